@@ -0,0 +1,48 @@
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/gdt.h>
+#include <libk/string.h>
+#include <libk/utils.h>
+#include <stddef.h>
+
+_Static_assert(offsetof(cpu_t, self) == CPU_SELF_OFFSET, "cpu_t layout");
+_Static_assert(offsetof(cpu_t, kernel_stack) == CPU_KERNEL_STACK_OFFSET, "cpu_t layout");
+_Static_assert(offsetof(cpu_t, user_rsp) == CPU_USER_RSP_OFFSET, "cpu_t layout");
+_Static_assert(offsetof(cpu_t, current) == CPU_CURRENT_OFFSET, "cpu_t layout");
+
+cpu_t cpus[MAX_CPUS];
+uint32_t cpu_count = 1;
+
+__attribute__((aligned(16)))
+static uint8_t ist_stacks[MAX_CPUS][IST_STACK_SIZE];
+
+// Point GS at this CPU's cpu_t. Must be redone after every load_gdt since
+// reloading the gs selector clears the base.
+void cpu_set_local(cpu_t *cpu) {
+    cpu->self = cpu;
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+void cpu_init_bsp(void) {
+    cpu_t *bsp = &cpus[0];
+    memset(bsp, 0, sizeof(cpu_t));
+    bsp->id = 0;
+    bsp->ist_stack = ist_stacks[0];
+    spinlock_init(&bsp->rq.lock);
+    gdt_init_cpu(bsp);
+    cpu_set_local(bsp);
+    bsp->online = 1;
+}
+
+// Prepare the cpu_t of an AP before it is started
+cpu_t *cpu_prepare_ap(uint32_t lapic_id) {
+    if (cpu_count >= MAX_CPUS) return NULL;
+    cpu_t *cpu = &cpus[cpu_count];
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->id = cpu_count;
+    cpu->lapic_id = lapic_id;
+    cpu->ist_stack = ist_stacks[cpu_count];
+    spinlock_init(&cpu->rq.lock);
+    cpu_count++;
+    return cpu;
+}
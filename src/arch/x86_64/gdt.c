@@ -1,16 +1,13 @@
 #include <arch/x86_64/gdt.h>
+#include <arch/x86_64/cpu.h>
 #include <libk/utils.h>
 #include <libk/string.h>
 
-// GDT with 7 entries: NULL, Kernel Code, Kernel Data, User Data, User Code, TSS (2 slots)
+// Every CPU gets its own GDT (cpu_t::gdt) with 7 entries:
+// NULL, Kernel Code, Kernel Data, User Data, User Code, TSS (2 slots)
+// The TSS descriptor has to be per-CPU since ltr marks it busy.
 // Note: In x86_64 sysret, User Data must come BEFORE User Code
-__attribute__((aligned(16)))
-gdt_entry_t gdt_entries[7];
-
-gdt_descriptor_t gdt;
-tss_t tss;
-
-static void gdt_set_entry(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+static void gdt_set_entry(gdt_entry_t *gdt_entries, int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
     gdt_entries[num].base0 = base & 0xFFFF;
     gdt_entries[num].base1 = (base >> 16) & 0xFF;
     gdt_entries[num].base2 = (base >> 24) & 0xFF;
@@ -19,7 +16,7 @@ static void gdt_set_entry(int num, uint32_t base, uint32_t limit, uint8_t access
     gdt_entries[num].access_byte = access;
 }
 
-static void gdt_set_tss(int num, uint64_t base, uint32_t limit) {
+static void gdt_set_tss(gdt_entry_t *gdt_entries, int num, uint64_t base, uint32_t limit) {
     tss_entry_t* tss_entry = (tss_entry_t*)&gdt_entries[num];
     
     tss_entry->limit0 = limit & 0xFFFF;
@@ -33,50 +30,62 @@ static void gdt_set_tss(int num, uint64_t base, uint32_t limit) {
 }
 
 void tss_set_kernel_stack(uint64_t stack) {
-    tss.rsp0 = stack;
+    cpu_t *cpu = this_cpu();
+    cpu->tss.rsp0 = stack;
+    cpu->kernel_stack = stack;
 }
 
-void init_gdt(){
+// Build and load the GDT and TSS of the calling CPU
+void gdt_init_cpu(cpu_t *cpu) {
+    tss_t *tss = &cpu->tss;
+    gdt_entry_t *gdt_entries = cpu->gdt;
+
     // Initialize TSS
-    memset(&tss, 0, sizeof(tss_t));
-    tss.iopb_offset = sizeof(tss_t);  // No I/O permission bitmap
+    memset(tss, 0, sizeof(tss_t));
+    tss->iopb_offset = sizeof(tss_t);  // No I/O permission bitmap
+    // IST1: private stack for the timer and reschedule vectors, so a context
+    // switch never copies frames on top of a task's own kernel stack
+    tss->ist1 = (uint64_t)cpu->ist_stack + IST_STACK_SIZE;
     
     // Entry 0: NULL segment
-    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(gdt_entries, 0, 0, 0, 0, 0);
     
     // Entry 1: Kernel Code (0x08) - DPL 0
     // Access: Present(1) | DPL(00) | Type(1) | Executable(1) | Conforming(0) | Readable(1) | Accessed(0)
     // = 0x9A
     // Flags: Granularity(1) | D/B(0) | Long mode(1) | AVL(0) = 0xA0
-    gdt_set_entry(1, 0, 0xFFFFF, 0x9A, 0xA0);
+    gdt_set_entry(gdt_entries, 1, 0, 0xFFFFF, 0x9A, 0xA0);
     
     // Entry 2: Kernel Data (0x10) - DPL 0
     // Access: Present(1) | DPL(00) | Type(1) | Executable(0) | Direction(0) | Writable(1) | Accessed(0)
     // = 0x92
     // Flags for data segment in 64-bit mode: G(1) | D/B(0) | L(0) | AVL(0) = 0x80
-    gdt_set_entry(2, 0, 0xFFFFF, 0x92, 0x80);
+    gdt_set_entry(gdt_entries, 2, 0, 0xFFFFF, 0x92, 0x80);
     
     // Entry 3: User Data (0x18) - DPL 3
     // Access: Present(1) | DPL(11) | Type(1) | Executable(0) | Direction(0) | Writable(1) | Accessed(0)
     // = 0xF2
     // Flags: G(1) | D/B(0) | L(0) | AVL(0) = 0x80
-    gdt_set_entry(3, 0, 0xFFFFF, 0xF2, 0x80);
+    gdt_set_entry(gdt_entries, 3, 0, 0xFFFFF, 0xF2, 0x80);
     
     // Entry 4: User Code (0x20) - DPL 3
     // Access: Present(1) | DPL(11) | Type(1) | Executable(1) | Conforming(0) | Readable(1) | Accessed(0)
     // = 0xFA
     // Flags: G(1) | D/B(0) | Long mode(1) | AVL(0) = 0xA0
-    gdt_set_entry(4, 0, 0xFFFFF, 0xFA, 0xA0);
+    gdt_set_entry(gdt_entries, 4, 0, 0xFFFFF, 0xFA, 0xA0);
     
     // Entry 5-6: TSS (0x28) - spans 2 entries in long mode
-    gdt_set_tss(5, (uint64_t)&tss, sizeof(tss_t) - 1);
+    gdt_set_tss(gdt_entries, 5, (uint64_t)tss, sizeof(tss_t) - 1);
     
     // GDT descriptor - 7 entries but TSS counts as 2
-    gdt.size = (sizeof(gdt_entry_t) * 7) - 1;
-    gdt.offset = (uint64_t)&gdt_entries;
+    cpu->gdtr.size = (sizeof(gdt_entry_t) * 7) - 1;
+    cpu->gdtr.offset = (uint64_t)cpu->gdt;
     
-    load_gdt(&gdt);
+    load_gdt(&cpu->gdtr);
     load_tss(GDT_TSS);
-    
+}
+
+void init_gdt(){
+    cpu_init_bsp();
     log("GDT", INFO,"Loaded with user-mode segments and TSS\\n\\r");
 }
@@ -16,10 +16,20 @@ void idt_set_gate(uint8_t num, uint64_t base, uint16_t sel, uint8_t flags){
     idt_entries[num].flags = flags;
 }
 
+// Run the handler on the given TSS interrupt stack (1-7, 0 = current stack)
+void idt_set_ist(uint8_t num, uint8_t ist){
+    idt_entries[num].ist = ist & 0x7;
+}
+
+// The IDT is shared, APs only need to load it
+void idt_load(){
+    asm volatile("lidt %0" : : "m"(idt));
+}
+
 void init_idt(){
     idt.limit = (sizeof(idt_entry_t) * 256) - 1;
     idt.base = (uint64_t)&idt_entries;
     memset(&idt_entries, 0, sizeof(idt_entry_t)*256);
-    asm volatile("lidt %0" : : "m"(idt));
+    idt_load();
     log("IDT", INFO, "Loaded.");
 }
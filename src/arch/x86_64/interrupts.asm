@@ -26,6 +26,25 @@ extern irq_handler
     jmp irq_common_stub
 %endmacro
 
+; Local APIC vectors (timer, IPIs), named after the vector number
+%macro APIC_IRQ 1
+  global apic_irq%1
+  apic_irq%1:
+    push 0
+    push %1
+    jmp irq_common_stub
+%endmacro
+
+; GS holds the per-CPU base in the kernel and the user's value in ring 3.
+; Swap on entry/exit only when the interrupted context was ring 3, the
+; argument is the stack offset of the saved CS.
+%macro swapgs_if_user 1
+    test qword [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 %macro save_regs 0
       push   rax
       push   rbx
@@ -64,22 +83,26 @@ extern irq_handler
 
 isr_common_stub:
     cld
+    swapgs_if_user 24
     save_regs
     mov rdi, rsp
     call fault_handler
     mov rsp, rax
     restore_regs
     add rsp, 16
+    swapgs_if_user 8
     iretq
 
 irq_common_stub:
     cld
+    swapgs_if_user 24
     save_regs
     mov rdi, rsp
     call irq_handler
     mov rsp, rax          ; Support context switch - use returned rsp
     restore_regs
     add rsp, 16
+    swapgs_if_user 8      ; CS of the context we are returning to
     iretq
 
 ISR_NOERRCODE 0
@@ -132,11 +155,18 @@ IRQ  13,      45
 IRQ  14,      46
 IRQ  15,      47
 
+APIC_IRQ 48
+APIC_IRQ 240
+APIC_IRQ 241
+APIC_IRQ 255
+
 ; Syscall handler (int 0x80)
 extern syscall_dispatch
 
 global syscall_stub
 syscall_stub:
+    cld                 ; int 0x80 keeps the user DF, the copy helpers need it clear
+    swapgs_if_user 8
     ; Save all registers (build register_t structure on stack)
     push 0              ; Error code placeholder
     push 0x80           ; Interrupt number (syscall)
@@ -151,6 +181,47 @@ syscall_stub:
     
     restore_regs
     add rsp, 16         ; Remove int_no and err_code
+    swapgs_if_user 8
+    iretq
+
+; SYSCALL entry. The CPU leaves the user rip in rcx, rflags in r11 and does
+; not switch stacks, so fetch the per-CPU kernel stack through GS first and
+; build the same register_t frame int 0x80 would.
+global syscall_entry
+syscall_entry:
+    swapgs
+    mov [gs:16], rsp    ; cpu_t.user_rsp
+    mov rsp, [gs:8]     ; cpu_t.kernel_stack
+    push 0x18 | 3       ; ss
+    push qword [gs:16]  ; rsp
+    push r11            ; rflags
+    push 0x20 | 3       ; cs
+    push rcx            ; rip
+    push 0              ; Error code placeholder
+    push 0x80           ; Same int_no as the int 0x80 path
+    save_regs
+
+    mov rdi, rsp
+    call syscall_dispatch
+    mov [rsp + 14*8], rax   ; Offset to saved rax in register_t
+
+    restore_regs
+    add rsp, 16         ; Remove int_no and err_code
+
+    ; The frame may have been rewritten (exec). sysret can only return to
+    ; 64-bit user code at a canonical address, anything else takes iretq.
+    cmp qword [rsp + 8], 0x20 | 3
+    jne .slow_return
+    mov r11, [rsp]
+    shr r11, 47
+    jnz .slow_return
+    mov rcx, [rsp]      ; rip
+    mov r11, [rsp + 16] ; rflags
+    mov rsp, [rsp + 24] ; user rsp
+    swapgs
+    o64 sysret
+.slow_return:
+    swapgs_if_user 8
     iretq
 
 ; Helper to jump to Ring 3 user mode
@@ -204,4 +275,5 @@ jump_to_usermode:
     xor r15, r15
     
     ; Switch to user mode!
+    swapgs
     iretq
\ No newline at end of file
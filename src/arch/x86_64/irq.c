@@ -1,5 +1,8 @@
 #include <arch/x86_64/idt.h>
+#include <arch/x86_64/lapic.h>
+#include <arch/x86_64/smp.h>
 #include <arch/ports.h>
+#include <kernel/sched/scheduler.h>
 #include <libk/utils.h>
 #include <libk/stdio.h>
 
@@ -19,6 +22,10 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void apic_irq48();
+extern void apic_irq240();
+extern void apic_irq241();
+extern void apic_irq255();
 
 void *interrupt_handlers[16] = {
     0, 0, 0, 0, 0, 0, 0, 0,
@@ -72,10 +79,41 @@ void init_irq(){
     idt_set_gate(45, (uint64_t)irq13, 0x08, 0x8E);
     idt_set_gate(46, (uint64_t)irq14, 0x08, 0x8E);
     idt_set_gate(47, (uint64_t)irq15, 0x08, 0x8E);
+
+    // Local APIC vectors: AP timer tick and inter-processor interrupts
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uint64_t)apic_irq48, 0x08, 0x8E);
+    idt_set_gate(IPI_RESCHEDULE, (uint64_t)apic_irq240, 0x08, 0x8E);
+    idt_set_gate(IPI_TLB_SHOOTDOWN, (uint64_t)apic_irq241, 0x08, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS, (uint64_t)apic_irq255, 0x08, 0x8E);
+
+    // Vectors that may switch tasks run on the per-CPU IST1 stack
+    idt_set_ist(32, 1);
+    idt_set_ist(LAPIC_TIMER_VECTOR, 1);
+    idt_set_ist(IPI_RESCHEDULE, 1);
     log("IRQ", INFO, "Initilaised.");
 }
 
+static void apic_vector_handler(register_t* regs){
+    switch (regs->int_no) {
+    case LAPIC_TIMER_VECTOR:
+    case IPI_RESCHEDULE:
+        schedule_tick(regs);
+        break;
+    case IPI_TLB_SHOOTDOWN:
+        smp_tlb_service();
+        break;
+    case LAPIC_SPURIOUS:
+        return;  // no EOI for spurious interrupts
+    }
+    lapic_eoi();
+}
+
 register_t* irq_handler(register_t* regs){
+    if (regs->int_no >= LAPIC_TIMER_VECTOR) {
+        apic_vector_handler(regs);
+        return regs;
+    }
+
     void (*handler)(register_t* regs);
     handler = interrupt_handlers[regs->int_no - 32];
     if(handler){
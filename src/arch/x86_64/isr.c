@@ -1,8 +1,12 @@
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/isr.h>
+#include <kernel/kmsg.h>
 #include <libk/stdio.h>
 #include <libk/utils.h>
 #include <libk/string.h>
+#include <mm/uaccess.h>
+#include <mm/vma.h>
+#include <kernel/sched/scheduler.h>
 
 extern void isr0();
 extern void isr1();
@@ -127,9 +131,34 @@ void isr_uninstall_handler(int isr){
     isr_handlers[isr] = 0;
 }
 
-void fault_handler(register_t* regs)
+register_t* fault_handler(register_t* regs)
 {
+    // Demand paging of user mappings, from user code or from a uaccess
+    // helper inside a syscall (which already holds the kernel lock)
+    if (regs->int_no == 14) {
+        uint64_t cr2;
+        asm volatile("mov %%cr2, %0" : "=r" (cr2));
+        if (cr2 < USER_SPACE_END) {
+            int held = kernel_lock_held();
+            if (!held) kernel_lock();
+            int ret = vma_fault(cr2, regs->err_code);
+            if (!held) kernel_unlock();
+            if (ret == 0) return regs;
+        }
+    }
+
+    // Kernel touching a bad user pointer from a uaccess helper: resume at
+    // its fixup, which reports -EFAULT to the syscall
+    if (regs->int_no == 14 && !(regs->cs & 3)) {
+        uint64_t fixup = search_exception_table(regs->rip);
+        if (fixup) {
+            regs->rip = fixup;
+            return regs;
+        }
+    }
+
     if (regs->int_no < 32) {
+        kmsg_panic();
         dbgln("\n\r==================================================\n\r");
         dbgln("FATAL EXCEPTION: %s (Interrupt %d)\n\r", exception_messages[regs->int_no], regs->int_no);
         
@@ -151,4 +180,5 @@ void fault_handler(register_t* regs)
         dbgln("==================================================\n\r");
         for (;;);
     }
+    return regs;
 }
@@ -0,0 +1,90 @@
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/lapic.h>
+#include <drivers/pit.h>
+#include <libk/utils.h>
+#include <mm/vmm.h>
+#include <stdint.h>
+
+#define LAPIC_REG_ID         0x020
+#define LAPIC_REG_TPR        0x080
+#define LAPIC_REG_EOI        0x0B0
+#define LAPIC_REG_SVR        0x0F0
+#define LAPIC_REG_ICR_LOW    0x300
+#define LAPIC_REG_ICR_HIGH   0x310
+#define LAPIC_REG_LVT_TIMER  0x320
+#define LAPIC_REG_TIMER_INIT 0x380
+#define LAPIC_REG_TIMER_CUR  0x390
+#define LAPIC_REG_TIMER_DIV  0x3E0
+
+#define LAPIC_SVR_ENABLE     (1 << 8)
+#define LAPIC_ICR_PENDING    (1 << 12)
+#define LAPIC_ICR_ASSERT     (1 << 14)   // Level bit, 0 only for INIT de-assert
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_MASKED   (1 << 16)
+
+static volatile uint8_t *lapic_base = NULL;
+// LAPIC timer counts (divide by 16) per PIT tick
+static uint32_t lapic_ticks_per_tick = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+  return *(volatile uint32_t *)(lapic_base + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+  *(volatile uint32_t *)(lapic_base + reg) = value;
+}
+
+// Enable the local APIC of the calling CPU. The first caller maps the
+// register page, all CPUs share the same physical base.
+void lapic_init(void) {
+  uint64_t base = rdmsr(MSR_APIC_BASE);
+  if (!lapic_base) {
+    lapic_base = vmm_map_mmio(base & ~0xFFFULL, 4096, PTE_PCD | PTE_PWT);
+    if (!lapic_base) {
+      log("LAPIC", ERROR, "Failed to map registers at 0x%xl\n\r", base & ~0xFFFULL);
+      return;
+    }
+  }
+  wrmsr(MSR_APIC_BASE, base | (1 << 11));
+  lapic_write(LAPIC_REG_TPR, 0);
+  lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS);
+}
+
+void lapic_eoi(void) {
+  lapic_write(LAPIC_REG_EOI, 0);
+}
+
+uint32_t lapic_id(void) {
+  return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_send_ipi(uint32_t id, uint8_t vector) {
+  if (!lapic_base) return;
+  while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING)
+    asm volatile("pause");
+  lapic_write(LAPIC_REG_ICR_HIGH, id << 24);
+  lapic_write(LAPIC_REG_ICR_LOW, vector | LAPIC_ICR_ASSERT);
+}
+
+// Measure the LAPIC timer against the PIT. Runs once on the BSP with
+// interrupts enabled, the result is reused by every AP.
+void lapic_timer_calibrate(void) {
+  lapic_write(LAPIC_REG_TIMER_DIV, 0x3);          // divide by 16
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_MASKED);
+
+  pit_wait(1);                                    // align to a tick edge
+  lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+  pit_wait(10);
+  uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CUR);
+  lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+  lapic_ticks_per_tick = elapsed / 10;
+  log("LAPIC", INFO, "Timer calibrated: %d counts per PIT tick\n\r", lapic_ticks_per_tick);
+}
+
+// Periodic timer at the PIT rate, used as the scheduler tick on APs
+void lapic_timer_start(void) {
+  lapic_write(LAPIC_REG_TIMER_DIV, 0x3);
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+  lapic_write(LAPIC_REG_TIMER_INIT, lapic_ticks_per_tick);
+}
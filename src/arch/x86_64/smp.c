@@ -0,0 +1,135 @@
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/gdt.h>
+#include <arch/x86_64/idt.h>
+#include <arch/x86_64/lapic.h>
+#include <arch/x86_64/smp.h>
+#include <arch/x86_64/syscall.h>
+#include <drivers/pit.h>
+#include <init/limine.h>
+#include <init/limine_req.h>
+#include <libk/utils.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+extern void enable_sse(void);
+
+// Serialises shootdown initiators, one mailbox round at a time
+static atomic_int shootdown_busy = 0;
+
+static void ap_entry(struct limine_smp_info *info) {
+  cpu_t *cpu = (cpu_t *)info->extra_argument;
+
+  enable_sse();
+  gdt_init_cpu(cpu);
+  cpu_set_local(cpu);
+  idt_load();
+  vmm_init_cpu();
+  vmm_switch_page_table(vmm_get_kernel_cr3());
+  lapic_init();
+  lapic_timer_start();
+  syscall_init_cpu();
+
+  log("SMP", INFO, "CPU %d (LAPIC %d) online\n\r", cpu->id, cpu->lapic_id);
+  __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+
+  // This loop becomes the CPU's idle context once tasks are placed here.
+  // Spare cycles go to zeroing frames ahead of time.
+  asm volatile("sti");
+  for (;;) {
+    if (!pmm_zero_pool_refill(16))
+      asm volatile("sti; hlt");
+  }
+}
+
+void init_smp(void) {
+  cpu_t *bsp = &cpus[0];
+
+  lapic_init();
+  bsp->lapic_id = lapic_id();
+  bsp->active_cr3 = vmm_get_cr3();
+
+  struct limine_smp_response *smp = smp_request.response;
+  if (!smp || smp->cpu_count <= 1) {
+    log("SMP", INFO, "Single CPU system\n\r");
+    return;
+  }
+
+  lapic_timer_calibrate();
+
+  for (uint64_t i = 0; i < smp->cpu_count; i++) {
+    struct limine_smp_info *info = smp->cpus[i];
+    if (info->lapic_id == smp->bsp_lapic_id) continue;
+
+    cpu_t *cpu = cpu_prepare_ap(info->lapic_id);
+    if (!cpu) {
+      log("SMP", ERROR, "More than %d CPUs, ignoring the rest\n\r", MAX_CPUS);
+      break;
+    }
+    info->extra_argument = (uint64_t)cpu;
+    __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_SEQ_CST);
+  }
+
+  // Give the APs up to a second to check in
+  uint64_t deadline = get_ticks() + 100;
+  uint32_t online = 1;
+  for (uint32_t i = 1; i < cpu_count; i++) {
+    while (!__atomic_load_n(&cpus[i].online, __ATOMIC_ACQUIRE) && get_ticks() < deadline)
+      asm volatile("pause");
+    if (cpus[i].online) online++;
+  }
+  log("SMP", INFO, "%d of %d CPUs online\n\r", online, (int)smp->cpu_count);
+}
+
+void smp_send_reschedule(cpu_t *cpu) {
+  if (!cpu || cpu == this_cpu() || !cpu->online) return;
+  lapic_send_ipi(cpu->lapic_id, IPI_RESCHEDULE);
+}
+
+void smp_tlb_service(void) {
+  cpu_t *cpu = this_cpu();
+  if (!__atomic_load_n(&cpu->tlb_pending, __ATOMIC_ACQUIRE)) return;
+  vmm_flush_tlb_local(cpu->tlb_addr, cpu->tlb_pages);
+  __atomic_store_n(&cpu->tlb_pending, 0, __ATOMIC_RELEASE);
+}
+
+void smp_tlb_shootdown(uint64_t cr3, uint64_t addr, size_t pages) {
+  // Before reading active_cr3 below: a CPU switching in concurrently either
+  // sees the stale mark or shows up as a target
+  if (cr3 != 0) vmm_pcid_mark_stale(cr3);
+  if (cpu_count <= 1) return;
+
+  cpu_t *self = this_cpu();
+  uint64_t pml4 = cr3 & 0x000ffffffffff000ULL;
+  uint64_t flags = irq_save_disable();
+
+  // Keep answering other initiators while waiting our turn, they may be
+  // spinning on us with interrupts off
+  while (atomic_exchange(&shootdown_busy, 1)) {
+    smp_tlb_service();
+    asm volatile("pause");
+  }
+
+  uint8_t targeted[MAX_CPUS] = {0};
+  for (uint32_t i = 0; i < cpu_count; i++) {
+    cpu_t *cpu = &cpus[i];
+    if (cpu == self || !cpu->online) continue;
+    if (cr3 != 0 && (cpu->active_cr3 & 0x000ffffffffff000ULL) != pml4) continue;
+
+    cpu->tlb_addr = addr;
+    cpu->tlb_pages = pages;
+    __atomic_store_n(&cpu->tlb_pending, 1, __ATOMIC_RELEASE);
+    lapic_send_ipi(cpu->lapic_id, IPI_TLB_SHOOTDOWN);
+    targeted[i] = 1;
+  }
+
+  for (uint32_t i = 0; i < cpu_count; i++) {
+    if (!targeted[i]) continue;
+    while (__atomic_load_n(&cpus[i].tlb_pending, __ATOMIC_ACQUIRE))
+      asm volatile("pause");
+  }
+
+  atomic_store(&shootdown_busy, 0);
+  irq_restore(flags);
+}
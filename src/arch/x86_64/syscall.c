@@ -1,4 +1,5 @@
 #include <arch/x86_64/syscall.h>
+#include <arch/x86_64/cpu.h>
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/gdt.h>
 #include <libk/utils.h>
@@ -12,27 +13,33 @@
 #include <stdint.h>
 
 extern void syscall_stub(void);
+extern void syscall_entry(void);
+
+#define EFER_SCE (1ULL << 0)
+// Flags cleared on entry: TF, IF, DF, NT, AC
+#define SYSCALL_RFLAGS_MASK 0x44700ULL
 
 syscall_handler_t syscall_handlers[MAX_SYSCALLS];
-register_t *current_syscall_regs = NULL;
 
 int64_t syscall_dispatch(register_t* regs) {
     uint64_t syscall_num = regs->rax;
-    current_syscall_regs = regs;
+    task_t *task = get_current_task();
     
-    if (syscall_num >= MAX_SYSCALLS || !syscall_handlers[syscall_num]) {
+    if (syscall_num >= MAX_SYSCALLS || !syscall_handlers[syscall_num] || !task) {
         dbgln("Unknown syscall: %d\n\r", (int)syscall_num);
-        current_syscall_regs = NULL;
         return -1;
     }
+    task->syscall_regs = regs;
     
     // Arguments are passed in: rdi, rsi, rdx, r10, r8, r9
     // (Linux x86_64 syscall convention, but r10 instead of rcx)
     syscall_handler_t handler = syscall_handlers[syscall_num];
+    kernel_lock();
     int64_t result = handler(regs->rdi, regs->rsi, regs->rdx, 
                    regs->r10, regs->r8, regs->r9);
+    kernel_unlock();
     
-    current_syscall_regs = NULL;
+    task->syscall_regs = NULL;
     return result;
 }
 
@@ -42,6 +49,17 @@ void syscall_register(uint32_t num, syscall_handler_t handler) {
     }
 }
 
+// Program the SYSCALL MSRs of the calling CPU. STAR[47:32] is the kernel
+// CS (SS = +8), STAR[63:48] the base sysret adds to: user CS = +16, SS = +8,
+// which is why user data sits right before user code in the GDT.
+void syscall_init_cpu(void) {
+    wrmsr(MSR_STAR, ((uint64_t)(GDT_KERNEL_DATA | RING_USER) << 48) |
+                    ((uint64_t)GDT_KERNEL_CODE << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_SFMASK, SYSCALL_RFLAGS_MASK);
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
+
 void init_syscalls(void) {
     memset(syscall_handlers, 0, sizeof(syscall_handlers));
     
@@ -65,9 +83,17 @@ void init_syscalls(void) {
     syscall_register(SYS_MKDIR, sys_mkdir);
     syscall_register(SYS_UNLINK, sys_unlink);
     syscall_register(SYS_LSEEK, sys_lseek);
-    // Set up interrupt 0x80 for syscalls
+    syscall_register(SYS_GETPID, sys_getpid);
+    syscall_register(SYS_IO_SETUP, sys_io_setup);
+    syscall_register(SYS_IO_ENTER, sys_io_enter);
+    syscall_register(SYS_MPROTECT, sys_mprotect);
+    syscall_register(SYS_MSYNC, sys_msync);
+
+    syscall_init_cpu();
+
+    // int 0x80 stays as a compatibility path
     // Flags: 0xEE = Present(1) | DPL(11) | Type(01110) = interrupt gate accessible from Ring 3
     idt_set_gate(0x80, (uint64_t)syscall_stub, GDT_KERNEL_CODE, 0xEE);
     
-    log("SYSCALL", INFO, "syscalls initialized (int 0x80)\n\r");
+    log("SYSCALL", INFO, "syscalls initialized (syscall, int 0x80)\n\r");
 }
@@ -5,6 +5,8 @@
 #include <libk/string.h>
 #include <kernel/vfs/vfs.h>
 #include <arch/x86_64/regs.h>
+#include <mm/uaccess.h>
+#include <mm/liballoc.h>
 
 struct user_stat {
     uint32_t st_ino;
@@ -24,19 +26,15 @@ int64_t sys_write(uint64_t fd, uint64_t buf, uint64_t count,
                   uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg4; (void)arg5; (void)arg6;
     
-    // TODO: validate user pointer
     const char* user_buf = (const char*)buf;
+    if (!user_buffer_ok(user_buf, count, 0)) return -EFAULT;
     
     // FIXME: this is probably redundant as we can just write to /ttyX files
     if (fd == 1 || fd == 2) {
         // stdout or stderr - write to current TTY
         tty_t* tty = get_current_tty();
-        if (tty) {
-            for (size_t i = 0; i < count; i++) {
-                tty_putchar(user_buf[i]);
-            }
-            return (int64_t)count;
-        }
+        if (tty)
+            return tty_write_user(user_buf, count);
         return -1;
     }
     
@@ -54,6 +52,7 @@ int64_t sys_read(uint64_t fd, uint64_t buf, uint64_t count,
                  uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg4; (void)arg5; (void)arg6;
     char* user_buf = (char*)buf;
+    if (!user_buffer_ok(user_buf, count, 1)) return -EFAULT;
 
     task_t *current = get_current_task();
     if (!current) return -1;
@@ -76,11 +75,8 @@ int64_t sys_read(uint64_t fd, uint64_t buf, uint64_t count,
 #define ENOENT 2
 
 
-int64_t sys_open(uint64_t path_ptr, uint64_t flags, uint64_t mode,
-                 uint64_t arg4, uint64_t arg5, uint64_t arg6) {
-    (void)mode; (void)arg4; (void)arg5; (void)arg6;
-    log("SYS_OPEN",INFO,"path='%s', flags=0x%xl (decimal %d)\n\r", (const char*)path_ptr, flags, flags);
-    const char *path = (const char*)path_ptr;
+static int64_t do_open(const char *path, uint64_t flags, uint64_t mode) {
+    log("SYS_OPEN",INFO,"path='%s', flags=0x%xl (decimal %d)\n\r", path, flags, flags);
     task_t *current = get_current_task();
     
     if (!current || !path) return -1;
@@ -125,6 +121,16 @@ int64_t sys_open(uint64_t path_ptr, uint64_t flags, uint64_t mode,
     return fd;
 }
 
+int64_t sys_open(uint64_t path_ptr, uint64_t flags, uint64_t mode,
+                 uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    (void)arg4; (void)arg5; (void)arg6;
+    char *path = getname(path_ptr);
+    if (!path) return -EFAULT;
+    int64_t ret = do_open(path, flags, mode);
+    kfree(path);
+    return ret;
+}
+
 int64_t sys_close(uint64_t fd, uint64_t arg2, uint64_t arg3,
                   uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
@@ -151,14 +157,17 @@ int64_t sys_mkdir(uint64_t path_ptr, uint64_t mode, uint64_t arg3,
                   uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)mode; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
     
-    const char *path = (const char*)path_ptr;
     task_t *current = get_current_task();
-    
-    if (!current || !path) return -1;
+    if (!current) return -1;
+
+    char *path = getname(path_ptr);
+    if (!path) return -EFAULT;
     
     log("SYS_MKDIR", INFO, "path='%s'", path);
     
-    if (vfs_mkdir(path) != 0) {
+    int ret = vfs_mkdir(path);
+    kfree(path);
+    if (ret != 0) {
         return -1;     
     }
 
@@ -204,19 +213,21 @@ int64_t sys_stat(uint64_t path_ptr, uint64_t buf_ptr, uint64_t arg3,
                  uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg3; (void)arg4; (void)arg5; (void)arg6;
     
-    const char *path = (const char*)path_ptr;
-    struct user_stat *buf = (struct user_stat*)buf_ptr;
-    
-    if (!path || !buf) return -1;
+    if (!buf_ptr) return -1;
+    char *path = getname(path_ptr);
+    if (!path) return -EFAULT;
     
     // Look up path in VFS
     inode_t *inode = NULL;
-    if (vfs_lookup_path(path, &inode) != 0 || !inode) {
+    int ret = vfs_lookup_path(path, &inode);
+    kfree(path);
+    if (ret != 0 || !inode) {
         return -1;
     }
     
-    fill_stat_from_inode(buf, inode);
-    return 0;
+    struct user_stat st;
+    fill_stat_from_inode(&st, inode);
+    return copy_to_user((void*)buf_ptr, &st, sizeof(st));
 }
 
 // fstat - get file status by file descriptor
@@ -224,8 +235,6 @@ int64_t sys_fstat(uint64_t fd, uint64_t buf_ptr, uint64_t arg3,
                   uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg3; (void)arg4; (void)arg5; (void)arg6;
     
-    struct user_stat *buf = (struct user_stat*)buf_ptr;
-    
     task_t *current = get_current_task();
     if (!current || fd >= MAX_FDS || !current->fd_table[fd]) {
         return -1;
@@ -236,8 +245,9 @@ int64_t sys_fstat(uint64_t fd, uint64_t buf_ptr, uint64_t arg3,
         return -1;
     }
     
-    fill_stat_from_inode(buf, f->inode);
-    return 0;
+    struct user_stat st;
+    fill_stat_from_inode(&st, f->inode);
+    return copy_to_user((void*)buf_ptr, &st, sizeof(st));
 }
 
 int64_t sys_getdents64(uint64_t fd, uint64_t buf_ptr, uint64_t count,
@@ -261,6 +271,7 @@ int64_t sys_getdents64(uint64_t fd, uint64_t buf_ptr, uint64_t count,
         return -1;
     }
 
+    if (!user_buffer_ok((void*)buf_ptr, count, 1)) return -EFAULT;
     return inode->i_ops->getdents(inode, &f->offset, (void*)buf_ptr, count);
 }
 
@@ -269,10 +280,12 @@ int64_t sys_chdir(uint64_t path_ptr, uint64_t arg2, uint64_t arg3,
                   uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
     
-    const char *path = (const char *)path_ptr;
-    if (!path) return -1;
+    char *path = getname(path_ptr);
+    if (!path) return -EFAULT;
     
-    return vfs_chdir(path);
+    int ret = vfs_chdir(path);
+    kfree(path);
+    return ret;
 }
 
 int64_t sys_getcwd(uint64_t buf_ptr, uint64_t size, uint64_t arg3,
@@ -281,6 +294,7 @@ int64_t sys_getcwd(uint64_t buf_ptr, uint64_t size, uint64_t arg3,
     
     char *buf = (char *)buf_ptr;
     if (!buf || size == 0) return -1;
+    if (!user_buffer_ok(buf, size, 1)) return -EFAULT;
     
     if (vfs_getcwd(buf, size) != 0) {
         return -1;
@@ -293,10 +307,12 @@ int64_t sys_unlink(uint64_t path_ptr, uint64_t arg2, uint64_t arg3,
                    uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
     
-    const char *path = (const char*)path_ptr;
-    if (!path) return -1;
+    char *path = getname(path_ptr);
+    if (!path) return -EFAULT;
     
-    if (vfs_unlink(path) != 0) {
+    int ret = vfs_unlink(path);
+    kfree(path);
+    if (ret != 0) {
         return -ENOENT;
     }
     return 0;
@@ -0,0 +1,181 @@
+#include <arch/x86_64/syscall.h>
+#include <arch/x86_64/ioring.h>
+#include <kernel/sched/scheduler.h>
+#include <mm/uaccess.h>
+#include <libk/utils.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EINVAL 22
+#define EBUSY  16
+
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+
+// SQEs start right after the header, CQEs after the SQEs. The offsets are
+// recomputed from the entry count kept in the task rather than trusted
+// from the user-writable header.
+#define IORING_SQ_OFF 64
+
+static uint32_t ioring_cq_off(uint32_t entries) {
+    return IORING_SQ_OFF + entries * sizeof(io_sqe_t);
+}
+
+static uint64_t ioring_size(uint32_t entries) {
+    return ioring_cq_off(entries) + 2 * entries * sizeof(io_cqe_t);
+}
+
+// Write an empty header for a ring of `entries` SQEs, 0 or -EFAULT
+static int ioring_reset(uint64_t uring, uint32_t entries) {
+    io_ring_t ring = {
+        .sq_entries = entries,
+        .sq_off = IORING_SQ_OFF,
+        .cq_entries = entries * 2,
+        .cq_off = ioring_cq_off(entries),
+    };
+    return copy_to_user((void*)uring, &ring, sizeof(ring));
+}
+
+void ioring_forget(task_t *t, uint64_t start, uint64_t end) {
+    if (t->ioring && start < t->ioring + ioring_size(t->ioring_entries) &&
+        end > t->ioring)
+        t->ioring = 0;
+}
+
+// Map the ring into the calling task and return its user address. Calling
+// it again hands back the existing ring, emptied, as long as it is big
+// enough. exec and unmapping the ring forget it, the next call maps a new
+// one.
+int64_t sys_io_setup(uint64_t entries, uint64_t arg2, uint64_t arg3,
+                     uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
+    task_t *current = get_current_task();
+    if (!current || !current->cr3) return -1;
+    if (entries == 0 || entries > IORING_MAX_ENTRIES) return -EINVAL;
+
+    uint32_t n = 8;
+    while (n < entries) n <<= 1;
+
+    if (current->ioring) {
+        if (n > current->ioring_entries) return -EBUSY;
+        if (ioring_reset(current->ioring, current->ioring_entries) != 0) return -EFAULT;
+        return (int64_t)current->ioring;
+    }
+
+    int64_t addr = sys_mmap(0, ioring_size(n), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+    if (addr < 0) return addr;
+    if (ioring_reset((uint64_t)addr, n) != 0) return -EFAULT;
+
+    current->ioring = (uint64_t)addr;
+    current->ioring_entries = n;
+    log("IORING", INFO, "task %d: %d entries at 0x%xl\n\r", current->id, n, addr);
+    return addr;
+}
+
+static int64_t ioring_issue(const io_sqe_t *sqe, int64_t prev) {
+    uint64_t len = sqe->len;
+    if (sqe->flags & IOSQE_LEN_FROM_PREV) len = (uint64_t)prev;
+
+    switch (sqe->opcode) {
+    case IORING_OP_NOP:
+        return 0;
+    case IORING_OP_READ:
+        return sys_read((uint64_t)sqe->fd, sqe->addr, len, 0, 0, 0);
+    case IORING_OP_WRITE:
+        return sys_write((uint64_t)sqe->fd, sqe->addr, len, 0, 0, 0);
+    case IORING_OP_OPEN:
+        return sys_open(sqe->addr, sqe->op_flags, 0, 0, 0, 0);
+    case IORING_OP_CLOSE:
+        return sys_close((uint64_t)sqe->fd, 0, 0, 0, 0, 0);
+    case IORING_OP_STAT:
+        return sys_stat(sqe->addr, sqe->addr2, 0, 0, 0, 0);
+    case IORING_OP_FSTAT:
+        return sys_fstat((uint64_t)sqe->fd, sqe->addr, 0, 0, 0, 0);
+    case IORING_OP_GETDENTS64:
+        return sys_getdents64((uint64_t)sqe->fd, sqe->addr, len, 0, 0, 0);
+    default:
+        return -EINVAL;
+    }
+}
+
+// The ring lives in user memory the task can unmap or scribble over at
+// any time, so every access goes through the uaccess helpers
+static int ring_get(uint64_t ring, size_t off, uint32_t *val) {
+    return copy_from_user(val, (uint8_t*)ring + off, sizeof(*val));
+}
+
+static int ring_put(uint64_t ring, size_t off, uint32_t val) {
+    return copy_to_user((uint8_t*)ring + off, &val, sizeof(val));
+}
+
+// Consume up to to_submit SQEs and post a CQE for each. Everything runs
+// synchronously, so the CQEs are there when this returns. Stops early when
+// the CQ is full; returns the number of SQEs consumed, or -EFAULT if the
+// ring is no longer accessible.
+int64_t sys_io_enter(uint64_t to_submit, uint64_t arg2, uint64_t arg3,
+                     uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
+    task_t *current = get_current_task();
+    if (!current || !current->ioring) return -EINVAL;
+
+    uint64_t ring = current->ioring;
+    uint32_t entries = current->ioring_entries;
+    io_sqe_t *sq = (io_sqe_t*)(ring + IORING_SQ_OFF);
+    io_cqe_t *cq = (io_cqe_t*)(ring + ioring_cq_off(entries));
+
+    uint32_t head, tail;
+    if (ring_get(ring, offsetof(io_ring_t, sq_head), &head) != 0 ||
+        ring_get(ring, offsetof(io_ring_t, sq_tail), &tail) != 0)
+        return -EFAULT;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (tail - head > entries) return -EINVAL;
+
+    uint64_t submitted = 0;
+    int64_t prev = 0;
+    int cancel = 0;
+
+    while (submitted < to_submit && head != tail) {
+        uint32_t cq_head, cq_tail;
+        if (ring_get(ring, offsetof(io_ring_t, cq_head), &cq_head) != 0 ||
+            ring_get(ring, offsetof(io_ring_t, cq_tail), &cq_tail) != 0)
+            return -EFAULT;
+        if (cq_tail - cq_head >= entries * 2) break;
+
+        io_sqe_t sqe;
+        if (copy_from_user(&sqe, &sq[head & (entries - 1)], sizeof(sqe)) != 0)
+            return -EFAULT;
+        int64_t res = cancel ? -IORING_ECANCELED : ioring_issue(&sqe, prev);
+
+        io_cqe_t cqe = { .user_data = sqe.user_data, .res = res };
+        if (copy_to_user(&cq[cq_tail & (entries * 2 - 1)], &cqe, sizeof(cqe)) != 0)
+            return -EFAULT;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (ring_put(ring, offsetof(io_ring_t, cq_tail), cq_tail + 1) != 0 ||
+            ring_put(ring, offsetof(io_ring_t, sq_head), ++head) != 0)
+            return -EFAULT;
+        submitted++;
+
+        if (sqe.flags & IOSQE_LINK) {
+            // A short WRITE breaks the chain too, whatever follows it
+            // would land in the wrong place
+            uint64_t len = (sqe.flags & IOSQE_LEN_FROM_PREV) ? (uint64_t)prev : sqe.len;
+            cancel = res < 0 || (sqe.opcode == IORING_OP_WRITE && (uint64_t)res < len);
+            prev = res;
+        } else {
+            cancel = 0;
+            prev = 0;
+        }
+    }
+
+    uint64_t stats[2];
+    if (copy_from_user(stats, (uint8_t*)ring + offsetof(io_ring_t, nr_enters), sizeof(stats)) != 0)
+        return -EFAULT;
+    stats[0]++;
+    stats[1] += submitted;
+    if (copy_to_user((uint8_t*)ring + offsetof(io_ring_t, nr_enters), stats, sizeof(stats)) != 0)
+        return -EFAULT;
+    return (int64_t)submitted;
+}
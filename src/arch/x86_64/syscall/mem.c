@@ -2,14 +2,19 @@
 #include <kernel/vfs/vfs.h>
 #include <mm/vmm.h>
 #include <mm/pmm.h>
+#include <mm/vma.h>
 #include <arch/x86_64/syscall.h>
+#include <mm/uaccess.h>
 #include <libk/utils.h>
 #include <stdint.h>
 #include <string.h>
 #define EPERM    1
 #define ENOENT   2
 #define ESRCH    3
+#define EBADF    9
 #define ENOMEM  12
+#define EACCES  13
+#define ENODEV  19
 #define EINVAL  22
 #define ENOSYS  38
 /* mmap protection flags */
@@ -26,6 +31,11 @@
 
 #define MAP_FAILED    ((void *)-1)
 
+/* msync flags */
+#define MS_ASYNC      0x1
+#define MS_INVALIDATE 0x2
+#define MS_SYNC       0x4
+
 // The below was obtained from multiple sources such as osdev wiki
 /*
  * Virtual address space layout (user-space):
@@ -34,20 +44,23 @@
  *   brk_start            set by ELF loader to page-aligned end of BSS
  *   brk_current          moves up as malloc/brk expands the heap
  *   ...
- *   0x00007F0000000000   mmap region grows downward from here
+ *   0x00007F0000000000   mmap region, lowest free gap first
+ *   0x00007FFF00000000   end of the mmap region
+ *   0x00007FFFF0000000   user stack
  *   0x00007FFFFFFFFFFF   top of canonical user space
  *
  * brk_start is stored in task_t and set during ELF loading.
  * USER_HEAP_FALLBACK is only used if the ELF loader didn't set it
  * (e.g. a hand-crafted test binary).
  *
- * task_t fields required:
- *   uint64_t  brk_start;    -- set by ELF loader, page-aligned end of BSS
- *   uint64_t  brk_current;  -- current break pointer
- *   uint64_t  mmap_base;    -- per-process mmap bump pointer
+ * Every mapping is recorded in task->vmas, which is where mmap looks for
+ * free space and what munmap and mprotect split. Anonymous mappings are
+ * populated up front; file mappings are faulted in from the page cache
+ * (mm/fault.c).
  */
 #define USER_HEAP_FALLBACK  0x0000000001000000ULL   /* 16 MiB, well clear of ELF */
-#define MMAP_BASE           0x00007F0000000000ULL   /* top of user mmap region */
+#define MMAP_BASE           0x00007F0000000000ULL   /* bottom of user mmap region */
+#define MMAP_END            0x00007FFF00000000ULL
 
 /* Page helpers */
 #define PAGE_MASK           (~(PAGE_SIZE - 1))
@@ -89,21 +102,49 @@ static uint64_t prot_to_flags(uint64_t prot)
     return flags;
 }
 
+static void unmap_pages(uint64_t cr3, uint64_t vaddr, size_t num_pages)
+{
+    /* One walk, huge pages split only where the range cuts them */
+    vmm_unmap_range(cr3, vaddr, num_pages, 1);
+}
+
+/*
+ * Back [vaddr, vaddr + 2 MiB) with one huge page. Returns -1 when no
+ * aligned physical run is free, the caller then uses small pages.
+ */
+static int map_huge_page(uint64_t cr3, uint64_t vaddr, uint64_t flags)
+{
+    void *frame = pmalloc_aligned(HUGE_PAGE_PAGES, HUGE_PAGE_PAGES);
+    if (!frame)
+        return -1;
+
+    memset(frame, 0, HUGE_PAGE_SIZE);
+    if (vmm_map_huge_in(cr3, (void *)vaddr, phys_from_virt(frame), flags) != 0) {
+        pmm_free_pages(frame, HUGE_PAGE_PAGES);
+        return -1;
+    }
+    return 0;
+}
+
 static int map_pages(uint64_t cr3, uint64_t vaddr, size_t num_pages, uint64_t flags)
 {
     size_t mapped = 0;
 
     for (size_t i = 0; i < num_pages; i++) {
-        void *page = pmalloc(1);
+        uint64_t va = vaddr + i * PAGE_SIZE;
+        if ((va & (HUGE_PAGE_SIZE - 1)) == 0 && num_pages - i >= HUGE_PAGE_PAGES &&
+            map_huge_page(cr3, va, flags) == 0) {
+            i      += HUGE_PAGE_PAGES - 1;
+            mapped += HUGE_PAGE_PAGES;
+            continue;
+        }
+
+        void *page = pcalloc(1);
         if (!page)
             goto oom;
 
-        memset(page, 0, PAGE_SIZE);
-
         void *phys = phys_from_virt(page);
-        if (vmm_map_page_in(cr3,
-                            (void *)(vaddr + i * PAGE_SIZE),
-                            phys, flags) != 0) {
+        if (vmm_map_page_in(cr3, (void *)va, phys, flags) != 0) {
             pmm_free_pages(page, 1);
             goto oom;
         }
@@ -115,25 +156,10 @@ static int map_pages(uint64_t cr3, uint64_t vaddr, size_t num_pages, uint64_t fl
 
 oom:
     /* Roll back all successfully mapped pages */
-    for (size_t i = 0; i < mapped; i++) {
-        void *phys = vmm_unmap_page_in(cr3,
-                                       (void *)(vaddr + i * PAGE_SIZE));
-        if (phys)
-            pmm_free_pages(virt_from_phys(phys), 1);
-    }
+    unmap_pages(cr3, vaddr, mapped);
     return -ENOMEM;
 }
 
-static void unmap_pages(uint64_t cr3, uint64_t vaddr, size_t num_pages)
-{
-    for (size_t i = 0; i < num_pages; i++) {
-        void *phys = vmm_unmap_page_in(cr3,
-                                       (void *)(vaddr + i * PAGE_SIZE));
-        if (phys)
-            pmm_free_pages(virt_from_phys(phys), 1);
-    }
-}
-
 int64_t sys_brk(uint64_t addr, uint64_t arg2, uint64_t arg3,
                 uint64_t arg4, uint64_t arg5, uint64_t arg6)
 {
@@ -145,7 +171,7 @@ int64_t sys_brk(uint64_t addr, uint64_t arg2, uint64_t arg3,
         current->brk_start   = USER_HEAP_FALLBACK;
         current->brk_current = USER_HEAP_FALLBACK;
     }
-    log("SYS_BRK", INFO, "task %d: addr=0x%xl brk_start=0x%xl brk_current=0x%xl\n\r",
+    log("SYS_BRK", VERBOSE, "task %d: addr=0x%xl brk_start=0x%xl brk_current=0x%xl\n\r",
         current->id, addr, current->brk_start, current->brk_current);
 
     if (addr == 0)
@@ -163,23 +189,34 @@ int64_t sys_brk(uint64_t addr, uint64_t arg2, uint64_t arg3,
         if (map_end > map_start) {
             size_t   n     = (map_end - map_start) / PAGE_SIZE;
             uint64_t flags = prot_to_flags(PROT_READ | PROT_WRITE);
-            log("SYS_BRK", INFO, "task %d: mapping %ul pages [0x%xl - 0x%xl)\n\r",
+            log("SYS_BRK", VERBOSE, "task %d: mapping %ul pages [0x%xl - 0x%xl)\n\r",
                 current->id, n, map_start, map_end);
+            if (!vma_range_free(&current->vmas, map_start, map_end)) {
+                log("SYS_BRK", ERROR, "task %d: heap would run into a mapping\n\r", current->id);
+                return (int64_t)old_brk;
+            }
             if (map_pages(current->cr3, map_start, n, flags) != 0) {
                 log("SYS_BRK", ERROR, "task %d: map_pages FAILED\n\r", current->id);
                 return (int64_t)old_brk;
             }
+            if (vma_map(&current->vmas, map_start, map_end, VMA_READ | VMA_WRITE,
+                        VMA_HEAP, NULL, 0) != 0) {
+                unmap_pages(current->cr3, map_start, n);
+                return (int64_t)old_brk;
+            }
         }
     } else if (new_brk < old_brk) {
         uint64_t unmap_start = PAGE_ALIGN_UP(new_brk);
         uint64_t unmap_end   = PAGE_ALIGN_UP(old_brk);
         if (unmap_end > unmap_start) {
             size_t n = (unmap_end - unmap_start) / PAGE_SIZE;
+            if (vma_unmap(&current->vmas, unmap_start, unmap_end) != 0)
+                return (int64_t)old_brk;
             unmap_pages(current->cr3, unmap_start, n);
         }
     }
     current->brk_current = new_brk;
-    log("SYS_BRK", INFO, "task %d: SUCCESS new brk_current=0x%xl\n\r",
+    log("SYS_BRK", VERBOSE, "task %d: SUCCESS new brk_current=0x%xl\n\r",
         current->id, current->brk_current);
     return (int64_t)new_brk;
 }
@@ -187,15 +224,16 @@ int64_t sys_brk(uint64_t addr, uint64_t arg2, uint64_t arg3,
 /* -------------------------------------------------------------------------
  * sys_mmap - map memory into the process address space.
  *
- * Currently only anonymous mappings are supported (MAP_ANONYMOUS).
- * The per-process bump pointer lives in task->mmap_base (add this field
- * to task_t; it is initialized to MMAP_BASE on first use).
+ * MAP_ANONYMOUS mappings get zeroed pages right away. File mappings only
+ * record the area; pages come from the file's page cache on first touch,
+ * shared with every other mapper for MAP_SHARED and copied on the first
+ * write for MAP_PRIVATE.
+ * Without MAP_FIXED the hint is used if it is free, otherwise the lowest
+ * gap of the mmap region that fits is taken, so unmapped holes are reused.
  * ---------------------------------------------------------------------- */
 int64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot,
                  uint64_t flags, uint64_t fd, uint64_t offset)
 {
-    (void)fd; (void)offset;
-
     task_t *current = get_current_task();
     if (!current || !current->cr3)
         return -ESRCH;
@@ -203,41 +241,67 @@ int64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot,
     if (length == 0)
         return -EINVAL;
 
-    if (!(flags & MAP_ANONYMOUS)) {
-        log("SYS_MMAP", ERROR ,"file-backed mappings not yet supported\n\r");
-        return -ENOSYS;
-    }
-
     if (!(flags & (MAP_PRIVATE | MAP_SHARED)))
         return -EINVAL;
 
+    inode_t *inode = NULL;
+    if (!(flags & MAP_ANONYMOUS)) {
+        if (fd >= MAX_FDS || !current->fd_table[fd])
+            return -EBADF;
+        if (offset & ~PAGE_MASK)
+            return -EINVAL;
+        inode = current->fd_table[fd]->inode;
+        if (!inode || inode->type != FT_REG || !inode->f_ops || !inode->f_ops->read)
+            return -ENODEV;
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !inode->f_ops->write)
+            return -EACCES;
+    }
+
     size_t   num_pages  = PAGE_ALIGN_UP(length) / PAGE_SIZE;
+    uint64_t size       = num_pages * PAGE_SIZE;
     uint64_t page_flags = prot_to_flags(prot);
-    uint64_t vaddr;
+    uint64_t vaddr      = 0;
 
     if (flags & MAP_FIXED) {
-        /*
-         * TODO: unmap any existing mapping in [addr, addr + length).
-         */
-        if (addr == 0 || (addr & ~PAGE_MASK))
+        if (addr == 0 || (addr & ~PAGE_MASK) || !access_ok((void *)addr, size))
             return -EINVAL;
 
+        /* Whatever was mapped there is replaced */
+        ioring_forget(current, addr, addr + size);
+        vma_writeback(&current->vmas, current->cr3, addr, addr + size);
+        if (vma_unmap(&current->vmas, addr, addr + size) != 0)
+            return -ENOMEM;
+        unmap_pages(current->cr3, addr, num_pages);
         vaddr = addr;
 
     } else if (addr != 0) {
-        vaddr = PAGE_ALIGN_DOWN(addr);
+        uint64_t hint = PAGE_ALIGN_DOWN(addr);
+        if (access_ok((void *)hint, size) &&
+            vma_range_free(&current->vmas, hint, hint + size))
+            vaddr = hint;
+    }
 
-    } else {
-        if (current->mmap_base == 0)
-            current->mmap_base = MMAP_BASE;
+    if (!vaddr) {
+        /* Regions of a huge page or more start 2 MiB aligned so map_pages
+         * can back them with huge pages */
+        uint64_t align = !inode && num_pages >= HUGE_PAGE_PAGES ? HUGE_PAGE_SIZE : PAGE_SIZE;
+        vaddr = vma_find_gap(&current->vmas, size, align, MMAP_BASE, MMAP_END);
+        if (!vaddr)
+            return -ENOMEM;
+    }
 
-        vaddr               = current->mmap_base;
-        current->mmap_base += num_pages * PAGE_SIZE;
+    if (!inode) {
+        int ret = map_pages(current->cr3, vaddr, num_pages, page_flags);
+        if (ret != 0)
+            return ret;   /* -ENOMEM, with all partial pages already cleaned up */
     }
 
-    int ret = map_pages(current->cr3, vaddr, num_pages, page_flags);
-    if (ret != 0)
-        return ret;   /* -ENOMEM, with all partial pages already cleaned up */
+    uint32_t vma_flags = (flags & MAP_SHARED) ? VMA_SHARED : 0;
+    if (vma_map(&current->vmas, vaddr, vaddr + size,
+                prot & (VMA_READ | VMA_WRITE | VMA_EXEC), vma_flags, inode, offset) != 0) {
+        unmap_pages(current->cr3, vaddr, num_pages);
+        return -ENOMEM;
+    }
 
     log("SYS_MMAP",INFO, "mapped %ul pages at 0x%xl\n\r", num_pages, vaddr);
     return (int64_t)vaddr;
@@ -253,11 +317,74 @@ int64_t sys_munmap(uint64_t addr, uint64_t length, uint64_t arg3,
         return -ESRCH;
 
     /* addr must be page-aligned and non-zero; length must be non-zero */
-    if (addr == 0 || (addr & ~PAGE_MASK) || length == 0)
+    if (addr == 0 || (addr & ~PAGE_MASK) || length == 0 ||
+        !access_ok((void*)addr, length))
         return -EINVAL;
 
     size_t num_pages = PAGE_ALIGN_UP(length) / PAGE_SIZE;
+    vma_writeback(&current->vmas, current->cr3, addr, addr + num_pages * PAGE_SIZE);
+    if (vma_unmap(&current->vmas, addr, addr + num_pages * PAGE_SIZE) != 0)
+        return -ENOMEM;
     unmap_pages(current->cr3, addr, num_pages);
+    ioring_forget(current, addr, addr + num_pages * PAGE_SIZE);
+
+    return 0;
+}
+
+/* Write the dirty pages of shared file mappings in the range back to
+ * their files. Writeback is synchronous, so MS_ASYNC behaves as MS_SYNC
+ * and MS_INVALIDATE has nothing to drop: the cache is the only copy. */
+int64_t sys_msync(uint64_t addr, uint64_t length, uint64_t flags,
+                  uint64_t arg4, uint64_t arg5, uint64_t arg6)
+{
+    (void)arg4; (void)arg5; (void)arg6;
+
+    task_t *current = get_current_task();
+    if (!current || !current->cr3)
+        return -ESRCH;
+
+    if ((addr & ~PAGE_MASK) || !access_ok((void*)addr, length) ||
+        (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)) ||
+        ((flags & MS_ASYNC) && (flags & MS_SYNC)))
+        return -EINVAL;
+
+    uint64_t end = addr + PAGE_ALIGN_UP(length);
+    if (!vma_range_mapped(&current->vmas, addr, end))
+        return -ENOMEM;
+    vma_writeback(&current->vmas, current->cr3, addr, end);
+
+    return 0;
+}
+
+/* Change the protection of a mapped range: one table walk and one TLB
+ * flush per area it covers. Cache pages behind a MAP_PRIVATE file area
+ * stay read-only, the first write still has to copy them. */
+int64_t sys_mprotect(uint64_t addr, uint64_t length, uint64_t prot,
+                     uint64_t arg4, uint64_t arg5, uint64_t arg6)
+{
+    (void)arg4; (void)arg5; (void)arg6;
+
+    task_t *current = get_current_task();
+    if (!current || !current->cr3)
+        return -ESRCH;
+
+    if ((addr & ~PAGE_MASK) || length == 0 || !access_ok((void*)addr, length))
+        return -EINVAL;
+
+    /* The whole range must be mapped */
+    size_t num_pages = PAGE_ALIGN_UP(length) / PAGE_SIZE;
+    if (vma_protect(&current->vmas, addr, addr + num_pages * PAGE_SIZE,
+                    prot & (VMA_READ | VMA_WRITE | VMA_EXEC)) != 0)
+        return -ENOMEM;
+
+    uint64_t end = addr + num_pages * PAGE_SIZE;
+    uint64_t page_flags = prot_to_flags(prot);
+    for (vma_t *v = vma_find(&current->vmas, addr); v && v->start < end; v = vma_next(v)) {
+        uint64_t s = v->start > addr ? v->start : addr;
+        uint64_t e = v->end < end ? v->end : end;
+        uint64_t shared = (v->file && (v->flags & VMA_SHARED)) ? PTE_SHARED : 0;
+        vmm_protect_range(current->cr3, s, (e - s) / PAGE_SIZE, page_flags | shared);
+    }
 
     return 0;
 }
@@ -6,6 +6,7 @@
 #include <mm/vmm.h>
 #include <mm/pmm.h>
 #include <mm/liballoc.h>
+#include <mm/uaccess.h>
 #include <libk/utils.h>
 #include <libk/string.h>
 #include <arch/x86_64/regs.h>
@@ -13,8 +14,6 @@
 
 #define USER_STACK_SIZE      8192 // 2 Pages
 
-extern task_t *task_list;
-
 int64_t sys_exit(uint64_t status, uint64_t arg2, uint64_t arg3,
                  uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
@@ -26,14 +25,22 @@ int64_t sys_exit(uint64_t status, uint64_t arg2, uint64_t arg3,
     
     if (current->parent_id > 0) {
         task_t *parent = find_task_by_id(current->parent_id);
-        if (parent && parent->state == TASK_BLOCKED) {
-            parent->state = TASK_RUNNABLE;
+        if (parent) {
+            task_wake(parent);
         }
     }
     
     current->state = TASK_ZOMBIE;
         
     if (current->is_usermode) {
+        // Stores through shared file mappings reach the file before the
+        // page table that recorded them goes away
+        if (current->cr3)
+            vma_writeback(&current->vmas, current->cr3, 0, USER_SPACE_END);
+
+        // Get off the page table before it goes back to the PMM
+        vmm_switch_page_table(vmm_get_kernel_cr3());
+
             if (current->user_code) {
             size_t meta_pages = (current->user_code_pages * sizeof(elf_page_t) + 4095) / 4096;
             if (meta_pages == 0) meta_pages = 1;
@@ -41,12 +48,14 @@ int64_t sys_exit(uint64_t status, uint64_t arg2, uint64_t arg3,
         }
 
         if (current->cr3) vmm_free_user_page_table(current->cr3);
+        vma_destroy(&current->vmas);
         
         current->user_code = NULL;
         current->user_stack = NULL;
         current->cr3 = 0;
     }
     log("SYS_EXIT", INFO, "Free memory: %d\r\n", get_free_physical_memory()); 
+    kernel_unlock();
     for (;;) {
         asm volatile("sti; hlt");
     }
@@ -70,24 +79,15 @@ int64_t sys_waitpid(uint64_t pid, uint64_t status_ptr, uint64_t options,
         return -1; 
     }
     
-    if (child->state == TASK_ZOMBIE) {
+    // The zombie's own CPU may still be parked in its exit loop, only reap
+    // once it has been switched away from
+    if (child->state == TASK_ZOMBIE && !__atomic_load_n(&child->on_cpu, __ATOMIC_ACQUIRE)) {
         int child_id = child->id;
-        if (status) *status = child->exit_status;
+        // Leave the child to be collected again if the status is lost
+        if (status && copy_to_user(status, &child->exit_status, sizeof(int)))
+            return -EFAULT;
         
-        if (child == task_list) {
-            if (child->next == child) {
-                task_list = NULL;
-            } else {
-                task_list = child->next;
-                task_t *tail = task_list;
-                while (tail->next != child) tail = tail->next;
-                tail->next = task_list;
-            }
-        } else {
-            task_t *prev = task_list;
-            while (prev->next != child) prev = prev->next;
-            prev->next = child->next;
-        }
+        task_remove(child);
         
         pmm_free_pages(child->stack_base, child->stack_pages);
         pmm_free_pages(child, 1);
@@ -103,13 +103,19 @@ int64_t sys_waitpid(uint64_t pid, uint64_t status_ptr, uint64_t options,
     current_task->state = TASK_BLOCKED;
     current_task->wake_tick = 0xFFFFFFFFFFFFFFFF;
     // Yield to the PIT Timer so the child can execute
-    while (current_task->state == TASK_BLOCKED) {
-        asm volatile("sti; hlt");
-
+    while (current_task->state == TASK_BLOCKED && child->state != TASK_ZOMBIE) {
+        sched_wait();
     }
+    current_task->state = TASK_RUNNING;
     return -2; 
 }
 
+int64_t sys_getpid(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                   uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
+    return get_current_task()->id;
+}
+
 int64_t sys_fork(uint64_t arg1, uint64_t arg2, uint64_t arg3,
                  uint64_t arg4, uint64_t arg5, uint64_t arg6) {
     (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5; (void)arg6;
@@ -129,36 +135,37 @@ int64_t sys_exec(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr,
   (void)arg4; (void)arg5; (void)arg6;
   log("SYS_EXEC", INFO, "Free memory: %d\r\n", get_free_physical_memory()); 
 
-  const char *path = (const char*)path_ptr;
   char **argv = (char**)argv_ptr;
   char **envp = (char**)envp_ptr;
   task_t *current_task = get_current_task();
 
-  if (!current_task || !path) return -1;
+  if (!current_task) return -1;
+  char *path = getname(path_ptr);
+  if (!path) return -EFAULT;
   log("SYS_EXEC",INFO,"loading '%s' into task %d\n\r", path, current_task->id);
 
-  int argc = 0;
-  if (argv) { while (argv[argc] && argc < MAX_EXEC_ARGS) argc++; }
-  int envc = 0;
-  if (envp) { while (envp[envc] && envc < MAX_EXEC_ARGS) envc++; }
-
+  // Everything below is copied out of the old image before it goes away,
+  // through the fault-safe helpers since the pointers come from userland
   char *argv_snap[MAX_EXEC_ARGS];
   char *envp_snap[MAX_EXEC_ARGS];
   int argv_snapped = 0, envp_snapped = 0;
+  int argc = 0, envc = 0;
 
-  for (int i = 0; i < argc; i++) {
-      size_t len = strlen(argv[i]) + 1;
-      argv_snap[i] = (char*)kmalloc(len);
-      if (!argv_snap[i]) goto snapshot_oom;
-      memcpy((uint8_t*)argv_snap[i], (uint8_t*)argv[i], len);
-      argv_snapped++;
+  while (argv && argc < MAX_EXEC_ARGS) {
+      uint64_t arg;
+      if (copy_from_user(&arg, &argv[argc], sizeof(arg)) != 0) goto snapshot_oom;
+      if (!arg) break;
+      argv_snap[argc] = getname(arg);
+      if (!argv_snap[argc]) goto snapshot_oom;
+      argv_snapped = ++argc;
   }
-  for (int i = 0; i < envc; i++) {
-      size_t len = strlen(envp[i]) + 1;
-      envp_snap[i] = (char*)kmalloc(len);
-      if (!envp_snap[i]) goto snapshot_oom;
-      memcpy((uint8_t*)envp_snap[i], (uint8_t*)envp[i], len);
-      envp_snapped++;
+  while (envp && envc < MAX_EXEC_ARGS) {
+      uint64_t env;
+      if (copy_from_user(&env, &envp[envc], sizeof(env)) != 0) goto snapshot_oom;
+      if (!env) break;
+      envp_snap[envc] = getname(env);
+      if (!envp_snap[envc]) goto snapshot_oom;
+      envp_snapped = ++envc;
   }
 
   {
@@ -181,6 +188,12 @@ int64_t sys_exec(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr,
       pmm_free_pages(elf_data, (file_size + 4095) / 4096);
       goto snapshot_oom_ret_neg1;
   }
+  // The segments are mapped in the live address space already
+  if (elf_map_vmas(elf_data, &current_task->vmas) != 0) {
+      pmm_free_pages(elf_data, (file_size + 4095) / 4096);
+      elf_free(&elf_info);
+      goto snapshot_oom_ret_neg1;
+  }
   pmm_free_pages(elf_data, (file_size + 4095) / 4096);
 
   void *new_stack_kaddr = pmalloc(2);
@@ -210,8 +223,22 @@ int64_t sys_exec(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr,
 
   // 4. POINT OF NO RETURN — everything above succeeded, safe to tear down
   //    the old image now and commit the new one.
+  //    The old heap goes away, the new image starts its own right after
+  //    its BSS.
+  if (current_task->brk_start) {
+      uint64_t heap_end = (current_task->brk_current + 4095) & ~0xFFFULL;
+      if (heap_end > current_task->brk_start &&
+          vma_unmap(&current_task->vmas, current_task->brk_start, heap_end) == 0)
+          vmm_unmap_range(current_task->cr3, current_task->brk_start,
+                          (heap_end - current_task->brk_start) / 4096, 1);
+  }
+  if (vma_map(&current_task->vmas, USER_STACK_TOP_VADDR - 8192, USER_STACK_TOP_VADDR,
+              VMA_READ | VMA_WRITE, VMA_STACK, NULL, 0) != 0)
+      log("SYS_EXEC", ERROR, "task %d: out of memory recording the stack\n\r", current_task->id);
   current_task->brk_start   = elf_info.end_addr;
   current_task->brk_current = elf_info.end_addr;
+  // The new image starts without a syscall ring of its own
+  current_task->ioring = 0;
 
   if (current_task->user_code) {
       elf_page_t *pages = (elf_page_t *)current_task->user_code;
@@ -244,6 +271,7 @@ int64_t sys_exec(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr,
 
   for (int i = 0; i < argv_snapped; i++) kfree(argv_snap[i]);
   for (int i = 0; i < envp_snapped; i++) kfree(envp_snap[i]);
+  kfree(path);
 
   return 0;
   }
@@ -251,11 +279,13 @@ int64_t sys_exec(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr,
 snapshot_oom_ret_neg1:
   for (int i = 0; i < argv_snapped; i++) kfree(argv_snap[i]);
   for (int i = 0; i < envp_snapped; i++) kfree(envp_snap[i]);
+  kfree(path);
   return -1;
 
 snapshot_oom:
   for (int i = 0; i < argv_snapped; i++) kfree(argv_snap[i]);
   for (int i = 0; i < envp_snapped; i++) kfree(envp_snap[i]);
+  kfree(path);
   return -1;
 }
 
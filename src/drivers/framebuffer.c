@@ -1,13 +1,23 @@
 #include "init/limine.h"
 #include "init/limine_req.h"
 #include <drivers/framebuffer.h>
+#include <libk/spinlock.h>
 #include <libk/string.h>
 #include <libk/utils.h>
 #include <mm/pmm.h>
+#include <mm/vmm.h>
 #include <stddef.h>
 #include <stdint.h>
 
+// fb_info.address is the shadow copy in RAM that everything draws to,
+// vram the real framebuffer, mapped write-combining. framebuffer_flush
+// copies the rectangle drawn to since the last flush across, so VRAM is
+// only ever written, and in long sequential runs.
 fb_info_t fb_info;
+static uint32_t *vram;
+
+static spinlock_t dirty_lock;
+static uint32_t dirty_x0, dirty_y0, dirty_x1, dirty_y1;
 
 void init_framebuffer() {
   struct limine_framebuffer_response *fb_response =
@@ -16,38 +26,110 @@ void init_framebuffer() {
     log("FB",ERROR,"No framebuffer found!\n\r");
     return;
   }
-  fb_info.address = (uint32_t *)(uint64_t)fb_response->framebuffers[0]->address;
-  fb_info.height = fb_response->framebuffers[0]->height;
-  fb_info.width = fb_response->framebuffers[0]->width;
-  fb_info.bpp = fb_response->framebuffers[0]->bpp;
+  struct limine_framebuffer *fb = fb_response->framebuffers[0];
+  fb_info.address = (uint32_t *)(uint64_t)fb->address;
+  fb_info.height = fb->height;
+  fb_info.width = fb->width;
+  fb_info.bpp = fb->bpp;
+  spinlock_init(&dirty_lock);
+
+  size_t bytes = (size_t)fb_info.width * fb_info.height * sizeof(uint32_t);
+  size_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint32_t *wc = vmm_map_mmio((uint64_t)phys_from_virt(fb_info.address),
+                              fb->pitch * fb->height, PTE_WC);
+  uint32_t *shadow = pmalloc(pages);
+  if (!wc || !shadow) {
+    if (shadow) pmm_free_pages(shadow, pages);
+    log("FB", ERROR, "No shadow framebuffer, drawing to VRAM directly\n\r");
+    return;
+  }
+
+  memcpy(shadow, fb_info.address, bytes);
+  vram = wc;
+  fb_info.address = shadow;
+  log("FB", INFO, "%dx%d, %d KiB shadow buffer, VRAM write-combining\n\r",
+      fb_info.width, fb_info.height, (int)(bytes / 1024));
+}
+
+// Grow the pending rectangle by [x0, x1) x [y0, y1)
+static void fb_damage(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  if (!vram) return;
+  spinlock_acquire(&dirty_lock);
+  if (dirty_x0 >= dirty_x1 || dirty_y0 >= dirty_y1) {
+    dirty_x0 = x0; dirty_y0 = y0;
+    dirty_x1 = x1; dirty_y1 = y1;
+  } else {
+    if (x0 < dirty_x0) dirty_x0 = x0;
+    if (y0 < dirty_y0) dirty_y0 = y0;
+    if (x1 > dirty_x1) dirty_x1 = x1;
+    if (y1 > dirty_y1) dirty_y1 = y1;
+  }
+  spinlock_release(&dirty_lock);
+}
+
+void framebuffer_flush() {
+  if (!vram) return;
+  spinlock_acquire(&dirty_lock);
+  uint32_t x0 = dirty_x0, y0 = dirty_y0, x1 = dirty_x1, y1 = dirty_y1;
+  dirty_x0 = dirty_y0 = dirty_x1 = dirty_y1 = 0;
+  spinlock_release(&dirty_lock);
+  if (x0 >= x1 || y0 >= y1) return;
+
+  // Pixels drawn while this runs were damaged again and go out next time
+  size_t offset = (size_t)y0 * fb_info.width + x0;
+  const uint32_t *src = fb_info.address + offset;
+  uint32_t *dst = vram + offset;
+  size_t row_bytes = (x1 - x0) * sizeof(uint32_t);
+  for (uint32_t y = y0; y < y1; ++y) {
+    memcpy(dst, src, row_bytes);
+    src += fb_info.width;
+    dst += fb_info.width;
+  }
 }
 
 void framebuffer_put_pixel(int x_pos, uint32_t y_pos, uint32_t color) {
   *(uint32_t *)(x_pos + y_pos * fb_info.width + fb_info.address) = color;
+  fb_damage(x_pos, y_pos, x_pos + 1, y_pos + 1);
 }
 
-void framebuffer_clear(uint32_t color) {
-  for (uint32_t i = 0; i < fb_info.height * fb_info.width; i++) {
-    fb_info.address[i] = color;
+// Copy a w x h block of pixels to (x, y), one row at a time
+void framebuffer_blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint32_t *src) {
+  if (x >= fb_info.width || y >= fb_info.height) return;
+  uint32_t cols = x + w > fb_info.width ? fb_info.width - x : w;
+  uint32_t rows = y + h > fb_info.height ? fb_info.height - y : h;
+
+  uint32_t *dst = fb_info.address + (size_t)y * fb_info.width + x;
+  for (uint32_t row = 0; row < rows; ++row) {
+    memcpy(dst, src, cols * sizeof(uint32_t));
+    dst += fb_info.width;
+    src += w;
   }
+  fb_damage(x, y, x + cols, y + rows);
 }
 
-fb_info_t *get_fb_info() { return &fb_info; }
+static void fb_fill(uint32_t *dst, uint32_t color, size_t pixels) {
+  asm volatile("rep stosl" : "+D"(dst), "+c"(pixels) : "a"(color) : "memory");
+}
 
-void scroll_framebuffer(uint32_t color, uint8_t pixel_count) {
-  int pixels_per_row = fb_info.width;
-  int row_count = fb_info.height;
+void framebuffer_clear(uint32_t color) {
+  fb_fill(fb_info.address, color, (size_t)fb_info.height * fb_info.width);
+  fb_damage(0, 0, fb_info.width, fb_info.height);
+}
 
-  for (int y = 0; y < row_count - pixel_count; y++) {
-    for (int x = 0; x < pixels_per_row; x++) {
-      fb_info.address[y * pixels_per_row + x] =
-          fb_info.address[(y + pixel_count) * pixels_per_row + x];
-    }
-  }
+fb_info_t *get_fb_info() { return &fb_info; }
 
-  for (int y = row_count - pixel_count; y < row_count; y++) {
-    for (int x = 0; x < pixels_per_row; x++) {
-      fb_info.address[y * pixels_per_row + x] = color;
-    }
+// Move the picture up pixel_count rows in one block and fill the rows
+// uncovered at the bottom. Only the shadow buffer is read.
+void scroll_framebuffer(uint32_t color, uint32_t pixel_count) {
+  if (pixel_count >= fb_info.height) {
+    framebuffer_clear(color);
+    return;
   }
+
+  size_t pixels_per_row = fb_info.width;
+  size_t kept = (fb_info.height - pixel_count) * pixels_per_row;
+  memmove(fb_info.address, fb_info.address + pixel_count * pixels_per_row,
+          kept * sizeof(uint32_t));
+  fb_fill(fb_info.address + kept, color, pixel_count * pixels_per_row);
+  fb_damage(0, 0, fb_info.width, fb_info.height);
 }
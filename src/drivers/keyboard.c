@@ -2,6 +2,7 @@
 #include <arch/ports.h>
 #include <drivers/keyboard.h>
 #include <drivers/tty/tty.h>
+#include <libk/ring.h>
 #include <libk/stdio.h>
 #include <libk/utils.h>
 
@@ -19,6 +20,11 @@ uint8_t isExtended = 0;  // Flag for extended scancodes (0xE0 prefix)
 /*keep tracks if key was pressed or not*/
 int irq_done = 0;
 
+// Scancodes from the IRQ, drained by keyboard_process
+static uint8_t scancode_buf[256];
+static spsc_ring_t scancodes;
+static volatile bool deferred = false;
+
 /*English US QWERTY layout. non-shifted*/
 const char keyMap_normal[58] = {
   0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0','-', '=', '\b',
@@ -40,7 +46,23 @@ void keyboard_handler(register_t* regs){
   (void)regs;                                                                                                                                                         
   uint8_t scancode;                                                                                                                                                      
   scancode = inb(0x60); /*read from keyboard data port*/
-  handleKey_normal(scancode);
+  spsc_push(&scancodes, scancode);
+  if (!deferred || !tty_input_wake())
+    keyboard_process();
+}
+
+void keyboard_process(void){
+  uint8_t scancode;
+  while (spsc_pop(&scancodes, &scancode))
+    handleKey_normal(scancode);
+}
+
+int keyboard_pending(void){
+  return !spsc_empty(&scancodes);
+}
+
+void keyboard_set_deferred(bool on){
+  deferred = on;
 }
 
 /*translate a scancode to an ascii character*/
@@ -77,6 +99,13 @@ void handleKey_normal(uint8_t scancode){
       return;  // Ignore extended key releases for now
     }
     
+    // Shift+PgUp/PgDn page through the scrollback, half a screen at a time
+    if (tty && isShift && (scancode == KEY_PGUP || scancode == KEY_PGDN)) {
+      int lines = tty->height / 2;
+      tty_scrollback(tty, scancode == KEY_PGUP ? lines : -lines);
+      return;
+    }
+
     // Send ANSI escape sequences for arrow keys
     if (tty) {
       switch(scancode) {
@@ -194,6 +223,7 @@ char keyboard_read(){               /*reads a single character from keyboard*/
 }
 
 void keyboard_install(void){        /*keyboard installer function*/
+  spsc_init(&scancodes, scancode_buf, sizeof(scancode_buf));
   irq_install_handler(1, keyboard_handler); /*register the handler for IRQ1, keyboard IRQ*/
   log("KBD",INFO,"Keyboard initialised\n\r");
 }
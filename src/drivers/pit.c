@@ -1,8 +1,8 @@
 #include <arch/ports.h>
 #include <arch/x86_64/irq.h>
 #include <drivers/pit.h>
-#include <drivers/tty/tty.h>
 #include <kernel/sched/scheduler.h>
+#include <kernel/vdso.h>
 #include <libk/utils.h>
 
 volatile uint64_t pit_ticks = 0;
@@ -10,15 +10,10 @@ uint16_t hz = 0;
 
 void pit_handler(register_t *regs) {
   pit_ticks++;
+  vdso_tick(pit_ticks);
 
   // run scheduler tick (preemptive round-robin)
   schedule_tick(regs);
-
-  if (tty_initialized) {
-    if (pit_ticks % (hz / 2) == 0) {
-      tty_toggle_cursor_visibility();
-    }
-  }
 }
 
 void set_frequency(uint16_t h) {
@@ -27,16 +27,6 @@ static void cmos_write(uint8_t reg, uint8_t val) {
 }
 
 
-struct rtc_time {
-    uint8_t sec;
-    uint8_t min;
-    uint8_t hour;
-    uint8_t day;
-    uint8_t month;
-    uint16_t year;
-};
-
-
 static inline int rtc_updating(void) {
     return cmos_read(0x0A) & 0x80;
 }
@@ -1,20 +1,67 @@
 #include "fs/devfs.h"
 #include <arch/ports.h>
+#include <arch/x86_64/irq.h>
 #include <drivers/serial.h>
 #include <libk/stdio.h>
 #include <libk/utils.h>
+#include <libk/ring.h>
+#include <libk/spinlock.h>
 #include <stdbool.h>
 #include <kernel/vfs/vfs.h>
+#include <kernel/sched/scheduler.h>
 #include <mm/liballoc.h>
+#include <mm/uaccess.h>
 #include <libk/string.h>
 
+// 16550 registers, offsets from the base port
+#define UART_DATA 0
+#define UART_IER  1
+#define UART_IIR  2
+#define UART_FCR  2
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_MSR  6
+
+#define IER_RX   0x01   // Received data available
+#define IER_THRE 0x02   // Transmit holding register empty
+
+#define LSR_DR   0x01   // Data ready
+#define LSR_THRE 0x20   // TX FIFO empty
+
+#define UART_FIFO_DEPTH 16
+#define SERIAL_IRQ 4    // COM1
+
+#define SERIAL_TX_BUF 8192
+#define SERIAL_RX_BUF 1024
+
 uint16_t def_port = 0;
 bool initialized = false;
 
+// Output is queued in tx and written to the UART 16 bytes at a time, once
+// per THRE interrupt. Every writer and the interrupt handler hold tx_lock,
+// the handler is the usual consumer but a writer starts the FIFO itself
+// when it is idle, or drains it by polling when the ring is full.
+static uint8_t tx_buf[SERIAL_TX_BUF];
+static spsc_ring_t tx;
+static spinlock_t tx_lock;
+static bool irq_mode = false;   // Buffered, else every byte is polled out
+static bool tx_armed = false;   // THRE interrupt enabled, a refill is coming
+
+// Non-blocking log mode: log()/dbgln() output that does not fit is thrown
+// away up to the end of its line, then a count of the lost bytes is logged
+static bool log_nonblock = false;
+static bool log_dropping = false;
+static uint32_t log_dropped = 0;
+
+// Received bytes, pushed by the interrupt handler, popped by ttyS0 reads
+static uint8_t rx_buf[SERIAL_RX_BUF];
+static spsc_ring_t rx;
+
 struct file_operations serial_file_ops = {
     .open = NULL,
     .close = NULL,
-    .read = NULL,
+    .read = serial_read,
     .write = serial_write
 };
 
@@ -32,9 +79,12 @@ int serial_init(uint16_t port){
     if(inb(port) != 0xAE){
         return 1;
     }
-    
+
     outb(port + 4, 0x0F);
     def_port = port;
+    spsc_init(&tx, tx_buf, sizeof(tx_buf));
+    spsc_init(&rx, rx_buf, sizeof(rx_buf));
+    spinlock_init(&tx_lock);
     initialized = true;
     return 0;
 }
@@ -43,16 +93,86 @@ bool is_serial_initialized(){
     return initialized;
 }
 
+static void serial_putchar_polled(char c){
+    while (!(inb(def_port + UART_LSR) & LSR_THRE));
+    outb(def_port + UART_DATA, (uint8_t)c);
+}
+
+// Move up to a FIFO's worth of the ring into the UART if it has drained,
+// and keep the THRE interrupt enabled for as long as bytes are left.
+// tx_lock held.
+static void tx_fill(){
+    if (inb(def_port + UART_LSR) & LSR_THRE) {
+        uint8_t c;
+        for (int i = 0; i < UART_FIFO_DEPTH && spsc_pop(&tx, &c); i++)
+            outb(def_port + UART_DATA, c);
+    }
+
+    bool want = !spsc_empty(&tx);
+    if (want != tx_armed) {
+        tx_armed = want;
+        outb(def_port + UART_IER, IER_RX | (want ? IER_THRE : 0));
+    }
+}
+
+// Queue one byte, tx_lock held. With the ring full either drop it (false)
+// or spin on the UART until a FIFO's worth has gone out.
+static bool tx_queue(uint8_t c, bool may_drop){
+    while (!spsc_push(&tx, c)) {
+        if (may_drop) return false;
+        tx_fill();
+    }
+    return true;
+}
+
+static void tx_queue_str(const char* s){
+    while (*s) tx_queue((uint8_t)*s++, false);
+}
+
+static void log_queue(char c){
+    if (!log_nonblock) {
+        tx_queue((uint8_t)c, false);
+        return;
+    }
+    if (log_dropping) {
+        // Resume at a line boundary, once half the ring is free again
+        if (c != '\n' || spsc_space(&tx) < SERIAL_TX_BUF / 2) {
+            log_dropped++;
+            return;
+        }
+        char num[21];
+        tx_queue_str("\n\r[SERIAL] ");
+        tx_queue_str(utoa(log_dropped, num, 10));
+        tx_queue_str(" bytes of log output dropped");
+        log_dropping = false;
+        log_dropped = 0;
+    }
+    if (!tx_queue((uint8_t)c, true)) {
+        log_dropping = true;
+        log_dropped = 1;
+    }
+}
+
 void serial_putchar(char c){
-    while (!(inb(def_port + 5) & 0x20));
-    outb(def_port, (uint8_t)c);
+    if (!irq_mode) {
+        serial_putchar_polled(c);
+        return;
+    }
+    spinlock_acquire(&tx_lock);
+    log_queue(c);
+    if (!tx_armed) tx_fill();
+    spinlock_release(&tx_lock);
 }
 
 void serial_puts(const char* str){
-    while(*str != 0){
-        serial_putchar(*str);
-        str++;
+    if (!irq_mode) {
+        while (*str) serial_putchar_polled(*str++);
+        return;
     }
+    spinlock_acquire(&tx_lock);
+    while (*str) log_queue(*str++);
+    if (!tx_armed) tx_fill();
+    spinlock_release(&tx_lock);
 }
 
 void serial_printf(char* fmt, ...){
@@ -62,19 +182,111 @@ void serial_printf(char* fmt, ...){
     va_end(args);
 }
 
+static void serial_handler(register_t* regs){
+    (void)regs;
+    uint8_t iir;
+    while (!((iir = inb(def_port + UART_IIR)) & 0x01)) {
+        switch (iir & 0x0E) {
+        case 0x04:  // RX data
+        case 0x0C:  // RX timeout, fewer bytes than the trigger level
+            while (inb(def_port + UART_LSR) & LSR_DR)
+                spsc_push(&rx, inb(def_port + UART_DATA));
+            break;
+        case 0x02:  // THRE
+            spinlock_acquire(&tx_lock);
+            tx_fill();
+            spinlock_release(&tx_lock);
+            break;
+        case 0x06:
+            inb(def_port + UART_LSR);
+            break;
+        default:
+            inb(def_port + UART_MSR);
+            break;
+        }
+    }
+}
+
+void serial_flush(){
+    if (!irq_mode) return;
+    spinlock_acquire(&tx_lock);
+    while (!spsc_empty(&tx)) tx_fill();
+    spinlock_release(&tx_lock);
+}
+
+void serial_panic(){
+    if (!initialized || !irq_mode) return;
+    // The lock may be held by whoever just faulted; nothing else runs now
+    irq_mode = false;
+    outb(def_port + UART_IER, 0x00);
+    uint8_t c;
+    while (spsc_pop(&tx, &c)) serial_putchar_polled((char)c);
+}
+
+void serial_set_log_nonblock(bool on){
+    spinlock_acquire(&tx_lock);
+    log_nonblock = on;
+    spinlock_release(&tx_lock);
+}
+
+long serial_read(file_t* file, void* buf, size_t count, uint64_t off){
+    (void)file;
+    (void)off;
+    if (!buf || count == 0) return -1;
+    if (!irq_mode) return 0;
+
+    // Return whatever has arrived, or wait for at least one byte
+    while (spsc_empty(&rx)) {
+        sched_wait();
+    }
+
+    char* cbuf = (char*)buf;
+    size_t n = 0;
+    uint8_t c;
+    while (n < count && spsc_pop(&rx, &c))
+        cbuf[n++] = (char)c;
+    return (long)n;
+}
 
 long serial_write(file_t* file, const void* buf, size_t count, uint64_t off){
     (void)file;
     (void)off;
-    const char* cbuf = (const char*)buf;
-    for(size_t i = 0; i < count; i++){
-        serial_putchar(cbuf[i]);
+    // buf is the caller's user buffer: copy it in chunks outside the lock
+    // rather than fault on it with interrupts off
+    const char* ubuf = (const char*)buf;
+    char chunk[64];
+    size_t i = 0;
+    while (i < count) {
+        size_t n = count - i < sizeof(chunk) ? count - i : sizeof(chunk);
+        if (copy_from_user(chunk, ubuf + i, n) != 0)
+            break;
+        if (!irq_mode) {
+            for (size_t j = 0; j < n; j++)
+                serial_putchar_polled(chunk[j]);
+        } else {
+            spinlock_acquire(&tx_lock);
+            for (size_t j = 0; j < n; j++)
+                tx_queue((uint8_t)chunk[j], false);
+            if (!tx_armed) tx_fill();
+            spinlock_release(&tx_lock);
+        }
+        i += n;
     }
-    return (long)count;
+    return i || !count ? (long)i : -EFAULT;
 }
 
 
 void init_serial_device(){
-    devfs_register_device("sr0", &serial_file_ops, FT_CHR); 
-    log("SERIAL", INFO,"Registered /dev/sr0\n\r");
+    if (initialized) {
+        irq_install_handler(SERIAL_IRQ, serial_handler);
+        spinlock_acquire(&tx_lock);
+        irq_mode = true;
+        outb(def_port + UART_IER, IER_RX);
+        spinlock_release(&tx_lock);
+        if (arg_exist("lognoblock"))
+            serial_set_log_nonblock(true);
+    }
+    devfs_register_device("ttyS0", &serial_file_ops, FT_CHR);
+    devfs_register_device("sr0", &serial_file_ops, FT_CHR);
+    log("SERIAL", INFO,"Registered /dev/ttyS0 and /dev/sr0\n\r");
 }
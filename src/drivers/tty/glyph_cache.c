@@ -0,0 +1,151 @@
+#include <drivers/tty/glyph_cache.h>
+#include <drivers/tty/psf2.h>
+#include <drivers/framebuffer.h>
+#include <libk/spinlock.h>
+#include <libk/utils.h>
+#include <mm/liballoc.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GLYPH_BUCKETS 256
+#define GLYPH_MIN_ENTRIES 16
+
+typedef struct glyph_entry {
+  uint32_t fg;
+  uint32_t bg;
+  uint16_t glyph;
+  uint16_t valid;
+  struct glyph_entry *hnext;  // Hash chain
+  struct glyph_entry *prev;   // LRU list, most recently used first
+  struct glyph_entry *next;
+  uint32_t *pixels;           // glyph_w * glyph_h, row major
+} glyph_entry_t;
+
+static glyph_entry_t *entries;
+static uint32_t *pixel_pool;
+static size_t nr_entries;
+static glyph_entry_t *buckets[GLYPH_BUCKETS];
+static glyph_entry_t *lru_head;
+static glyph_entry_t *lru_tail;
+static uint32_t glyph_w;
+static uint32_t glyph_h;
+static spinlock_t cache_lock;
+
+static inline size_t bucket_of(uint16_t glyph, uint32_t fg, uint32_t bg) {
+  uint32_t h = glyph * 0x9E3779B1u ^ fg * 0x85EBCA77u ^ bg * 0xC2B2AE3Du;
+  return (h >> 16) % GLYPH_BUCKETS;
+}
+
+static inline const uint8_t *glyph_bits(uint8_t glyph) {
+  if (glyph >= g_font.header->length) glyph = 0;
+  return g_font.glyphBuffer + glyph * g_font.header->bytesperglyph;
+}
+
+static void lru_unlink(glyph_entry_t *e) {
+  if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+  if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+}
+
+static void lru_push_front(glyph_entry_t *e) {
+  e->prev = NULL;
+  e->next = lru_head;
+  if (lru_head) lru_head->prev = e; else lru_tail = e;
+  lru_head = e;
+}
+
+static void unhash(glyph_entry_t *e) {
+  glyph_entry_t **pp = &buckets[bucket_of(e->glyph, e->fg, e->bg)];
+  while (*pp != e) pp = &(*pp)->hnext;
+  *pp = e->hnext;
+}
+
+static void expand_glyph(uint32_t *dst, uint8_t glyph, uint32_t fg, uint32_t bg) {
+  const uint8_t *bits = glyph_bits(glyph);
+  uint32_t stride = (glyph_w + 7) / 8;
+  for (uint32_t row = 0; row < glyph_h; ++row) {
+    const uint8_t *line = bits + row * stride;
+    for (uint32_t col = 0; col < glyph_w; ++col)
+      *dst++ = (line[col / 8] >> (7 - (col % 8))) & 1 ? fg : bg;
+  }
+}
+
+// Expanded pixels of (glyph, fg, bg), rendering them over the least
+// recently used entry on a miss. Called with cache_lock held.
+static glyph_entry_t *lookup(uint8_t glyph, uint32_t fg, uint32_t bg) {
+  size_t b = bucket_of(glyph, fg, bg);
+  glyph_entry_t *e;
+  for (e = buckets[b]; e; e = e->hnext) {
+    if (e->glyph == glyph && e->fg == fg && e->bg == bg)
+      break;
+  }
+
+  if (!e) {
+    e = lru_tail;
+    if (e->valid) unhash(e);
+    e->glyph = glyph;
+    e->fg = fg;
+    e->bg = bg;
+    e->valid = 1;
+    expand_glyph(e->pixels, glyph, fg, bg);
+    e->hnext = buckets[b];
+    buckets[b] = e;
+  }
+
+  if (e != lru_head) {
+    lru_unlink(e);
+    lru_push_front(e);
+  }
+  return e;
+}
+
+void glyph_cache_init() {
+  if (!g_font.header || !g_font.glyphBuffer) return;
+
+  glyph_w = g_font.header->width;
+  glyph_h = g_font.header->height;
+  size_t glyph_bytes = (size_t)glyph_w * glyph_h * sizeof(uint32_t);
+  size_t n = GLYPH_CACHE_BYTES / glyph_bytes;
+  if (n < GLYPH_MIN_ENTRIES) n = GLYPH_MIN_ENTRIES;
+
+  entries = kmalloc(n * sizeof(glyph_entry_t));
+  pixel_pool = kmalloc(n * glyph_bytes);
+  if (!entries || !pixel_pool) {
+    log("TTY", ERROR, "No memory for the glyph cache, painting uncached\n\r");
+    if (entries) kfree(entries);
+    if (pixel_pool) kfree(pixel_pool);
+    entries = NULL;
+    pixel_pool = NULL;
+    return;
+  }
+
+  spinlock_init(&cache_lock);
+  for (size_t i = 0; i < n; ++i) {
+    entries[i].valid = 0;
+    entries[i].hnext = NULL;
+    entries[i].pixels = pixel_pool + i * glyph_w * glyph_h;
+    lru_push_front(&entries[i]);
+  }
+  nr_entries = n;
+  log("TTY", INFO, "Glyph cache: %d entries of %dx%d\n\r", (int)n, glyph_w, glyph_h);
+}
+
+void glyph_cache_paint(uint8_t glyph, uint32_t fg, uint32_t bg, uint32_t x, uint32_t y) {
+  if (!nr_entries) {
+    // No cache (yet), expand straight into the framebuffer
+    const uint8_t *bits = glyph_bits(glyph);
+    uint32_t w = g_font.header->width;
+    uint32_t stride = (w + 7) / 8;
+    for (uint32_t row = 0; row < g_font.header->height; ++row) {
+      for (uint32_t col = 0; col < w; ++col) {
+        uint8_t bit = (bits[row * stride + col / 8] >> (7 - (col % 8))) & 1;
+        framebuffer_put_pixel(x + col, y + row, bit ? fg : bg);
+      }
+    }
+    return;
+  }
+
+  spinlock_acquire(&cache_lock);
+  glyph_entry_t *e = lookup(glyph, fg, bg);
+  framebuffer_blit(x, y, glyph_w, glyph_h, e->pixels);
+  spinlock_release(&cache_lock);
+}
@@ -61,7 +61,13 @@ void hansi_handle_sgr(ansi_args* stack, int count){
     }
 }
 
-void hansi_handler(char c){
+static void put_one(char c){
+    tty_put_span(&c, 1);
+}
+
+// One byte through the state machine, bytes that turn out not to start an
+// escape sequence are printed. Caller holds tty_lock.
+static void hansi_step(char c){
     if(g_parser.state == HTERM_ESC){
         if(c == '\033'){
             g_parser.state = HTERM_BRACKET;
@@ -71,7 +77,7 @@ void hansi_handler(char c){
         }
         else{
             g_parser.state = HTERM_ESC;
-            tty_putchar_raw(c);
+            put_one(c);
         }
     }
     else if(g_parser.state == HTERM_BRACKET){
@@ -80,7 +86,7 @@ void hansi_handler(char c){
         }
         else{
             g_parser.state = HTERM_ESC;
-            tty_putchar_raw(c);
+            put_one(c);
         }
     }
     else if(g_parser.state == HTERM_ARGS){
@@ -165,9 +171,9 @@ void hansi_handler(char c){
                     break;
                 case 'J': // ED - Erase in Display
                     n = g_parser.args[0].empty ? 0 : g_parser.args[0].value;
-                    if (n == 2) {
+                    if (n == 2 && tty) {
                         // Clear entire screen
-                        tty_clear();
+                        tty_erase(tty);
                     }
                     // TODO: n=0 clear from cursor to end, n=1 clear from start to cursor
                     break;
@@ -180,4 +186,20 @@ void hansi_handler(char c){
             g_parser.state = HTERM_ESC;
         }
     }
-}
\ No newline at end of file
+}
+
+void hansi_write(const char* buf, size_t len){
+    size_t i = 0;
+    while(i < len){
+        if(g_parser.state == HTERM_ESC && buf[i] != '\033'){
+            size_t end = i + 1;
+            while(end < len && buf[end] != '\033')
+                end++;
+            tty_put_span(buf + i, end - i);
+            i = end;
+        }
+        else{
+            hansi_step(buf[i++]);
+        }
+    }
+}
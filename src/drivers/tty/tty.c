@@ -3,6 +3,7 @@
 #include <libk/utils.h>
 #include <drivers/framebuffer.h>
 #include <drivers/tty/font.h>
+#include <drivers/tty/glyph_cache.h>
 #include <drivers/tty/hansi_parser.h>
 #include <drivers/tty/psf2.h>
 #include <drivers/tty/tty.h>
@@ -10,10 +11,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <mm/liballoc.h>
+#include <mm/uaccess.h>
 #include <kernel/vfs/vfs.h>
 #include <stdlib.h>
 
 tty_t* current_tty;
+spinlock_t tty_lock;
 
 uint32_t colors[16];
 
@@ -41,7 +44,9 @@ void init_tty() {
   x_cursor = 0;
   y_cursor = 0;
   current_fb = get_fb_info();
+  spinlock_init(&tty_lock);
   load_embedded_psf2();
+  glyph_cache_init();
   
   
   for (int i = 0; i < TTY_NUM; ++i) {
@@ -57,19 +62,33 @@ void init_tty() {
       .colors = colors,
       .height = current_fb->height/g_font.header->height,
       .width = current_fb->width/g_font.header->width,
+      .head = 0,
+      .history = 0,
+      .view = 0,
       .id = i,
       .tty_ops = tty_file_ops,
       .ldisc_mode = TTY_CANONICAL,
       .echo = true,
-      .input_head = 0,
-      .input_tail = 0,
       .line_length = 0,
       .line_cursor = 0,
-      .line_ready = false,
+      .lines_ready = 0,
       .input_esc_state = INPUT_STATE_NORMAL,
     };
-    ttys[i].buffer = (terminal_cell_t*)kmalloc(sizeof(terminal_cell_t)*ttys[i].width*ttys[i].height);
-    memset(ttys[i].buffer, 0, sizeof(terminal_cell_t)*ttys[i].height*ttys[i].width);
+    spsc_init(&ttys[i].input, ttys[i].input_buf, TTY_MAX_BUF);
+    ttys[i].rows = ttys[i].height + TTY_SCROLLBACK;
+    ttys[i].buffer = (terminal_cell_t*)kmalloc(sizeof(terminal_cell_t)*ttys[i].width*ttys[i].rows);
+    if (!ttys[i].buffer) {
+      log("TTY", ERROR, "No memory for the scrollback of /dev/%s\n\r", name);
+      ttys[i].rows = ttys[i].height;
+      ttys[i].buffer = (terminal_cell_t*)kmalloc(sizeof(terminal_cell_t)*ttys[i].width*ttys[i].rows);
+    }
+    memset(ttys[i].buffer, 0, sizeof(terminal_cell_t)*ttys[i].rows*ttys[i].width);
+    ttys[i].damage_lo = (uint16_t*)kmalloc(sizeof(uint16_t)*ttys[i].height);
+    ttys[i].damage_hi = (uint16_t*)kmalloc(sizeof(uint16_t)*ttys[i].height);
+    for (int row = 0; row < ttys[i].height; ++row) {
+      ttys[i].damage_lo[row] = ttys[i].width;
+      ttys[i].damage_hi[row] = 0;
+    }
   }
   current_tty = &ttys[0]; 
   tty_initialized = true;
@@ -107,6 +126,7 @@ void init_colors(uint32_t black, uint32_t red, uint32_t green, uint32_t yellow,
   currentFg = colors[7];
 
   framebuffer_clear(currentBg);
+  framebuffer_flush();
 }
 
 void tty_paint_cell(terminal_cell_t cell) {
@@ -154,55 +174,30 @@ void tty_paint_cell_psf(terminal_cell_t cell, tty_t* tty) {
     return;
   }
 
-  int start_x = tty->x_cursor * g_font.header->width;
-  int start_y = tty->y_cursor * g_font.header->height;
-
-  for (uint32_t row = 0; row < g_font.header->height; ++row) {
-    for (uint32_t col = 0; col < g_font.header->width; ++col) {
-      uint8_t byte = glyph[row * ((g_font.header->width + 7) / 8) + (col / 8)];
-      uint8_t bit = (byte >> (7 - (col % 8))) & 1;
-
-      // Use the cell's fg/bg colors instead of global colors
-      uint32_t color = bit ? cell.fg : cell.bg;
-      framebuffer_put_pixel(start_x + col, start_y + row, color);
-    }
-  }
+  tty_paint_cell_at(cell, tty->x_cursor, tty->y_cursor);
 }
 
-void tty_hide_cursor() {
-  if (!current_tty) return;
-  
-  // Get the actual character at cursor position from buffer, or space if empty
-  int idx = current_tty->y_cursor * current_tty->width + current_tty->x_cursor;
-  terminal_cell_t cell;
-  
-  if (current_tty->buffer[idx].printable_char != 0) {
-    cell = current_tty->buffer[idx];
-  } else {
-    cell = (terminal_cell_t){.printable_char = ' ', .fg = currentFg, .bg = currentBg};
-  }
-  
-  tty_paint_cell_psf(cell, current_tty); // Restore the actual character
+// Rasterise one cell at a text position, fonts already validated
+void tty_paint_cell_at(terminal_cell_t cell, uint16_t cell_x, uint16_t cell_y) {
+  glyph_cache_paint((uint8_t)cell.printable_char, cell.fg, cell.bg,
+                    cell_x * g_font.header->width, cell_y * g_font.header->height);
 }
 
-void tty_putchar_raw(char c) {
-  tty_t* tty = current_tty;
-  if (!tty) return;
-  
-  terminal_cell_t* buffer = tty->buffer;
-  
-  tty_hide_cursor(); // Hide the cursor before printing
+// Apply one character at the cursor to the cells of tty. Only damage is
+// recorded, tty_flush paints it.
+static void tty_put_cell(tty_t* tty, char c) {
+  terminal_cell_t blank = {.printable_char = ' ', .fg = currentFg, .bg = currentBg};
+  terminal_cell_t* line = tty_row(tty, tty->y_cursor);
   switch (c) {
-  case '\n': {
+  case '\n':
     // Clear rest of line in buffer
-    terminal_cell_t blank = {.printable_char = ' ', .fg = currentFg, .bg = currentBg};
     for (uint16_t x = tty->x_cursor; x < tty->width; x++) {
-      buffer[tty->y_cursor * tty->width + x] = blank;
+      line[x] = blank;
     }
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->width);
     tty->x_cursor = 0;
     tty->y_cursor++;
     break;
-  }
 
   case '\r':
     tty->x_cursor = 0;
@@ -210,12 +205,11 @@ void tty_putchar_raw(char c) {
 
   case '\t': {
     // Clear cells for tab
-    terminal_cell_t blank = {.printable_char = ' ', .fg = currentFg, .bg = currentBg};
     uint16_t target_x = (tty->x_cursor - (tty->x_cursor % 8)) + 8;
     if (target_x > tty->width) target_x = tty->width;
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, target_x);
     while (tty->x_cursor < target_x) {
-      buffer[tty->y_cursor * tty->width + tty->x_cursor] = blank;
-      tty_paint_cell_psf(blank, tty);
+      line[tty->x_cursor] = blank;
       tty->x_cursor++;
     }
     break;
@@ -228,27 +222,16 @@ void tty_putchar_raw(char c) {
       tty->y_cursor--;
       tty->x_cursor = tty->width - 1;
     }
-
-    {
-      terminal_cell_t blank = {
-          .printable_char = ' ', .fg = currentFg, .bg = currentBg};
-      // Clear the buffer entry too
-      int idx = tty->y_cursor * tty->width + tty->x_cursor;
-      buffer[idx] = blank;
-      tty_paint_cell_psf(blank, tty); // Draw blank at new cursor
-    }
+    // Clear the cell the cursor moved back onto
+    tty_row(tty, tty->y_cursor)[tty->x_cursor] = blank;
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->x_cursor + 1);
     break;
 
   default:
-    {
-      terminal_cell_t cell = {
-          .printable_char = c, .fg = currentFg, .bg = currentBg};
-      // Store in buffer so it can be restored when cursor moves
-      int idx = tty->y_cursor * tty->width + tty->x_cursor;
-      buffer[idx] = cell;
-      tty_paint_cell_psf(cell, tty);
-      tty->x_cursor++;
-    }
+    line[tty->x_cursor] = (terminal_cell_t){
+        .printable_char = c, .fg = currentFg, .bg = currentBg};
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->x_cursor + 1);
+    tty->x_cursor++;
     break;
   }
   if (tty->x_cursor >= tty->width) {
@@ -256,30 +239,73 @@ void tty_putchar_raw(char c) {
     tty->y_cursor++;
   }
   if (tty->y_cursor >= tty->height) {
-    // Scroll buffer: shift all rows up by one
-    for (int row = 1; row < tty->height; ++row) {
-      for (int col = 0; col < tty->width; ++col) {
-        buffer[(row - 1) * tty->width + col] = buffer[row * tty->width + col];
-      }
-    }
-    // Clear the last row
-    terminal_cell_t blank = {.printable_char = ' ', .fg = currentFg, .bg = currentBg};
-    for (int col = 0; col < tty->width; ++col) {
-      buffer[(tty->height - 1) * tty->width + col] = blank;
-    }
-    
-    scroll_framebuffer(currentBg, g_font.header->height);
+    // Scroll buffer up by one row, the screen follows on the next flush
+    tty_scroll_cells(tty, blank);
+    if (tty->scroll_pending < tty->height)
+      tty->scroll_pending++;
     tty->x_cursor = 0;
     tty->y_cursor = tty->height - 1;
   }
-  tty_paint_cursor(tty->x_cursor, tty->y_cursor);
 }
 
-void tty_putchar(char c) { hansi_handler(c); }
+void tty_put_span(const char* s, size_t len) {
+  tty_t* tty = current_tty;
+  if (!tty) return;
+  for (size_t i = 0; i < len; ++i)
+    tty_put_cell(tty, s[i]);
+}
+
+// Common start of an output call, with tty_lock held: the view goes back
+// to the live screen and the cell under the cursor is repainted without it
+static tty_t* tty_output_begin() {
+  tty_t* tty = current_tty;
+  if (!tty) return NULL;
+  // Output always lands on the live screen
+  if (tty->view)
+    tty_set_view(tty, 0);
+  tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->x_cursor + 1);
+  return tty;
+}
+
+void tty_putchar_raw(char c) {
+  spinlock_acquire(&tty_lock);
+  tty_t* tty = tty_output_begin();
+  if (tty)
+    tty_put_cell(tty, c);
+  spinlock_release(&tty_lock);
+  tty_render_kick();
+}
+
+void tty_write_buf(const char* buf, size_t len) {
+  spinlock_acquire(&tty_lock);
+  if (tty_output_begin())
+    hansi_write(buf, len);
+  spinlock_release(&tty_lock);
+  tty_render_kick();
+}
+
+void tty_putchar(char c) { tty_write_buf(&c, 1); }
+
+long tty_write_user(const char* ubuf, size_t len) {
+  char chunk[256];
+  size_t done = 0;
+  while (done < len) {
+    size_t n = len - done < sizeof(chunk) ? len - done : sizeof(chunk);
+    if (copy_from_user(chunk, ubuf + done, n) != 0)
+      break;
+    spinlock_acquire(&tty_lock);
+    if (tty_output_begin())
+      hansi_write(chunk, n);
+    spinlock_release(&tty_lock);
+    done += n;
+  }
+  tty_render_kick();
+  return done || !len ? (long)done : -EFAULT;
+}
 
 // Paint cursor at current TTY's cursor position
 void tty_paint_cursor(uint32_t x, uint32_t y) {
-  if (!current_tty) return;
+  if (!current_tty || current_tty->view) return;
   // Temporarily set cursor position for painting
   uint16_t saved_x = current_tty->x_cursor;
   uint16_t saved_y = current_tty->y_cursor;
@@ -294,36 +320,31 @@ void tty_paint_cursor(uint32_t x, uint32_t y) {
   current_tty->y_cursor = saved_y;
 }
 
-void tty_toggle_cursor_visibility() {
-  if (!current_tty) return;
-  static int cursor_visible = 1;
-  if (cursor_visible) {
-    tty_paint_cursor(current_tty->x_cursor, current_tty->y_cursor);
-  } else {
-    // Restore the actual character from buffer instead of painting space
-    int idx = current_tty->y_cursor * current_tty->width + current_tty->x_cursor;
-    terminal_cell_t cell;
-    if (current_tty->buffer[idx].printable_char != 0) {
-      cell = current_tty->buffer[idx];
-    } else {
-      cell = (terminal_cell_t){.printable_char = ' ', .fg = currentFg, .bg = currentBg};
-    }
-    tty_paint_cell_psf(cell, current_tty);
-  }
-  cursor_visible = !cursor_visible;
-}
-
 void set_currentFg(uint32_t value) { currentFg = value; }
 
 void set_currentBg(uint32_t value) { currentBg = value; }
 
-void tty_clear() {
-  if (current_tty) {
-    current_tty->x_cursor = 0;
-    current_tty->y_cursor = 0;
-    memset(current_tty->buffer, 0, sizeof(terminal_cell_t) * current_tty->width * current_tty->height);
+void tty_erase(tty_t* tty) {
+  terminal_cell_t blank = {.printable_char = ' ', .fg = currentFg, .bg = currentBg};
+  tty->x_cursor = 0;
+  tty->y_cursor = 0;
+  tty->view = 0;
+  tty->scroll_pending = 0;
+  // The history stays, only the screen is wiped
+  for (uint16_t row = 0; row < tty->height; ++row) {
+    terminal_cell_t* line = tty_row(tty, row);
+    for (uint16_t col = 0; col < tty->width; ++col)
+      line[col] = blank;
   }
-  framebuffer_clear(currentBg);
+  tty_damage_all(tty);
+}
+
+void tty_clear() {
+  spinlock_acquire(&tty_lock);
+  if (current_tty)
+    tty_erase(current_tty);
+  spinlock_release(&tty_lock);
+  tty_render_kick();
 }
 
 tty_t* get_current_tty(){
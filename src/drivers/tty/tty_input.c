@@ -1,22 +1,54 @@
 #include <drivers/tty/tty.h>
 #include <drivers/tty/psf2.h>
 #include <drivers/framebuffer.h>
+#include <drivers/keyboard.h>
+#include <kernel/sched/scheduler.h>
+#include <libk/utils.h>
 #include <stddef.h>
 #include <stdint.h>
 
+static task_t* input_task;
+
 void tty_set_ldisc(tty_t* tty, int mode) {
   tty->ldisc_mode = mode;
 }
 
+// Line editing and echo run here, in task context, rather than in the
+// keyboard IRQ, which only queues scancodes
+static void input_loop() {
+  // Sleeping first lets an IRQ still draining the queue itself (before
+  // input_task was set) finish
+  scheduler_sleep(1);
+  for (;;) {
+    keyboard_process();
+    // The keyboard IRQ wakes us through tty_input_wake
+    scheduler_block(keyboard_pending);
+  }
+}
+
+void init_tty_input() {
+  // From here on the IRQ only queues, this task is the one consumer
+  keyboard_set_deferred(true);
+  input_task = create_kernel_task(input_loop, 4);
+  if (!input_task) {
+    keyboard_set_deferred(false);
+    log("TTY", ERROR, "No input task, handling keys in the IRQ\n\r");
+    return;
+  }
+  log("TTY", INFO, "Input task id=%d\n\r", input_task->id);
+}
+
+int tty_input_wake() {
+  if (!input_task) return 0;
+  task_wake(input_task);
+  return 1;
+}
+
 // Handle a character input from keyboard to a specific TTY
 void tty_input_char(tty_t* tty, char c) {
   if (tty->ldisc_mode == TTY_RAW) {
-    // Raw mode: just put char directly into input buffer
-    size_t next_head = (tty->input_head + 1) % TTY_MAX_BUF;
-    if (next_head != tty->input_tail) { // Buffer not full
-      tty->input_buf[tty->input_head] = c;
-      tty->input_head = next_head;
-    }
+    // Raw mode: just put char directly into input buffer (dropped if full)
+    spsc_push(&tty->input, (uint8_t)c);
     // Don't echo in raw mode for escape sequences
     if (tty->echo && tty->id == current_tty->id && c >= 32 && c < 127) {
       tty_putchar(c);
@@ -102,17 +134,17 @@ void tty_input_char(tty_t* tty, char c) {
       if (tty->line_length < TTY_MAX_BUF - 1) {
         tty->line_buffer[tty->line_length++] = '\n';
       }
-      // Copy line to input ring buffer
-      for (size_t i = 0; i < tty->line_length; i++) {
-        size_t next_head = (tty->input_head + 1) % TTY_MAX_BUF;
-        if (next_head != tty->input_tail) {
-          tty->input_buf[tty->input_head] = tty->line_buffer[i];
-          tty->input_head = next_head;
-        }
+      // Copy line to input ring buffer, whole or not at all so that every
+      // counted line ends in a newline
+      if (spsc_space(&tty->input) >= tty->line_length) {
+        for (size_t i = 0; i < tty->line_length; i++)
+          spsc_push(&tty->input, (uint8_t)tty->line_buffer[i]);
+        atomic_fetch_add_explicit(&tty->lines_ready, 1, memory_order_release);
+      } else {
+        atomic_fetch_add_explicit(&tty->input.dropped, tty->line_length, memory_order_relaxed);
       }
       tty->line_length = 0;
       tty->line_cursor = 0;
-      tty->line_ready = true;
       // Echo newline
       if (tty->echo && tty->id == current_tty->id) {
         tty_putchar('\n');
@@ -192,34 +224,30 @@ long tty_read(file_t* file, void* buf, size_t len, uint64_t off) {
   
   if (tty->ldisc_mode == TTY_CANONICAL) {
     // Canonical mode: wait for a complete line
-    while (!tty->line_ready) {
+    while (!atomic_load_explicit(&tty->lines_ready, memory_order_acquire)) {
       // Wait for input (allow interrupts)
-      asm volatile("sti; hlt; cli");
+      sched_wait();
     }
     
     // Read from input buffer until newline or len reached
-    while (bytes_read < len && tty->input_tail != tty->input_head) {
-      char c = tty->input_buf[tty->input_tail];
-      tty->input_tail = (tty->input_tail + 1) % TTY_MAX_BUF;
+    uint8_t c;
+    while (bytes_read < len && spsc_pop(&tty->input, &c)) {
       dest[bytes_read++] = c;
       if (c == '\n') {
-        break;  // Return at end of line in canonical mode
+        // Return at end of line in canonical mode
+        atomic_fetch_sub_explicit(&tty->lines_ready, 1, memory_order_relaxed);
+        break;
       }
     }
-    
-    // Check if more data available, if not reset line_ready
-    if (tty->input_tail == tty->input_head) {
-      tty->line_ready = false;
-    }
   } else {
     // Raw mode: return whatever is available, or wait for at least one char
-    while (tty->input_tail == tty->input_head) {
-      asm volatile("sti; hlt; cli");
+    while (spsc_empty(&tty->input)) {
+      sched_wait();
     }
     
-    while (bytes_read < len && tty->input_tail != tty->input_head) {
-      dest[bytes_read++] = tty->input_buf[tty->input_tail];
-      tty->input_tail = (tty->input_tail + 1) % TTY_MAX_BUF;
+    uint8_t c;
+    while (bytes_read < len && spsc_pop(&tty->input, &c)) {
+      dest[bytes_read++] = c;
     }
   }
   
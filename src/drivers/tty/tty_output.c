@@ -1,19 +1,65 @@
 #include <drivers/tty/tty.h>
 #include <drivers/tty/psf2.h>
+#include <libk/string.h>
+#include <mm/uaccess.h>
 #include <stddef.h>
 #include <stdint.h>
 
+void tty_damage_all(tty_t* tty){
+  for (uint16_t row = 0; row < tty->height; ++row) {
+    tty->damage_lo[row] = 0;
+    tty->damage_hi[row] = tty->width;
+  }
+  tty->dirty = true;
+}
+
+
+void tty_scroll_cells(tty_t* tty, terminal_cell_t blank){
+  size_t rows = tty->height - 1;
+  // The top row joins the history, the oldest history row comes back as
+  // the new last row
+  tty->head = (tty->head + 1) % tty->rows;
+  if (tty->history < tty->rows - tty->height)
+    tty->history++;
+  memmove(tty->damage_lo, tty->damage_lo + 1, sizeof(uint16_t) * rows);
+  memmove(tty->damage_hi, tty->damage_hi + 1, sizeof(uint16_t) * rows);
+  terminal_cell_t* last = tty_row(tty, rows);
+  for (int col = 0; col < tty->width; ++col) {
+    last[col] = blank;
+  }
+  tty_damage(tty, rows, 0, tty->width);
+}
+
+void tty_set_view(tty_t* tty, uint16_t view){
+  tty->view = view;
+  tty->scroll_pending = 0;
+  tty_damage_all(tty);
+}
+
+void tty_scrollback(tty_t* tty, int lines){
+  spinlock_acquire(&tty_lock);
+  int view = (int)tty->view + lines;
+  if (view < 0) view = 0;
+  if (view > tty->history) view = tty->history;
+  if (view != tty->view)
+    tty_set_view(tty, view);
+  spinlock_release(&tty_lock);
+  tty_render_kick();
+}
 
 void tty_push(tty_t* tty, terminal_cell_t* cell){
-  terminal_cell_t* buffer = tty->buffer;
+  if (tty->view)
+    tty_set_view(tty, 0);
+  terminal_cell_t* line = tty_row(tty, tty->y_cursor);
   char c = cell->printable_char;
   switch (c) {
   case '\n': {
     // Clear from current cursor to end of line before moving to next line
     terminal_cell_t blank = {.printable_char = ' ', .fg = cell->fg, .bg = cell->bg};
     for (uint16_t x = tty->x_cursor; x < tty->width; x++) {
-      buffer[tty->y_cursor * tty->width + x] = blank;
+      line[x] = blank;
     }
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->width);
     tty->x_cursor = 0;
     tty->y_cursor++;
     break;
@@ -28,8 +74,9 @@ void tty_push(tty_t* tty, terminal_cell_t* cell){
     uint16_t target_x = (tty->x_cursor - (tty->x_cursor % 8)) + 8;
     if (target_x > tty->width) target_x = tty->width;
     terminal_cell_t blank = {.printable_char = ' ', .fg = cell->fg, .bg = cell->bg};
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, target_x);
     while (tty->x_cursor < target_x) {
-      buffer[tty->y_cursor * tty->width + tty->x_cursor] = blank;
+      line[tty->x_cursor] = blank;
       tty->x_cursor++;
     }
     break;
@@ -43,7 +90,8 @@ void tty_push(tty_t* tty, terminal_cell_t* cell){
     }
     break;
   default:
-      buffer[tty->y_cursor * tty->width + tty->x_cursor] = *cell;
+      line[tty->x_cursor] = *cell;
+      tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->x_cursor + 1);
       tty->x_cursor++;
     break;
   }
@@ -52,30 +100,26 @@ void tty_push(tty_t* tty, terminal_cell_t* cell){
     tty->y_cursor++;
   }
   if (tty->y_cursor >= tty->height) {
-    // Scroll buffer: shift all rows up by one
-    for (int row = 1; row < tty->height; ++row) {
-      for (int col = 0; col < tty->width; ++col) {
-        buffer[(row - 1) * tty->width + col] = buffer[row * tty->width + col];
-      }
-    }
     // Clear the last row with proper space characters
     terminal_cell_t blank = {.printable_char = ' ', .fg = tty->colors[7], .bg = tty->colors[0]};
-    for (int col = 0; col < tty->width; ++col) {
-      buffer[(tty->height - 1) * tty->width + col] = blank;
-    }
+    tty_scroll_cells(tty, blank);
     // Keep cursor at the last row
     tty->y_cursor = tty->height - 1;
-    // Don't scroll framebuffer here - tty_write will do full repaint
+    // The framebuffer is moved once per flush, however many lines scrolled
+    if (tty->scroll_pending < tty->height)
+      tty->scroll_pending++;
   }
 
 }
 
+// data is the caller's user buffer: it is copied in chunks before
+// tty_lock is taken, the same way tty_write_user does for fd 1 and 2
 long tty_write(file_t* file, const void* data, size_t len, uint64_t off){
   (void)off;
   if (!data) {
     return -1;
   }
-  const char* str = (const char*)data;
+  const char* ubuf = (const char*)data;
   size_t bytes_wrote = 0;
  
   tty_t* tty = &ttys[file->inode->ino - 6000];
@@ -83,65 +127,110 @@ long tty_write(file_t* file, const void* data, size_t len, uint64_t off){
   terminal_cell_t cell;
   cell.fg = tty->colors[7];
   cell.bg = tty->colors[0];
-  
-  while(bytes_wrote < len && str[bytes_wrote] != 0){
-    cell.printable_char = str[bytes_wrote];
-    tty_push(tty, &cell);
-    bytes_wrote++;
-  }
-  
-  // After all characters are pushed, repaint the entire screen from buffer
-  if (tty->id == current_tty->id) {
-    framebuffer_clear(tty->colors[0]);
-    uint16_t saved_x = tty->x_cursor;
-    uint16_t saved_y = tty->y_cursor;
-    
-    for (int row = 0; row < tty->height; ++row) {
-      for (int col = 0; col < tty->width; ++col) {
-        int i = row * tty->width + col;
-        terminal_cell_t c = tty->buffer[i];
-        if (c.printable_char == 0) {
-          c.printable_char = ' ';
-          c.fg = tty->colors[7];
-          c.bg = tty->colors[0];
-        }
-        tty->x_cursor = col;
-        tty->y_cursor = row;
-        tty_paint_cell_psf(c, tty);
+
+  char chunk[256];
+  bool end = false;
+  while(bytes_wrote < len && !end){
+    size_t n = len - bytes_wrote < sizeof(chunk) ? len - bytes_wrote : sizeof(chunk);
+    if (copy_from_user(chunk, ubuf + bytes_wrote, n) != 0)
+      break;
+    spinlock_acquire(&tty_lock);
+    for (size_t i = 0; i < n; i++) {
+      if (chunk[i] == 0) {
+        end = true;
+        break;
       }
+      cell.printable_char = chunk[i];
+      tty_push(tty, &cell);
+      bytes_wrote++;
     }
-    
-    tty->x_cursor = saved_x;
-    tty->y_cursor = saved_y;
+    spinlock_release(&tty_lock);
   }
-  
-  return (long)bytes_wrote;
+
+  tty_render_kick();
+
+  return bytes_wrote || !len || end ? (long)bytes_wrote : -EFAULT;
 }
 
-void tty_switch(int id){
-  tty_t* tty = &ttys[id];
-  uint16_t saved_x = tty->x_cursor;
-  uint16_t saved_y = tty->y_cursor;
-  
-  framebuffer_clear(tty->colors[0]);
-  
-  for(int row = 0; row < tty->height; ++row){
-    for(int col = 0; col < tty->width; ++col){
-      int i = row * tty->width + col;
-      tty->x_cursor = col;
-      tty->y_cursor = row;
-      // If cell is empty (printable_char == 0), paint as space
-      terminal_cell_t cell = tty->buffer[i];
-      if (cell.printable_char == 0) {
-        cell.printable_char = ' ';
-        cell.fg = tty->colors[7];
-        cell.bg = tty->colors[0];
+// Cells copied out of a damaged row under tty_lock, painted after it is
+// dropped. tty_flush has one caller at a time, see tty_render_frame.
+#define FLUSH_CELLS 256
+static terminal_cell_t flush_cells[FLUSH_CELLS];
+
+void tty_flush(tty_t* tty){
+  if (!g_font.header || !g_font.glyphBuffer)
+    return;
+
+  uint16_t row = 0;
+  spinlock_acquire(&tty_lock);
+  tty->dirty = false;
+  while (tty == current_tty) {
+    if (tty->scroll_pending) {
+      // Move the pixels before painting anything below the scroll. If it
+      // happened halfway through, the rows painted so far moved with it
+      // and the damage left below did too, so start over from the top.
+      uint16_t lines = tty->scroll_pending;
+      uint32_t bg = tty->colors[0];
+      tty->scroll_pending = 0;
+      tty->dirty = false;
+      row = 0;
+      if (lines >= tty->height) {
+        // Every row was rewritten, moving pixels would be wasted
+        tty_damage_all(tty);
+        tty->dirty = false;
+        continue;
       }
-      tty_paint_cell_psf(cell, tty);
+      spinlock_release(&tty_lock);
+      scroll_framebuffer(bg, lines * g_font.header->height);
+      spinlock_acquire(&tty_lock);
+      continue;
+    }
+
+    while (row < tty->height && tty->damage_lo[row] >= tty->damage_hi[row])
+      row++;
+    if (row >= tty->height)
+      break;
+
+    uint16_t lo = tty->damage_lo[row];
+    uint16_t hi = tty->damage_hi[row];
+    if (hi - lo > FLUSH_CELLS)
+      hi = lo + FLUSH_CELLS;
+    terminal_cell_t* line = tty_view_row(tty, row);
+    for (uint16_t col = lo; col < hi; ++col) {
+      terminal_cell_t c = line[col];
+      if (c.printable_char == 0) {
+        c.printable_char = ' ';
+        c.fg = tty->colors[7];
+        c.bg = tty->colors[0];
+      }
+      flush_cells[col - lo] = c;
+    }
+    uint16_t y = row;
+    if (hi == tty->damage_hi[row]) {
+      tty->damage_lo[row] = tty->width;
+      tty->damage_hi[row] = 0;
+      row++;
+    } else {
+      tty->damage_lo[row] = hi;
     }
+    spinlock_release(&tty_lock);
+
+    for (uint16_t col = lo; col < hi; ++col)
+      tty_paint_cell_at(flush_cells[col - lo], col, y);
+
+    spinlock_acquire(&tty_lock);
   }
-  
-  tty->x_cursor = saved_x;
-  tty->y_cursor = saved_y;
+  spinlock_release(&tty_lock);
+}
+
+void tty_switch(int id){
+  tty_t* tty = &ttys[id];
+
+  // Nothing on screen belongs to the new tty, repaint all of it
+  spinlock_acquire(&tty_lock);
   current_tty = tty;
-}
\ No newline at end of file
+  tty->scroll_pending = 0;
+  tty_damage_all(tty);
+  spinlock_release(&tty_lock);
+  tty_render_kick();
+}
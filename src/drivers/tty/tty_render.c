@@ -0,0 +1,86 @@
+#include <drivers/tty/tty.h>
+#include <drivers/tty/psf2.h>
+#include <drivers/framebuffer.h>
+#include <drivers/pit.h>
+#include <kernel/sched/scheduler.h>
+#include <libk/utils.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Writers only touch cells and damage. This task turns them into pixels:
+// every frame it paints the damage that piled up since the last one, so a
+// burst of output costs one repaint however many writes it took.
+
+static task_t* render_task;
+static int cursor_phase = -1;   // 0 while the cursor is shown
+
+// Whoever paints owns the framebuffer and the flush buffer of tty_flush
+static _Atomic int painting;
+
+// Paint the damage and the cursor of the current tty. tty_lock is only
+// held to copy state out, the rasterising runs with interrupts enabled.
+static void render_once() {
+  spinlock_acquire(&tty_lock);
+  tty_t* tty = current_tty;
+  int phase = hz >= 2 ? (int)((get_ticks() / (hz / 2)) & 1) : 0;
+  if (!tty || (!tty->dirty && phase == cursor_phase)) {
+    spinlock_release(&tty_lock);
+    return;
+  }
+
+  // Blinking off: paint the cell back over the cursor
+  if (phase && phase != cursor_phase)
+    tty_damage(tty, tty->y_cursor, tty->x_cursor, tty->x_cursor + 1);
+  cursor_phase = phase;
+  spinlock_release(&tty_lock);
+
+  tty_flush(tty);
+
+  if (!phase) {
+    spinlock_acquire(&tty_lock);
+    bool show = tty == current_tty && !tty->view;
+    uint16_t x = tty->x_cursor;
+    uint16_t y = tty->y_cursor;
+    terminal_cell_t cursor = {.printable_char = '_', .fg = currentFg, .bg = currentBg};
+    spinlock_release(&tty_lock);
+    if (show && g_font.header && g_font.glyphBuffer)
+      tty_paint_cell_at(cursor, x, y);
+  }
+
+  framebuffer_flush();
+}
+
+void tty_render_frame() {
+  // A caller that finds someone painting leaves its damage to them, the
+  // painter looks for more before giving up
+  do {
+    if (atomic_exchange_explicit(&painting, 1, memory_order_acquire))
+      return;
+    render_once();
+    atomic_store_explicit(&painting, 0, memory_order_release);
+  } while (current_tty && current_tty->dirty);
+}
+
+void tty_render_kick() {
+  if (!render_task)
+    tty_render_frame();
+}
+
+static void render_loop() {
+  uint64_t frame_ticks = (hz + TTY_RENDER_HZ - 1) / TTY_RENDER_HZ;
+  if (!frame_ticks) frame_ticks = 1;
+  for (;;) {
+    scheduler_sleep(frame_ticks);
+    tty_render_frame();
+  }
+}
+
+void init_tty_render() {
+  render_task = create_kernel_task(render_loop, 4);
+  if (!render_task) {
+    log("TTY", ERROR, "No render task, painting on every write\n\r");
+    return;
+  }
+  log("TTY", INFO, "Render task id=%d, at most %d frames/s\n\r", render_task->id, TTY_RENDER_HZ);
+}
@@ -0,0 +1,97 @@
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include <arch/x86_64/gdt.h>
+#include <kernel/sched/scheduler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_CPUS 16
+#define PCID_COUNT 4096
+#define IST_STACK_SIZE (4096 * 4)
+
+#define MSR_APIC_BASE       0x1B
+#define MSR_PAT             0x277
+#define MSR_EFER            0xC0000080
+#define MSR_STAR            0xC0000081
+#define MSR_LSTAR           0xC0000082
+#define MSR_SFMASK          0xC0000084
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
+// Per-CPU state, reachable through the GS base while in the kernel.
+// The first fields are read from assembly, keep the offsets below in sync.
+typedef struct cpu {
+    struct cpu *self;          // gs:0
+    uint64_t kernel_stack;     // gs:8  - rsp0 of the task running on this CPU
+    uint64_t user_rsp;         // gs:16 - scratch slot for the syscall entry path
+    struct task *current;      // gs:24
+
+    uint32_t id;
+    uint32_t lapic_id;
+    volatile int online;
+
+    struct task *idle;         // Context this CPU was running before its first task
+    run_queue_t rq;
+    uint64_t nr_steals;        // Tasks this CPU pulled from others
+    uint64_t nr_stolen;        // Tasks others pulled from this CPU
+    volatile uint64_t active_cr3;
+
+    // TLB shootdown mailbox, filled by the initiating CPU
+    volatile uint64_t tlb_addr;
+    volatile size_t tlb_pages;
+    volatile int tlb_pending;
+    // PCIDs whose cached translations may be stale on this CPU, the next
+    // switch to one of them flushes it instead of keeping its entries
+    uint64_t pcid_stale[PCID_COUNT / 64];
+
+    __attribute__((aligned(16))) gdt_entry_t gdt[7];
+    gdt_descriptor_t gdtr;
+    tss_t tss;
+    uint8_t *ist_stack;
+} cpu_t;
+
+#define CPU_SELF_OFFSET         0
+#define CPU_KERNEL_STACK_OFFSET 8
+#define CPU_USER_RSP_OFFSET     16
+#define CPU_CURRENT_OFFSET      24
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t cpu_count;
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b,
+                         uint32_t *c, uint32_t *d) {
+    asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static inline cpu_t *this_cpu(void) {
+    cpu_t *cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline uint64_t irq_save_disable(void) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
+void cpu_init_bsp(void);
+void cpu_set_local(cpu_t *cpu);
+cpu_t *cpu_prepare_ap(uint32_t lapic_id);
+
+#endif
@@ -59,9 +59,12 @@ typedef struct{
     uint64_t offset;
 } __attribute__((packed)) gdt_descriptor_t;
 
+struct cpu;
+
 extern void load_gdt(gdt_descriptor_t* gdt);
 extern void load_tss(uint16_t selector);
 void init_gdt();
+void gdt_init_cpu(struct cpu *cpu);
 void tss_set_kernel_stack(uint64_t stack);
 
 #endif
\ No newline at end of file
@@ -20,6 +20,8 @@ typedef struct{
 } __attribute__((packed)) idt_desc_t;
 
 void idt_set_gate(uint8_t num, uint64_t base, uint16_t sel, uint8_t flags);
+void idt_set_ist(uint8_t num, uint8_t ist);
+void idt_load();
 void init_idt();
 
 #endif
\ No newline at end of file
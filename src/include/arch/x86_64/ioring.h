@@ -0,0 +1,64 @@
+#ifndef __IORING_H__
+#define __IORING_H__
+
+#include <stdint.h>
+
+// Batched syscall interface. A task maps one ring with SYS_IO_SETUP, fills
+// submission entries (SQEs) and hands them over with a single SYS_IO_ENTER;
+// every SQE produces one completion entry (CQE) in the same mapping.
+// The layout is ABI and mirrored in userland/source/stubs.c.
+
+#define IORING_MAX_ENTRIES 256
+
+#define IORING_OP_NOP        0
+#define IORING_OP_READ       1   // fd, addr = buf, len
+#define IORING_OP_WRITE      2   // fd, addr = buf, len
+#define IORING_OP_OPEN       3   // addr = path, op_flags = open flags
+#define IORING_OP_CLOSE      4   // fd
+#define IORING_OP_STAT       5   // addr = path, addr2 = struct stat
+#define IORING_OP_FSTAT      6   // fd, addr = struct stat
+#define IORING_OP_GETDENTS64 7   // fd, addr = buf, len
+
+// The next SQE only runs if this one succeeds, otherwise the rest of the
+// chain completes with -IORING_ECANCELED. A WRITE that writes fewer bytes
+// than asked counts as failing here.
+#define IOSQE_LINK         (1 << 0)
+// Take len from the result of the previous SQE in the chain, so a READ can
+// be linked to the WRITE that consumes it
+#define IOSQE_LEN_FROM_PREV (1 << 1)
+
+#define IORING_ECANCELED 125
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;       // IOSQE_*
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t addr;
+    uint64_t addr2;
+    uint32_t len;
+    uint32_t op_flags;
+    uint64_t user_data;  // Copied to the CQE untouched
+} io_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t res;         // Syscall return value
+} io_cqe_t;
+
+// Sits at the start of the mapping. Userland owns sq_tail and cq_head,
+// the kernel owns sq_head and cq_tail. Indices run freely and are masked.
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_entries;
+    uint32_t sq_off;     // Byte offset of the SQE array
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_entries; // Twice sq_entries
+    uint32_t cq_off;     // Byte offset of the CQE array
+    uint64_t nr_enters;
+    uint64_t nr_sqes;
+} io_ring_t;
+
+#endif
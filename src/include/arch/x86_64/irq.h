@@ -10,6 +10,6 @@ void init_irq();
 void irq_install_handler(int irq, void (*handler)(register_t* regs));
 void irq_uninstall_handler(int irq);
 void send_eoi(int irq);
-void irq_handler(register_t* regs);
+register_t* irq_handler(register_t* regs);
 
 #endif
\ No newline at end of file
@@ -6,6 +6,6 @@
 void init_isr();
 void isr_install_handler(int isr, void (*handler)(register_t* regs));
 void isr_uninstall_handler(int isr);
-void fault_handler(register_t* regs);
+register_t* fault_handler(register_t* regs);
 
 #endif
\ No newline at end of file
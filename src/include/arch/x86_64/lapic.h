@@ -0,0 +1,19 @@
+#ifndef __LAPIC_H__
+#define __LAPIC_H__
+
+#include <stdint.h>
+
+// Vectors above the PIC range, serviced through the local APIC
+#define LAPIC_TIMER_VECTOR   48
+#define IPI_RESCHEDULE       0xF0
+#define IPI_TLB_SHOOTDOWN    0xF1
+#define LAPIC_SPURIOUS       0xFF
+
+void lapic_init(void);
+void lapic_eoi(void);
+uint32_t lapic_id(void);
+void lapic_send_ipi(uint32_t lapic_id, uint8_t vector);
+void lapic_timer_calibrate(void);
+void lapic_timer_start(void);
+
+#endif
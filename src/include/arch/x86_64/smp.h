@@ -0,0 +1,22 @@
+#ifndef __SMP_H__
+#define __SMP_H__
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/regs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+void init_smp(void);
+
+// Kick a CPU so it reschedules right away instead of at its next tick
+void smp_send_reschedule(cpu_t *cpu);
+
+// Invalidate [addr, addr + pages * 4096) on every other CPU that currently
+// has cr3 loaded (cr3 == 0 targets all CPUs, for kernel mappings).
+// Returns once all of them have flushed.
+void smp_tlb_shootdown(uint64_t cr3, uint64_t addr, size_t pages);
+
+// Handle a pending shootdown request for the calling CPU (IPI handler)
+void smp_tlb_service(void);
+
+#endif
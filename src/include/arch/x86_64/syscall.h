@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <arch/x86_64/regs.h>
+#include <kernel/sched/scheduler.h>
 #include <stddef.h>
 
 #define SYS_EXIT        0
@@ -25,12 +26,19 @@
 #define SYS_MKDIR       17
 #define SYS_UNLINK      18
 #define SYS_LSEEK       19
+#define SYS_GETPID      20
+#define SYS_IO_SETUP    21
+#define SYS_IO_ENTER    22
+#define SYS_MPROTECT    23
+#define SYS_MSYNC       24
 
 
 #define MAX_SYSCALLS 32
 
 
-extern register_t *current_syscall_regs;
+// Frame of the syscall the calling task is in, kept per task so CPUs
+// servicing syscalls concurrently don't clobber each other
+#define current_syscall_regs (get_current_task()->syscall_regs)
 
 // Syscall handler function type
 typedef int64_t (*syscall_handler_t)(uint64_t arg1, uint64_t arg2, uint64_t arg3, 
@@ -40,6 +48,7 @@ typedef int64_t (*syscall_handler_t)(uint64_t arg1, uint64_t arg2, uint64_t arg3
 extern syscall_handler_t syscall_handlers[MAX_SYSCALLS];
 
 void init_syscalls(void);
+void syscall_init_cpu(void);
 
 
 void syscall_register(uint32_t num, syscall_handler_t handler);
@@ -92,5 +101,17 @@ int64_t sys_unlink(uint64_t path_ptr, uint64_t arg2, uint64_t arg3,
                    uint64_t arg4, uint64_t arg5, uint64_t arg6);
 int64_t sys_lseek(uint64_t fd, uint64_t offset, uint64_t whence,
                   uint64_t arg4, uint64_t arg5, uint64_t arg6);
+int64_t sys_getpid(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                   uint64_t arg4, uint64_t arg5, uint64_t arg6);
+int64_t sys_io_setup(uint64_t entries, uint64_t arg2, uint64_t arg3,
+                     uint64_t arg4, uint64_t arg5, uint64_t arg6);
+int64_t sys_io_enter(uint64_t to_submit, uint64_t arg2, uint64_t arg3,
+                     uint64_t arg4, uint64_t arg5, uint64_t arg6);
+// Drop the task's ring if [start, end) overlaps it (munmap, MAP_FIXED)
+void ioring_forget(task_t *t, uint64_t start, uint64_t end);
+int64_t sys_mprotect(uint64_t addr, uint64_t length, uint64_t prot,
+                     uint64_t arg4, uint64_t arg5, uint64_t arg6);
+int64_t sys_msync(uint64_t addr, uint64_t length, uint64_t flags,
+                  uint64_t arg4, uint64_t arg5, uint64_t arg6);
 
 #endif
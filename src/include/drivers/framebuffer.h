@@ -13,8 +13,11 @@ typedef struct {
 
 void init_framebuffer();
 void framebuffer_put_pixel(int x_pos, uint32_t y_pos, uint32_t color);
+void framebuffer_blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint32_t *src);
 void framebuffer_clear(uint32_t color);
+// Copy what was drawn since the last flush to the screen
+void framebuffer_flush();
 fb_info_t *get_fb_info();
-void scroll_framebuffer(uint32_t color, uint8_t pixel_count);
+void scroll_framebuffer(uint32_t color, uint32_t pixel_count);
 
 #endif
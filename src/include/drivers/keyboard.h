@@ -36,11 +36,18 @@
 #define KEY_DELETE              0x53
 
 #include <arch/x86_64/regs.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 void keyboard_install(void);
 void keyboard_handler(register_t* regs);
 void handleKey_normal(uint8_t scancode);
+// Run queued scancodes through handleKey_normal. Only one context may do
+// this: the IRQ itself, or once deferred is set the TTY input task.
+void keyboard_process(void);
+// Scancodes are queued for keyboard_process
+int keyboard_pending(void);
+void keyboard_set_deferred(bool on);
 char keyboard_read();
 
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <arch/x86_64/regs.h>
 #include <stdint.h>
 
+extern uint16_t hz;
+
 void pit_handler(register_t* regs);
 void pit_install(uint16_t hertz);
 void pit_wait(int ticks);
@@ -15,6 +15,13 @@ bool is_serial_initialized();
 void serial_putchar(char c);
 void serial_puts(const char* str);
 void serial_printf(char* fmt, ...);
+// Wait until everything queued has reached the UART
+void serial_flush();
+// Back to polled output for the fatal exception path, queued bytes first
+void serial_panic();
+// Drop log()/dbgln() output instead of waiting when the TX ring is full
+void serial_set_log_nonblock(bool on);
+long serial_read(file_t* file, void* buf, size_t count, uint64_t off);
 long serial_write(file_t* file, const void* buf, size_t count, uint64_t off);
 void init_serial_device();
 
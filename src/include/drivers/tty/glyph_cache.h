@@ -0,0 +1,18 @@
+#ifndef __GLYPH_CACHE_H__
+#define __GLYPH_CACHE_H__
+
+#include <stdint.h>
+
+// Cache of PSF glyphs already expanded to 32bpp for one (fg, bg) pair, so
+// painting a cell is a block copy per pixel row. Entries are recycled in
+// least recently used order once GLYPH_CACHE_BYTES of pixels are in use.
+#define GLYPH_CACHE_BYTES (256 * 1024)
+
+// Size the cache for the loaded font. Until this succeeds
+// glyph_cache_paint expands glyphs on the fly.
+void glyph_cache_init();
+
+// Draw glyph at pixel position (x, y) of the framebuffer
+void glyph_cache_paint(uint8_t glyph, uint32_t fg, uint32_t bg, uint32_t x, uint32_t y);
+
+#endif
@@ -8,6 +8,7 @@
 #define HTERM_ENDARGS	4
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct {
     int value;
@@ -20,6 +21,8 @@ typedef struct{
 	ansi_args args[MAX_ARGS];
 } hansi_parser;
 
-void hansi_handler(char c);
+// Parse a whole buffer, text between escape sequences goes to
+// tty_put_span in runs. Caller holds tty_lock (see tty_write_buf).
+void hansi_write(const char* buf, size_t len);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <libk/spinlock.h>
+#include <libk/ring.h>
 #include <drivers/framebuffer.h>
 
 #define TTY_MAX_BUF 256
@@ -16,6 +17,9 @@
 
 #define TTY_NUM       4
 
+// Lines of history kept above the screen of each tty
+#define TTY_SCROLLBACK 256
+
 typedef struct {
   char printable_char;
   uint32_t fg;
@@ -30,28 +34,42 @@ typedef struct {
 typedef struct {
   uint8_t id;
 
+  // Ring of rows: the screen is the height rows starting at head, the
+  // history lines before it. Scrolling moves head and recycles the
+  // oldest row.
   terminal_cell_t *buffer;
   uint32_t *colors;
   uint16_t width;
   uint16_t height;
+  uint16_t rows;            // Rows in the ring, screen plus history
+  uint16_t head;
+  uint16_t history;         // History lines holding output so far
+  uint16_t view;            // Lines scrolled back, 0 shows the live screen
 
   uint16_t x_cursor;
   uint16_t y_cursor;
 
+  // Damage since the last repaint: cells [damage_lo[row], damage_hi[row])
+  // of each row changed (none if lo >= hi), after the screen scrolled up
+  // scroll_pending lines
+  uint16_t *damage_lo;
+  uint16_t *damage_hi;
+  uint16_t scroll_pending;
+  bool dirty;               // Anything to repaint at all
+
   // Line discipline modes
   int ldisc_mode;           // TTY_CANONICAL or TTY_RAW
   bool echo;                // Echo input to screen
   
-  // Input ring buffer
+  // Input ring buffer: the input task produces, tty_read consumes
   char input_buf[TTY_MAX_BUF];
-  volatile size_t input_head;   // Write position (keyboard writes here)
-  volatile size_t input_tail;   // Read position (tty_read reads from here)
+  spsc_ring_t input;
   
   // Canonical mode line editing buffer
   char line_buffer[TTY_MAX_BUF];
   size_t line_length;
   size_t line_cursor;           // Cursor position within line buffer for editing
-  volatile bool line_ready;     // Set when Enter is pressed in canonical mode
+  _Atomic uint32_t lines_ready; // Complete lines in input (canonical mode)
   
   // Input escape sequence parser state
   int input_esc_state;
@@ -65,6 +83,28 @@ typedef struct {
 
 extern tty_t* current_tty;
 
+// Guards the cells, cursors and damage of every tty and the choice of
+// current_tty. Writers only update cells under it, painting is left to the
+// render task (tty_render.c).
+extern spinlock_t tty_lock;
+
+// Cells [lo, hi) of row need repainting
+static inline void tty_damage(tty_t* tty, uint16_t row, uint16_t lo, uint16_t hi) {
+  if (lo < tty->damage_lo[row]) tty->damage_lo[row] = lo;
+  if (hi > tty->damage_hi[row]) tty->damage_hi[row] = hi;
+  tty->dirty = true;
+}
+
+// Row y of the live screen
+static inline terminal_cell_t* tty_row(tty_t* tty, uint16_t y) {
+  return tty->buffer + (size_t)((tty->head + y) % tty->rows) * tty->width;
+}
+
+// Row y of what is on screen, history included while scrolled back
+static inline terminal_cell_t* tty_view_row(tty_t* tty, uint16_t y) {
+  return tty->buffer + (size_t)((tty->head + tty->rows - tty->view + y) % tty->rows) * tty->width;
+}
+
 extern uint32_t colors[16];
 
 extern uint32_t currentBg;
@@ -88,20 +128,60 @@ void init_colors(uint32_t black, uint32_t red, uint32_t green, uint32_t yellow,
 
 void tty_paint_cell(terminal_cell_t cell);
 void tty_paint_cell_psf(terminal_cell_t cell, tty_t* tty);
+void tty_paint_cell_at(terminal_cell_t cell, uint16_t cell_x, uint16_t cell_y);
 void tty_putchar_raw(char c);
 void tty_putchar(char c);
+// Write len bytes through the ANSI parser in one go: the cursor is hidden
+// and shown, and the damage painted, once for the whole buffer
+void tty_write_buf(const char* buf, size_t len);
+// tty_write_buf for a user buffer: copied in chunks first, so the parser
+// never touches user memory with tty_lock held. Bytes written or -EFAULT.
+long tty_write_user(const char* ubuf, size_t len);
+// Plain text (no escape sequences) into the cells of the current tty,
+// painted by the next flush
+void tty_put_span(const char* s, size_t len);
 void tty_paint_cursor(uint32_t x, uint32_t y);
-void tty_toggle_cursor_visibility();
 
 void set_currentFg(uint32_t value);
 void set_currentBg(uint32_t value);
 
 void tty_clear();
+// Blank the screen of tty and home the cursor, caller holds tty_lock
+void tty_erase(tty_t* tty);
 
 void tty_switch(int id);
+// Paint the damaged cells of tty if it is on screen. Cells are copied out
+// a piece at a time under tty_lock and painted with it dropped, so the
+// caller must not hold it. Only tty_render_frame calls this, writers call
+// tty_render_kick.
+void tty_flush(tty_t* tty);
+// Mark every cell of tty for repainting, caller holds tty_lock
+void tty_damage_all(tty_t* tty);
+// Move the screen up one row into the history (damage included), blank
+// fills the last
+void tty_scroll_cells(tty_t* tty, terminal_cell_t blank);
+// Scroll the view lines further back into the history (negative: towards
+// the live screen)
+void tty_scrollback(tty_t* tty, int lines);
+// Show the screen scrolled back view lines, caller holds tty_lock
+void tty_set_view(tty_t* tty, uint16_t view);
+
+// Rendering (tty_render.c): a kernel task paints the current tty at up to
+// TTY_RENDER_HZ frames a second and blinks the cursor
+#define TTY_RENDER_HZ 60
+void init_tty_render();
+// Paint one frame now if anything changed
+void tty_render_frame();
+// Let the renderer know cells changed; paints right away until the render
+// task runs
+void tty_render_kick();
 tty_t* get_current_tty();
 
-// Input handling
+// Input handling. Keystrokes are queued by the keyboard IRQ and run
+// through the line discipline by the input task (tty_input.c).
+void init_tty_input();
+// Wake the input task, 0 if there is none (the caller handles input itself)
+int tty_input_wake();
 void tty_input_char(tty_t* tty, char c);
 void tty_set_ldisc(tty_t* tty, int mode);
 
@@ -9,5 +9,6 @@ extern volatile struct limine_kernel_file_request kernel_file_request;
 extern volatile struct limine_module_request module_request;
 extern volatile struct limine_kernel_address_request kernel_addr_request;
 extern volatile struct limine_hhdm_request hhdm_request;
+extern volatile struct limine_smp_request smp_request;
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <mm/vma.h>
 
 // ELF Magic
 #define ELF_MAGIC 0x464C457F  // "\x7FELF"
@@ -86,6 +87,9 @@ int elf_load(const void* data, size_t size, elf_info_t* info);
 // cr3_phys: physical address of the target PML4
 int elf_load_into(const void* data, size_t size, elf_info_t* info, uint64_t cr3_phys);
 
+// Record the loadable segments of an image as areas of a task's address space
+int elf_map_vmas(const void* data, vma_tree_t* vmas);
+
 // Free ELF loaded pages
 void elf_free(elf_info_t* info);
 
@@ -0,0 +1,27 @@
+#ifndef __KMSG_H__
+#define __KMSG_H__
+
+#include <stdarg.h>
+
+// Kernel log ring. log() and dbgln() only format their message into a
+// fixed size record (tick count, module, level, text) and return; the
+// klogd task copies new records to the serial console, and /dev/kmsg
+// reads them back. Recording takes no lock, so it is safe from IRQ
+// handlers and from code holding any spinlock.
+#define KMSG_RECORDS    512     // Power of two, older records are overwritten
+#define KMSG_MODULE_MAX 16      // Including the terminator
+#define KMSG_TEXT_MAX   160     // Including the terminator, longer text is cut
+
+// Append a record. module NULL marks raw dbgln() text, printed without a
+// prefix.
+void kmsg_vadd(const char *module, int level, const char *fmt, va_list args);
+
+// Start klogd and register /dev/kmsg. Until then every record is printed
+// by the context that added it.
+void init_kmsg_device(void);
+
+// Fatal exception path: print what is still pending with polled output,
+// and print every later record synchronously
+void kmsg_panic(void);
+
+#endif
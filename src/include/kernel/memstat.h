@@ -0,0 +1,9 @@
+#ifndef __MEMSTAT_H__
+#define __MEMSTAT_H__
+
+// /dev/memstat: free physical memory (the pre-zeroed pool included), then
+// one line per user task with the page-table memory and resident set of
+// its address space, in KiB
+void init_memstat_device(void);
+
+#endif
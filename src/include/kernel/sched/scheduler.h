@@ -4,8 +4,11 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <arch/x86_64/regs.h>
+#include <libk/spinlock.h>
+#include <mm/vma.h>
 
 struct file;
+struct cpu;
 
 // Maximum open files per process TODO: maybe increase it in future
 #define MAX_FDS 16
@@ -18,7 +21,9 @@ typedef enum {
 } task_state_t;
 
 typedef struct task {
-    struct task *next;
+    struct task *next;     // Global task list (all tasks, any CPU)
+    struct task *rq_next;  // Ring of tasks owned by one CPU's run queue
+    struct task *rq_prev;
     task_state_t state;
     register_t regs;
     void *stack_base;      // Kernel stack base
@@ -39,22 +44,59 @@ typedef struct task {
     void *user_code;       // User code page (for cleanup) - or ELF pages array
     void *user_stack;      // User stack page (for cleanup)
     size_t user_code_pages; // Number of user code pages (for ELF)
-    uint64_t mmap_base;
+    vma_tree_t vmas;          // Areas of the user address space
+    uint64_t ioring;          // User address of the batched syscall ring, 0 if none
+    uint32_t ioring_entries;
     struct file *fd_table[MAX_FDS];
     
     void *cwd;  
+
+    // SMP bookkeeping
+    struct cpu *cpu;           // CPU whose run queue holds this task
+    volatile int on_cpu;       // Context is live on a CPU, must not be freed
+    uint8_t is_idle;           // Per-CPU idle context, never migrated or reaped
+    uint64_t last_ran;         // Tick it was last switched out
+    uint32_t nr_migrations;
+    register_t *syscall_regs;  // Frame of the syscall being serviced
 } task_t;
 
+// Per-CPU run queue (deque), tasks are linked through rq_next/rq_prev
+typedef struct run_queue {
+    task_t *head;
+    uint32_t nr_tasks;         // Excluding the idle context
+    spinlock_t lock;
+} run_queue_t;
+
 #define USER_STACK_TOP_VADDR 0x7FFFF0000000ULL
 #define USER_STACK_VADDR     (USER_STACK_TOP_VADDR - 8192)
 
 void init_scheduler();
 task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack_pages,
                               int argc, char *argv[], int envc, char *envp[]);
+// Ring 0 task running entry on its own stack, entry must never return
+task_t *create_kernel_task(void (*entry)(void), size_t stack_pages);
 task_t *fork_current_task(register_t *parent_regs);
 task_t *find_task_by_id(int id);
+// Call fn on every task with the task list locked, fn must not block
+void sched_for_each_task(void (*fn)(task_t *t, void *arg), void *arg);
 void schedule_tick(register_t *regs);
 task_t *get_current_task();
+// Both sleeps return with the caller's interrupt flag as it was on entry
 void scheduler_sleep(uint64_t ticks);
+// Sleep until task_wake(), with no timeout. ready() is checked once the
+// task is marked blocked, so an event its waker posted just before is not
+// missed.
+void scheduler_block(int (*ready)(void));
+void task_enqueue(task_t *t);
+void task_remove(task_t *t);
+void task_wake(task_t *t);
+
+// Big kernel lock, serialises syscalls across CPUs. Blocking waits inside a
+// syscall must go through sched_wait() so the lock is dropped while halted.
+void kernel_lock(void);
+void kernel_unlock(void);
+// 1 if the calling task holds the big kernel lock
+int kernel_lock_held(void);
+void sched_wait(void);
 
 #endif
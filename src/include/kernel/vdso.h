@@ -0,0 +1,26 @@
+#ifndef __VDSO_H__
+#define __VDSO_H__
+
+#include <stdint.h>
+
+// Read-only page mapped into every user address space at a fixed address.
+// Userland reads the clock from it without entering the kernel; the layout
+// is ABI and mirrored in userland/source/stubs.c.
+#define VDSO_DATA_VADDR 0x00007FFFFFFFE000ULL
+
+typedef struct {
+    volatile uint32_t seq;        // Odd while the kernel is updating the fields below
+    uint32_t tick_hz;             // Timer tick frequency
+    uint64_t tsc_hz;              // 0 when there is no usable TSC
+    uint64_t boot_epoch;          // Unix time (seconds) at tick 0
+    volatile uint64_t ticks;      // Ticks since boot
+    volatile uint64_t tick_tsc;   // TSC value when `ticks` was last bumped
+} vdso_data_t;
+
+void init_vdso(void);
+// Map the data page into a user page table
+int vdso_map_into(uint64_t cr3_phys);
+// Timer hook, publishes the new tick count under the seqlock
+void vdso_tick(uint64_t ticks);
+
+#endif
@@ -42,6 +42,8 @@ struct inode{
 
     uint8_t type;         // File type: FT_REG, FT_DIR, FT_CHR, etc.
     uint8_t is_directory; // Legacy (kept for compatibility, use type == FT_DIR instead)
+
+    uint32_t map_count;   // VMAs backed by this inode, it is not freed while nonzero
 };
 
 typedef struct dentry {
@@ -66,6 +68,7 @@ struct file {
     uint32_t flags;
     file_operations_t *f_ops;
     uint64_t offset;
+    uint64_t private;   // Per open file driver state, zero after vfs_open
 };
 
 struct file_operations {
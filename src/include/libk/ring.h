@@ -0,0 +1,73 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single producer / single consumer byte ring. One context (an
+// IRQ handler, say) only ever pushes and one other only ever pops; neither
+// needs a lock or has to disable interrupts. head and tail run freely and
+// are masked on use, so all size bytes are usable. size is a power of two.
+//
+// The producer publishes a byte with a release store of head after writing
+// it, the consumer acquires head before reading the byte (and the same the
+// other way round for tail), so a byte is never seen before it is written
+// or overwritten before it is read.
+typedef struct {
+  uint8_t *buf;
+  uint32_t mask;
+  _Atomic uint32_t head;     // Next slot to fill, written by the producer
+  _Atomic uint32_t tail;     // Next slot to drain, written by the consumer
+  _Atomic uint32_t dropped;  // Pushes refused because the ring was full
+} spsc_ring_t;
+
+static inline void spsc_init(spsc_ring_t *r, void *storage, uint32_t size) {
+  r->buf = (uint8_t *)storage;
+  r->mask = size - 1;
+  atomic_store_explicit(&r->head, 0, memory_order_relaxed);
+  atomic_store_explicit(&r->tail, 0, memory_order_relaxed);
+  atomic_store_explicit(&r->dropped, 0, memory_order_relaxed);
+}
+
+// Producer side. false (and the byte counted as dropped) when full.
+static inline bool spsc_push(spsc_ring_t *r, uint8_t v) {
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (head - tail > r->mask) {
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    return false;
+  }
+  r->buf[head & r->mask] = v;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return true;
+}
+
+// Consumer side. false when empty.
+static inline bool spsc_pop(spsc_ring_t *r, uint8_t *v) {
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  if (head == tail)
+    return false;
+  *v = r->buf[tail & r->mask];
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+// Bytes waiting, exact for the consumer, a lower bound for anyone else
+static inline uint32_t spsc_count(spsc_ring_t *r) {
+  return atomic_load_explicit(&r->head, memory_order_acquire) -
+         atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+// Free slots, exact for the producer
+static inline uint32_t spsc_space(spsc_ring_t *r) {
+  return r->mask + 1 - spsc_count(r);
+}
+
+static inline bool spsc_empty(spsc_ring_t *r) {
+  return spsc_count(r) == 0;
+}
+
+#endif // RING_H
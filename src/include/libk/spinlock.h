@@ -2,13 +2,19 @@
 #define SPINLOCK_H
 
 #include <stdatomic.h>
+#include <stdint.h>
 
+// Spinlocks disable interrupts on the local CPU while held, so a lock taken
+// from process context can never deadlock against an IRQ handler on the
+// same CPU. The caller's RFLAGS are restored on release.
 typedef struct {
   atomic_int lock;
+  uint64_t flags;
 } spinlock_t;
 
 void spinlock_init(spinlock_t *lock);
 void spinlock_acquire(spinlock_t *lock);
+int spinlock_try_acquire(spinlock_t *lock);
 void spinlock_release(spinlock_t *lock);
 
 #endif // SPINLOCK_H
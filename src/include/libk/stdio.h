@@ -9,6 +9,8 @@ void putchar(char c);
 void puts(const char* str);
 int __vsprintf__(char *fmt, va_list args, void (*putchar_func)(char c), void (*puts_func)(const char *str));
 int sprintf(char *out_buffer, const char *fmt, ...);
+int snprintf(char *out_buffer, size_t size, const char *fmt, ...);
+int vsnprintf(char *out_buffer, size_t size, const char *fmt, va_list args);
 int printf(char *fmt, ...);
 void wait(uint16_t ms);
 void gets(char* to);
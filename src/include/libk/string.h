@@ -11,6 +11,11 @@ void *memset(void *bufptr, int value, size_t size);
 uint16_t *memsetw(uint16_t *dest, uint16_t val, size_t count);
 void *memcpy(void *dest, const void *src, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
+int memcmp(const void *s1, const void *s2, size_t n);
+// Copy one 4 KiB page, both addresses page aligned
+void copy_page(void *dst, const void *src);
+// Pick the block-copy variants for this CPU, after the command line is parsed
+void init_string_ops(void);
 
 int strlen(const char *str);
 char *strcpy(char *dst, const char *src);
@@ -1,14 +1,31 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+// Log levels, most severe first
 #define ERROR 0
 #define INFO 1
+#define VERBOSE 2   // Hot paths, off unless booted with 'verbose'
+
+// log() calls above LOG_LEVEL are compiled out, those above log_level are
+// skipped at run time without evaluating their arguments
+#ifndef LOG_LEVEL
+#define LOG_LEVEL VERBOSE
+#endif
 
 #include <init/stivale2.h>
 #include <stdarg.h>
 
+extern int log_level;
+
+#define log(module, status, ...)                                        \
+  do {                                                                  \
+    if ((status) <= LOG_LEVEL && (status) <= log_level)                 \
+      klog(module, status, __VA_ARGS__);                                \
+  } while (0)
+
 void sysfetch();
-void log(const char* module, int status, char *fmt, ...);
+// Record a message in the kernel log ring (kernel/kmsg.h), use log()
+void klog(const char* module, int status, char *fmt, ...);
 void dbgln(char *fmt, ...);
 void init_arg_parser();
 int arg_exist(char *arg);
@@ -0,0 +1,40 @@
+#ifndef __PAGECACHE_H__
+#define __PAGECACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct inode;
+
+// Page cache of regular files: one 4 KiB frame per (file, page index),
+// shared by every mapping of that page and by read()/write() once the
+// file has pages cached. Pages stay resident until the file is evicted.
+// Callers hold the big kernel lock.
+//
+// Files are keyed by their inode. The dentry cache hands the same inode
+// to every lookup of a path, and vfs_unlink evicts a file before freeing
+// its inode, so neither a reused inode address nor a FAT cluster handed
+// to a new file can find the old file's pages.
+
+// Kernel address of page `index` of the file, read in on first use (bytes
+// past EOF read as zero). NULL on I/O error or when out of memory.
+void *page_cache_get(struct inode *inode, uint64_t index);
+
+// Write page `index` back to the file, up to EOF only. 0 or -1.
+int page_cache_writeback(struct inode *inode, uint64_t index);
+
+// 1 if any page of the file is cached
+int page_cache_holds(struct inode *inode);
+
+// read() served from the cache, filling missing pages, so it sees stores
+// made through shared mappings. Returns bytes copied or -1.
+long page_cache_read(struct inode *inode, void *buf, size_t len, uint64_t offset);
+
+// Bring cached pages in line with a write() that just reached the file
+void page_cache_update(struct inode *inode, uint64_t offset, const void *buf, size_t len);
+
+// Drop every cached page of the file without writing it back. The file
+// must not be mapped any more; called when it is deleted or truncated.
+void page_cache_evict(struct inode *inode);
+
+#endif
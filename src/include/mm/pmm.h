@@ -8,10 +8,18 @@
 #define PAGE_SIZE 4096
 
 void *pmalloc(size_t pages);
+void *pmalloc_aligned(size_t pages, size_t align_pages);
+// Zeroed pages. Single pages come from the pre-zeroed pool when it has any.
 void *pcalloc(size_t pages);
+// Zero up to max_pages free frames into the pool, for idle loops. Returns
+// how many were added, 0 once the pool is full or memory is getting low.
+size_t pmm_zero_pool_refill(size_t max_pages);
+// Frames sitting zeroed in the pool, counted as free memory
+size_t pmm_zero_pool_pages(void);
 void pmm_free_pages(void *adr, size_t page_count);
 int init_pmm();
 uint32_t get_total_physical_memory();
+// Bytes free, the zeroed pool included
 uint32_t get_free_physical_memory();
 
 /* Helpers to convert addresses using the HHDM (higher-half direct-map)
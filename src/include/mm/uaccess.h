@@ -0,0 +1,42 @@
+#ifndef __UACCESS_H__
+#define __UACCESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define USER_SPACE_END 0x0000800000000000ULL
+
+#define EFAULT       14
+#define ENAMETOOLONG 36
+
+// Range lies entirely in the user half (does not say it is mapped)
+static inline int access_ok(const void *ptr, size_t n) {
+    uint64_t start = (uint64_t)ptr;
+    return start + n >= start && start + n <= USER_SPACE_END;
+}
+
+// Copy between kernel and user memory. A fault on the user side is caught
+// through the exception table and reported instead of taking the kernel
+// down. Both return 0 or -EFAULT.
+int copy_from_user(void *dst, const void *usrc, size_t n);
+int copy_to_user(void *udst, const void *src, size_t n);
+
+// Copy a NUL terminated string of at most n bytes including the NUL.
+// Returns its length, -EFAULT or -ENAMETOOLONG.
+long strncpy_from_user(char *dst, const char *usrc, size_t n);
+
+// Copy a user path into a kmalloc'ed PATH_MAX buffer, NULL on a bad
+// pointer or overlong path. Release with kfree.
+char *getname(uint64_t upath);
+
+// Check [ptr, ptr + n) is user memory mapped in the current address space,
+// writable too if `write`, faulting in pages not touched yet. For buffers
+// handed to code that cannot recover from a fault, such as the VFS
+// drivers; tasks are single threaded, so the mapping cannot change under
+// the syscall.
+int user_buffer_ok(const void *ptr, size_t n, int write);
+
+// Fixup address for a faulting kernel rip, 0 if there is none
+uint64_t search_exception_table(uint64_t rip);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __VMA_H__
+#define __VMA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Access rights of an area, same values as the mmap PROT_* bits
+#define VMA_READ  0x1
+#define VMA_WRITE 0x2
+#define VMA_EXEC  0x4
+
+// vma_t.flags
+#define VMA_SHARED 0x1  // Writes are visible to every mapper (MAP_SHARED)
+#define VMA_HEAP   0x2  // The brk area
+#define VMA_STACK  0x4
+
+struct inode;
+
+// One virtual memory area: a page aligned range of a task's address space
+// with uniform protection and backing
+typedef struct vma {
+    uint64_t start;          // First byte
+    uint64_t end;            // One past the last byte
+    uint32_t prot;           // VMA_READ | VMA_WRITE | VMA_EXEC
+    uint32_t flags;          // VMA_SHARED, VMA_HEAP, VMA_STACK
+    struct inode *file;      // Backing file, NULL for anonymous memory
+    uint64_t offset;         // File offset mapped at start
+
+    // Red-black tree ordered by address. Every node also caches the lowest
+    // start, the highest end and the widest hole between two areas of its
+    // subtree, gap searches prune on those.
+    struct vma *parent;
+    struct vma *left;
+    struct vma *right;
+    int red;
+    uint64_t sub_start;
+    uint64_t sub_end;
+    uint64_t sub_gap;
+} vma_t;
+
+typedef struct {
+    vma_t *root;
+    size_t count;
+} vma_tree_t;
+
+// Area containing addr, NULL if it falls in a hole
+vma_t *vma_lookup(vma_tree_t *tree, uint64_t addr);
+// Lowest area ending above addr (it may start above addr as well)
+vma_t *vma_find(vma_tree_t *tree, uint64_t addr);
+// Next area up in the address space
+vma_t *vma_next(vma_t *vma);
+
+// 1 if no area overlaps [start, end)
+int vma_range_free(vma_tree_t *tree, uint64_t start, uint64_t end);
+// 1 if areas cover all of [start, end) without holes
+int vma_range_mapped(vma_tree_t *tree, uint64_t start, uint64_t end);
+
+// Lowest align-aligned address in [lo, hi) with size free bytes behind
+// it, 0 if there is none. align is a power of two.
+uint64_t vma_find_gap(vma_tree_t *tree, uint64_t size, uint64_t align,
+                      uint64_t lo, uint64_t hi);
+
+// Record [start, end), replacing whatever overlapped it. Merges with
+// neighbours that have the same protection, flags and backing.
+// All of these return 0, or -1 when an area could not be allocated.
+int vma_map(vma_tree_t *tree, uint64_t start, uint64_t end, uint32_t prot,
+            uint32_t flags, struct inode *file, uint64_t offset);
+// Forget [start, end), splitting areas that straddle its ends
+int vma_unmap(vma_tree_t *tree, uint64_t start, uint64_t end);
+// Change the protection of [start, end). Also -1, with nothing changed,
+// if part of the range is not mapped.
+int vma_protect(vma_tree_t *tree, uint64_t start, uint64_t end, uint32_t prot);
+
+// Copy every area of src into the empty tree dst (fork)
+int vma_clone(vma_tree_t *dst, vma_tree_t *src);
+void vma_destroy(vma_tree_t *tree);
+
+// Page fault error code bits vma_fault looks at
+#define PF_WRITE 0x2
+#define PF_FETCH 0x10
+
+// Demand paging for the current task (mm/fault.c). Maps the page cache
+// page behind a file area, or a private copy of it on a write to a
+// MAP_PRIVATE area. Returns 0 once addr is mapped, -1 if the access is
+// not allowed or lies past EOF.
+int vma_fault(uint64_t addr, uint64_t err);
+
+// Write the dirty pages of MAP_SHARED file areas in [start, end) back to
+// their files (msync, munmap and exit)
+void vma_writeback(vma_tree_t *tree, uint64_t cr3, uint64_t start, uint64_t end);
+
+#endif
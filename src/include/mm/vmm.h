@@ -12,14 +12,36 @@
 #define PTE_ACCESSED (1ULL << 5)
 #define PTE_DIRTY (1ULL << 6)
 #define PTE_PSE (1ULL << 7)
+#define PTE_PAT (1ULL << 7)        // PAT bit of a 4 KiB PTE
+#define PTE_GLOBAL (1ULL << 8)
+#define PTE_PAT_LARGE (1ULL << 12) // PAT bit of a 2 MiB / 1 GiB entry
+// Software bit: frame is shared between address spaces and not owned by
+// any of them (clone maps it as is, teardown does not free it)
+#define PTE_SHARED (1ULL << 9)
 #define PTE_NX (1ULL << 63)
+// Write-combining, PAT entry 5 (see vmm_init_cpu)
+#define PTE_WC (PTE_PAT | PTE_PWT)
+
+#define HUGE_PAGE_SIZE  0x200000ULL
+#define HUGE_PAGE_PAGES 512
 int init_vmm();
+// Load the PAT, enable global pages and PCIDs on the calling CPU (BSP in init_vmm, APs
+// from ap_entry before their first page table switch)
+void vmm_init_cpu(void);
 
 // Map a single 4KiB page: virtual -> physical with given pte flags (or 0 for default rw).
 int vmm_map_page(void *virt, void *phys, uint64_t flags);
 
-// Map a contiguous range of pages
+// Map a contiguous range of pages, using 2 MiB pages wherever virt and
+// phys are both 2 MiB aligned over a full huge page
 int vmm_map_range(void *virt, void *phys, size_t pages, uint64_t flags);
+int vmm_map_range_in(uint64_t cr3_phys, void *virt, void *phys, size_t pages, uint64_t flags);
+
+// Map one 2 MiB page. Fails if a page table with live entries is in the way.
+int vmm_map_huge_in(uint64_t cr3_phys, void *virt, void *phys, uint64_t flags);
+// Remove a 2 MiB mapping, returns its physical base or NULL if virt is not
+// covered by one
+void *vmm_unmap_huge_in(uint64_t cr3_phys, void *virt);
 
 // Per-process page table support
 // Create a new page table that shares kernel mappings (higher half)
@@ -29,17 +51,58 @@ uint64_t vmm_create_user_page_table(void);
 // Map a page in a specific page table (given by cr3 physical address)
 int vmm_map_page_in(uint64_t cr3_phys, void *virt, void *phys, uint64_t flags);
 
-// Switch to a different page table
+// Switch to a different page table. User page tables carry their PCID in
+// the low 12 bits of the cr3 value, so the switch keeps the TLB entries of
+// the incoming address space unless they were marked stale.
 void vmm_switch_page_table(uint64_t cr3_phys);
 
+// Translations of cr3 may be cached by CPUs not running it right now; make
+// each of them flush the PCID on its next switch in. Called before any
+// shootdown, since shootdowns only reach CPUs that have cr3 loaded.
+void vmm_pcid_mark_stale(uint64_t cr3_phys);
+
+// Invalidate a range of pages in the calling CPU's TLB
+void vmm_flush_tlb_local(uint64_t addr, size_t pages);
+
 // Get current CR3
 uint64_t vmm_get_cr3(void);
+uint64_t vmm_get_kernel_cr3(void);
+
+// Map device memory into the kernel MMIO window, extra flags are or'ed in
+// (PTE_PCD | PTE_PWT for uncached registers). Returns the virtual address.
+void *vmm_map_mmio(uint64_t phys, size_t size, uint64_t flags);
 
 // Free a user page table (frees only user-space entries, not kernel)
 void vmm_free_user_page_table(uint64_t cr3_phys);
 
+// Memory a user address space holds, kept up to date by every map/unmap
+typedef struct {
+    uint64_t pt_pages;   // PDPT, PD and PT pages (the PML4 is not counted)
+    uint64_t rss_pages;  // 4 KiB pages mapped in the user half
+} vmm_stats_t;
+
+// Copy out the counters of a user page table, -1 for the kernel one
+int vmm_get_stats(uint64_t cr3_phys, vmm_stats_t *out);
+
+// Leaf entry for vaddr. Pages inside a large mapping are reported as the
+// equivalent 4 KiB PTE, so callers never see PTE_PSE.
 uint64_t vmm_get_pte(uint64_t cr3_phys, uint64_t vaddr);
+// Clear bits (PTE_DIRTY, PTE_ACCESSED) in the 4 KiB PTE mapping vaddr and
+// flush it from every TLB. Returns the entry as it was, 0 if vaddr is not
+// mapped by a 4 KiB page.
+uint64_t vmm_clear_pte_bits(uint64_t cr3_phys, uint64_t vaddr, uint64_t bits);
 uint64_t vmm_clone_user_page_table(uint64_t parent_cr3_phys);
 void *vmm_unmap_page_in(uint64_t cr3_phys, void *virt);
 
+// Protection bits vmm_protect_range rewrites, the rest of a PTE is kept
+#define VMM_PROT_MASK (PTE_RW | PTE_USER | PTE_NX)
+
+// Unmap [vaddr, vaddr + pages * 4096) in one walk, freeing the frames
+// (unless shared) if free_frames and any user page tables left empty. TLB
+// invalidation is batched into one flush and one shootdown.
+void vmm_unmap_range(uint64_t cr3_phys, uint64_t vaddr, size_t pages, int free_frames);
+// Replace the VMM_PROT_MASK bits of every present page in the range.
+// PTE_SHARED frames are left read-only unless flags has PTE_SHARED too.
+void vmm_protect_range(uint64_t cr3_phys, uint64_t vaddr, size_t pages, uint64_t flags);
+
 #endif
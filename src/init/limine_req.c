@@ -33,3 +33,7 @@ __attribute__((
     used,
     section(".limine_reqs"))) volatile struct limine_kernel_address_request
     kernel_addr_request = {.id = LIMINE_KERNEL_ADDRESS_REQUEST, .revision = 0};
+
+__attribute__((used,
+               section(".limine_reqs"))) volatile struct limine_smp_request
+    smp_request = {.id = LIMINE_SMP_REQUEST, .revision = 0, .flags = 0};
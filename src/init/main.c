@@ -26,6 +26,7 @@ SOFTWARE. */
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/irq.h>
 #include <arch/x86_64/isr.h>
+#include <arch/x86_64/smp.h>
 #include <arch/x86_64/syscall.h>
 #include <drivers/keyboard.h>
 #include <drivers/pit.h>
@@ -38,6 +39,9 @@ SOFTWARE. */
 #include <init/stivale2.h>
 #include <kernel/elf.h>
 #include <kernel/sched/scheduler.h>
+#include <kernel/vdso.h>
+#include <kernel/memstat.h>
+#include <kernel/kmsg.h>
 #include <libk/stdio.h>
 #include <libk/string.h>
 #include <libk/utils.h>
@@ -86,6 +90,7 @@ void init_kernel() {
   enable_sse();
   initial_psf_setup();
   init_arg_parser();
+  init_string_ops();
   if (!arg_exist("noserial")) {
     serial_init(COM1_PORT);
   }
@@ -101,13 +106,19 @@ void init_kernel() {
   init_pmm();
   liballoc_init();
   init_vmm();
+  init_smp();
+  init_vdso();
   // init_initrd_stripFS();
   mount_filesystem();
   // init_procfs();
   devfs_init();
   init_syscalls();
   init_tty();
+  init_tty_render();
+  init_tty_input();
   init_serial_device();
+  init_memstat_device();
+  init_kmsg_device();
   if (arg_exist("gruvbox")) {
     init_colors(
     0x000000,  // black
@@ -207,7 +218,9 @@ void kmain() {
       log("ELF",ERROR,"No ELF program in initrd (or load failed)\n\r");
   }
 
+  // Idle: prepare zeroed frames, sleep once the pool is full
   for (;;) {
-    asm("sti; hlt");
+    if (!pmm_zero_pool_refill(16))
+      asm("sti; hlt");
   }
 }
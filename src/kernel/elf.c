@@ -105,12 +105,11 @@ static int elf_load_impl(const void* data, size_t size, elf_info_t* info, uint64
           (int)total_pages, lowest_addr, highest_addr, cr3_phys);
     
     // Allocate page tracking array (stores both user and kernel vaddrs)
-    elf_page_t* page_map = (elf_page_t*)pmalloc(1);
+    elf_page_t* page_map = (elf_page_t*)pcalloc(1);
     if (!page_map) {
         log("ELF", ERROR, "Failed to allocate page tracking\n\r");
         return -1;
     }
-    memset(page_map, 0, 4096);
     size_t num_mapped = 0;
     
     info->pages = (void**)page_map;  // Reuse pages pointer for tracking
@@ -159,17 +158,14 @@ static int elf_load_impl(const void* data, size_t size, elf_info_t* info, uint64
             }
             
             if (!already_mapped) {
-                // Allocate physical page (returns kernel vaddr)
-                void* page = pmalloc(1);
+                // Allocate a zeroed physical page (returns kernel vaddr)
+                void* page = pcalloc(1);
                 if (!page) {
                     log("ELF", ERROR, "Failed to allocate page\n\r");
                     elf_free(info);
                     return -1;
                 }
                 
-                // Zero the page using kernel vaddr
-                memset(page, 0, 4096);
-                
                 // Determine page flags - always RW for simplicity
                 // uint64_t flags = PTE_PRESENT | PTE_USER | PTE_RW;
                 
@@ -269,6 +265,26 @@ int elf_load_into(const void* data, size_t size, elf_info_t* info, uint64_t cr3_
     return elf_load_impl(data, size, info, cr3_phys);
 }
 
+// Record the PT_LOAD segments of an image loaded by elf_load_into
+int elf_map_vmas(const void* data, vma_tree_t* vmas) {
+    const elf64_ehdr_t* ehdr = (const elf64_ehdr_t*)data;
+    const uint8_t* file_data = (const uint8_t*)data;
+
+    for (uint16_t i = 0; i < ehdr->e_phnum; i++) {
+        const elf64_phdr_t* phdr = (const elf64_phdr_t*)(file_data + ehdr->e_phoff + i * ehdr->e_phentsize);
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) continue;
+
+        uint32_t prot = 0;
+        if (phdr->p_flags & 0x4) prot |= VMA_READ;
+        if (phdr->p_flags & 0x2) prot |= VMA_WRITE;
+        if (phdr->p_flags & 0x1) prot |= VMA_EXEC;
+        if (vma_map(vmas, page_align_down(phdr->p_vaddr),
+                    page_align_up(phdr->p_vaddr + phdr->p_memsz), prot, 0, NULL, 0) != 0)
+            return -1;
+    }
+    return 0;
+}
+
 void elf_free(elf_info_t* info) {
     if (!info) return;
     
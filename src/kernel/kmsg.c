@@ -0,0 +1,215 @@
+#include <kernel/kmsg.h>
+#include <kernel/sched/scheduler.h>
+#include <drivers/serial.h>
+#include <drivers/pit.h>
+#include <fs/devfs.h>
+#include <libk/stdio.h>
+#include <libk/string.h>
+#include <libk/utils.h>
+#include <mm/uaccess.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define EINVAL 22
+
+typedef struct {
+    // 2n + 1 while record n is being written, 2n + 2 once it is complete.
+    // Readers check it before and after copying, like a seqlock, so a
+    // record overwritten under them is noticed rather than returned torn.
+    _Atomic uint64_t seq;
+    uint64_t ticks;
+    uint8_t level;
+    uint8_t len;
+    char module[KMSG_MODULE_MAX];   // Empty for dbgln() text
+    char text[KMSG_TEXT_MAX];
+} kmsg_record_t;
+
+static kmsg_record_t ring[KMSG_RECORDS];
+static _Atomic uint64_t next_seq;   // Writers claim records with fetch_add
+
+static task_t *klogd;
+static _Atomic int console_busy;    // Someone is printing records
+static uint64_t console_seq;        // Next record for the console
+static bool sync_console = true;    // No klogd (yet), or after a panic
+
+static void kmsg_console_drain(void);
+
+static inline uint64_t seq_done(uint64_t n) {
+    return 2 * n + 2;
+}
+
+void kmsg_vadd(const char *module, int level, const char *fmt, va_list args) {
+    uint64_t n = atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed);
+    kmsg_record_t *r = &ring[n % KMSG_RECORDS];
+
+    atomic_store_explicit(&r->seq, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    r->ticks = get_ticks();
+    r->level = (uint8_t)level;
+    if (module) {
+        strncpy(r->module, module, KMSG_MODULE_MAX - 1);
+        r->module[KMSG_MODULE_MAX - 1] = '\0';
+    } else {
+        r->module[0] = '\0';
+    }
+    int len = vsnprintf(r->text, KMSG_TEXT_MAX, fmt, args);
+    r->len = len < KMSG_TEXT_MAX ? (uint8_t)len : KMSG_TEXT_MAX - 1;
+
+    atomic_store_explicit(&r->seq, seq_done(n), memory_order_release);
+
+    if (sync_console)
+        kmsg_console_drain();
+    else
+        task_wake(klogd);
+}
+
+// Copy record *seq into out and advance *seq. Skips whatever was
+// overwritten before it could be read. false once the reader has caught
+// up, or when the next record is still being written.
+static bool kmsg_read_record(uint64_t *seq, kmsg_record_t *out) {
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&next_seq, memory_order_acquire);
+        if (*seq >= head) return false;
+        if (head - *seq > KMSG_RECORDS) *seq = head - KMSG_RECORDS;
+
+        kmsg_record_t *r = &ring[*seq % KMSG_RECORDS];
+        uint64_t s = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (s < seq_done(*seq)) return false;
+        if (s > seq_done(*seq)) {
+            (*seq)++;
+            continue;
+        }
+
+        out->ticks = r->ticks;
+        out->level = r->level;
+        out->len = r->len;
+        memcpy(out->module, r->module, KMSG_MODULE_MAX);
+        memcpy(out->text, r->text, r->len);
+        out->text[out->len] = '\0';
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&r->seq, memory_order_relaxed) != s) {
+            (*seq)++;
+            continue;
+        }
+        (*seq)++;
+        return true;
+    }
+}
+
+static void kmsg_console_print(kmsg_record_t *r) {
+    if (r->module[0]) {
+        const char *status = r->level == ERROR ? "\033[31mERROR"
+                           : r->level == VERBOSE ? "\033[90mVERBOSE" : "\033[32m";
+        serial_printf("\033[1;34m[%s] %s: \033[0m", r->module, (char *)status);
+    }
+    serial_puts(r->text);
+}
+
+// Record seq is complete (or already overwritten) and can be read
+static bool kmsg_ready(uint64_t seq) {
+    if (seq >= atomic_load_explicit(&next_seq, memory_order_acquire)) return false;
+    kmsg_record_t *r = &ring[seq % KMSG_RECORDS];
+    return atomic_load_explicit(&r->seq, memory_order_acquire) >= seq_done(seq);
+}
+
+// Print every complete record the console has not shown yet. One caller
+// at a time; a caller that finds the console busy leaves its record to
+// the one printing, who checks for new records before giving up. A record
+// still being written is left to its writer, which drains (or wakes
+// klogd) once it is done, so nobody ever waits on another CPU here.
+static void kmsg_console_drain(void) {
+    if (!is_serial_initialized()) return;
+    kmsg_record_t r;
+    do {
+        if (atomic_exchange_explicit(&console_busy, 1, memory_order_acquire)) return;
+        while (kmsg_read_record(&console_seq, &r))
+            kmsg_console_print(&r);
+        atomic_store_explicit(&console_busy, 0, memory_order_release);
+    } while (kmsg_ready(console_seq));
+}
+
+void kmsg_panic(void) {
+    serial_panic();
+    sync_console = true;
+    // Whoever held the console may be the one that faulted
+    atomic_store_explicit(&console_busy, 0, memory_order_release);
+    kmsg_console_drain();
+}
+
+static void klogd_loop() {
+    for (;;) {
+        scheduler_sleep(hz);
+        kmsg_console_drain();
+    }
+}
+
+// Every open file keeps the sequence number of the next record it reads
+// in file->private. A read returns whole lines only; -EINVAL if the next
+// one does not fit in the buffer at all.
+static long kmsg_read(file_t *file, void *buf, size_t count, uint64_t off) {
+    (void)off;
+    uint64_t seq = file->private;
+    char *out = buf;
+    size_t done = 0;
+    char line[KMSG_TEXT_MAX + 64];
+    kmsg_record_t r;
+
+    for (;;) {
+        uint64_t save = seq;
+        if (!kmsg_read_record(&seq, &r)) break;
+
+        // Drop the line endings, every record becomes one line
+        while (r.len && (r.text[r.len - 1] == '\n' || r.text[r.len - 1] == '\r'))
+            r.text[--r.len] = '\0';
+        int n = snprintf(line, sizeof(line), "%d,%ul,%ul;%s%s%s\n", r.level, seq - 1,
+                         r.ticks * 1000 / (hz ? hz : 1), r.module,
+                         r.module[0] ? ": " : "", r.text);
+        if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+
+        if (done + n > count) {
+            seq = save;
+            if (!done) return -EINVAL;
+            break;
+        }
+        if (copy_to_user(out + done, line, n) != 0) {
+            seq = save;
+            if (!done) return -EFAULT;
+            break;
+        }
+        done += n;
+    }
+
+    file->private = seq;
+    return (long)done;
+}
+
+static long kmsg_write(file_t *file, const void *buf, size_t count, uint64_t off) {
+    (void)file;
+    (void)off;
+    char text[KMSG_TEXT_MAX];
+    size_t n = count < KMSG_TEXT_MAX - 1 ? count : KMSG_TEXT_MAX - 1;
+    if (copy_from_user(text, buf, n) != 0) return -EFAULT;
+    text[n] = '\0';
+    log("USER", INFO, "%s", text);
+    return (long)count;
+}
+
+static struct file_operations kmsg_file_ops = {
+    .open = NULL,
+    .close = NULL,
+    .read = kmsg_read,
+    .write = kmsg_write
+};
+
+void init_kmsg_device(void) {
+    devfs_register_device("kmsg", &kmsg_file_ops, FT_CHR);
+    klogd = create_kernel_task(klogd_loop, 4);
+    if (!klogd) {
+        log("KMSG", ERROR, "No klogd, printing records as they are added\n\r");
+        return;
+    }
+    sync_console = false;
+    log("KMSG", INFO, "Registered /dev/kmsg, klogd id=%d\n\r", klogd->id);
+}
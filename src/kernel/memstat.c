@@ -0,0 +1,60 @@
+#include <kernel/memstat.h>
+#include <kernel/sched/scheduler.h>
+#include <fs/devfs.h>
+#include <mm/vmm.h>
+#include <mm/pmm.h>
+#include <mm/liballoc.h>
+#include <libk/stdio.h>
+#include <libk/string.h>
+#include <libk/utils.h>
+
+#define MEMSTAT_BUF  8192
+#define MEMSTAT_LINE 64    // Longest line sprintf can produce below
+
+typedef struct {
+    char *buf;
+    size_t len;
+} memstat_ctx_t;
+
+static void memstat_task(task_t *t, void *arg) {
+    memstat_ctx_t *ctx = arg;
+    vmm_stats_t st;
+    if (!t->is_usermode || !t->cr3 || vmm_get_stats(t->cr3, &st) != 0) return;
+    if (ctx->len + MEMSTAT_LINE > MEMSTAT_BUF) return;
+    ctx->len += sprintf(ctx->buf + ctx->len, "%d %ul %ul\n", t->id,
+                        st.pt_pages * 4, st.rss_pages * 4);
+}
+
+// The whole table is rebuilt on every read, so a reader that consumes it
+// in several calls may see lines from different moments
+static long memstat_read(file_t *file, void *buf, size_t count, uint64_t off) {
+    (void)file;
+    memstat_ctx_t ctx = { .buf = kmalloc(MEMSTAT_BUF), .len = 0 };
+    if (!ctx.buf) return -1;
+
+    // Zeroed pool frames are free memory, not used by anyone
+    ctx.len = sprintf(ctx.buf, "free_kib %d zeroed_kib %ul\n",
+                      get_free_physical_memory() / 1024, pmm_zero_pool_pages() * 4);
+    ctx.len += sprintf(ctx.buf + ctx.len, "pid pt_kib rss_kib\n");
+    sched_for_each_task(memstat_task, &ctx);
+
+    long n = 0;
+    if (off < ctx.len) {
+        n = (long)(ctx.len - off < count ? ctx.len - off : count);
+        memcpy(buf, ctx.buf + off, n);
+    }
+    kfree(ctx.buf);
+    return n;
+}
+
+static struct file_operations memstat_file_ops = {
+    .open = NULL,
+    .close = NULL,
+    .read = memstat_read,
+    .write = NULL
+};
+
+void init_memstat_device(void) {
+    devfs_register_device("memstat", &memstat_file_ops, FT_CHR);
+    log("MEMSTAT", INFO, "Registered /dev/memstat\n\r");
+}
@@ -1,43 +1,122 @@
 #include <kernel/sched/scheduler.h>
 #include <kernel/sched/build_stack.h>
 #include <kernel/elf.h>
+#include <kernel/vdso.h>
 #include <kernel/vfs/vfs.h>
 #include <mm/pmm.h>
 #include <mm/vmm.h>
 #include <mm/liballoc.h>
+#include <arch/x86_64/cpu.h>
 #include <arch/x86_64/gdt.h>
+#include <arch/x86_64/smp.h>
 #include <libk/string.h>
 #include <libk/utils.h>
 #include <drivers/pit.h>
 #include <drivers/tty/tty.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 task_t *task_list = NULL;
-static task_t *current = NULL;
-static int next_task_id = 1;
+static spinlock_t task_list_lock;
+static atomic_int next_task_id = 1;
+
+static atomic_int big_lock = 0;
+static task_t *big_lock_owner = NULL;
 
 #define USER_CODE_VADDR  0x400000ULL
 
 void init_scheduler() {
     task_list = NULL;
-    current = NULL;
+    spinlock_init(&task_list_lock);
 }
 
 task_t *get_current_task() { 
-    return current; 
+    task_t *t;
+    // One gs-relative load, the task cannot be moved between reading the
+    // CPU pointer and reading its current task
+    asm volatile("mov %%gs:%c1, %0" : "=r"(t) : "i"(CPU_CURRENT_OFFSET));
+    return t;
 }
 
 task_t *find_task_by_id(int id) {
-    if (!task_list) return NULL;
-    task_t *t = task_list;
-    do {
-        if (t->id == id) return t;
-        t = t->next;
-    } while (t != task_list);
-    return NULL;
+    task_t *found = NULL;
+    spinlock_acquire(&task_list_lock);
+    if (task_list) {
+        task_t *t = task_list;
+        do {
+            if (t->id == id) {
+                found = t;
+                break;
+            }
+            t = t->next;
+        } while (t != task_list);
+    }
+    spinlock_release(&task_list_lock);
+    return found;
+}
+
+void sched_for_each_task(void (*fn)(task_t *t, void *arg), void *arg) {
+    spinlock_acquire(&task_list_lock);
+    if (task_list) {
+        task_t *t = task_list;
+        do {
+            fn(t, arg);
+            t = t->next;
+        } while (t != task_list);
+    }
+    spinlock_release(&task_list_lock);
+}
+
+// Run queues are deques: a doubly linked ring whose tail is head->rq_prev.
+// The owner appends at the tail and rotates through the ring, thieves take
+// from the tail end. Caller holds rq->lock.
+static void rq_push_tail(run_queue_t *rq, task_t *t) {
+    if (!rq->head) {
+        rq->head = t;
+        t->rq_next = t;
+        t->rq_prev = t;
+    } else {
+        task_t *tail = rq->head->rq_prev;
+        t->rq_prev = tail;
+        t->rq_next = rq->head;
+        tail->rq_next = t;
+        rq->head->rq_prev = t;
+    }
+    if (!t->is_idle) rq->nr_tasks++;
+}
+
+static void rq_remove(run_queue_t *rq, task_t *t) {
+    if (!rq->head || !t->rq_next) return;
+    if (t->rq_next == t) {
+        rq->head = NULL;
+    } else {
+        t->rq_prev->rq_next = t->rq_next;
+        t->rq_next->rq_prev = t->rq_prev;
+        if (rq->head == t) rq->head = t->rq_next;
+    }
+    t->rq_next = NULL;
+    t->rq_prev = NULL;
+    if (!t->is_idle) rq->nr_tasks--;
+}
+
+// New tasks go to the online CPU with the fewest tasks queued
+static cpu_t *sched_pick_cpu(void) {
+    cpu_t *best = &cpus[0];
+    for (uint32_t i = 1; i < cpu_count; i++) {
+        if (cpus[i].online && cpus[i].rq.nr_tasks < best->rq.nr_tasks)
+            best = &cpus[i];
+    }
+    return best;
+}
+
+// Nudge a CPU that is sitting in its idle loop
+static void sched_kick(cpu_t *cpu) {
+    task_t *cur = cpu->current;
+    if (!cur || cur->is_idle) smp_send_reschedule(cpu);
 }
 
 void task_enqueue(task_t *t) {
+    spinlock_acquire(&task_list_lock);
     if (!task_list) {
         task_list = t;
         t->next = t;
@@ -49,33 +128,158 @@ void task_enqueue(task_t *t) {
         tail->next = t;
         t->next = task_list;
     }
+    spinlock_release(&task_list_lock);
+
+    cpu_t *cpu = sched_pick_cpu();
+    spinlock_acquire(&cpu->rq.lock);
+    t->cpu = cpu;
+    rq_push_tail(&cpu->rq, t);
+    spinlock_release(&cpu->rq.lock);
+    sched_kick(cpu);
 }
 
+// Unlink a task from the global list and its run queue. The caller must
+// make sure it is not live on any CPU (see on_cpu).
+void task_remove(task_t *t) {
+    spinlock_acquire(&task_list_lock);
+    if (task_list) {
+        if (t == task_list && t->next == t) {
+            task_list = NULL;
+        } else {
+            task_t *prev = task_list;
+            while (prev->next != t && prev->next != task_list) prev = prev->next;
+            if (prev->next == t) {
+                prev->next = t->next;
+                if (task_list == t) task_list = t->next;
+            }
+        }
+    }
+    spinlock_release(&task_list_lock);
+
+    cpu_t *cpu = t->cpu;
+    if (cpu) {
+        spinlock_acquire(&cpu->rq.lock);
+        rq_remove(&cpu->rq, t);
+        spinlock_release(&cpu->rq.lock);
+    }
+}
+
+void task_wake(task_t *t) {
+    // Order the waker's event (a queued byte, say) before the state check,
+    // pairs with the fence in scheduler_block
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (t->state != TASK_BLOCKED) return;
+    t->state = TASK_RUNNABLE;
+    if (t->cpu) sched_kick(t->cpu);
+}
+
+// A task that ran within this many ticks probably still has its working
+// set in the old CPU's caches, leave it there
+#define SCHED_CACHE_HOT_TICKS 2
+
+static int task_can_migrate(task_t *t, uint64_t now) {
+    if (t->is_idle || t->on_cpu || t->state != TASK_RUNNABLE) return 0;
+    return now - t->last_ran >= SCHED_CACHE_HOT_TICKS;
+}
+
+// Called by an idle CPU with its own rq lock held: pull one runnable task
+// from the busiest other queue. Victim locks are only tried, two CPUs
+// stealing from each other must not deadlock.
+static task_t *sched_steal(cpu_t *self) {
+    cpu_t *victim = NULL;
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t *c = &cpus[i];
+        if (c == self || !c->online || c->rq.nr_tasks < 2) continue;
+        if (!victim || c->rq.nr_tasks > victim->rq.nr_tasks) victim = c;
+    }
+    if (!victim || !spinlock_try_acquire(&victim->rq.lock)) return NULL;
+
+    uint64_t now = get_ticks();
+    task_t *found = NULL;
+    if (victim->rq.head) {
+        task_t *t = victim->rq.head->rq_prev;
+        do {
+            if (task_can_migrate(t, now)) {
+                found = t;
+                break;
+            }
+            t = t->rq_prev;
+        } while (t != victim->rq.head->rq_prev);
+    }
+
+    if (found) {
+        rq_remove(&victim->rq, found);
+        found->cpu = self;
+        found->nr_migrations++;
+        victim->nr_stolen++;
+        self->nr_steals++;
+        rq_push_tail(&self->rq, found);
+    }
+    spinlock_release(&victim->rq.lock);
+
+    if (found)
+        log("SCHED",VERBOSE,"cpu %d stole task id=%d from cpu %d\n\r", self->id, found->id, victim->id);
+    return found;
+}
+
+void kernel_lock(void) {
+    while (atomic_exchange(&big_lock, 1) == 1) {
+        // Spin with interrupts open: the holder may be waiting on us for a
+        // TLB shootdown, and the timer is free to run something else here
+        asm volatile("sti; pause; cli");
+    }
+    big_lock_owner = get_current_task();
+}
+
+void kernel_unlock(void) {
+    big_lock_owner = NULL;
+    atomic_store(&big_lock, 0);
+}
+
+int kernel_lock_held(void) {
+    task_t *t = get_current_task();
+    return t && big_lock_owner == t;
+}
+
+// Halt until the next interrupt, dropping the big kernel lock meanwhile
+void sched_wait(void) {
+    int held = kernel_lock_held();
+    if (held) kernel_unlock();
+    asm volatile("sti; hlt; cli");
+    if (held) kernel_lock();
+}
 
 void task_exit() {
+    task_t *current = get_current_task();
     current->state = TASK_ZOMBIE;
     log("SCHED",INFO,"task id=%d exited\n\r", current->id);
     
     if (current->is_usermode) {
         if (current->user_code) pmm_free_pages(current->user_code, current->user_code_pages);
         if (current->user_stack) pmm_free_pages(current->user_stack, 2); 
-        if (current->cr3) vmm_free_user_page_table(current->cr3);
+        if (current->cr3) {
+            vmm_switch_page_table(vmm_get_kernel_cr3());
+            vmm_free_user_page_table(current->cr3);
+        }
+        vma_destroy(&current->vmas);
     }
     
     for (;;) asm volatile("hlt");
 }
 
-static void sweep_wakeup(void) {
-    if (!task_list) return;
+static void sweep_wakeup(run_queue_t *rq) {
+    if (!rq->head) return;
     uint64_t ticks = get_ticks();
-    task_t *t = task_list;
+    task_t *t = rq->head;
     do {
         if (t->state == TASK_BLOCKED && t->wake_tick <= ticks) {
             t->state = TASK_RUNNABLE;
-            log("SCHED",INFO,"wake task id=%d\n\r", t->id);
+            // Kernel tasks (the TTY renderer) wake every frame, too often to log
+            if (t->is_usermode)
+                log("SCHED",VERBOSE,"wake task id=%d\n\r", t->id);
         }
-        t = t->next;
-    } while (t != task_list);
+        t = t->rq_next;
+    } while (t != rq->head);
 }
 
 void scheduler_sleep(uint64_t ticks) {
@@ -85,55 +289,103 @@ void scheduler_sleep(uint64_t ticks) {
         while (get_ticks() < et) asm volatile("hlt");
         return;
     }
+    // sched_wait returns with interrupts off, give the caller back its IF
+    uint64_t flags = irq_save_disable();
     c->wake_tick = get_ticks() + ticks;
     c->state = TASK_BLOCKED;
-    while (c->state == TASK_BLOCKED) asm volatile("hlt");
+    while (c->state == TASK_BLOCKED) sched_wait();
+    irq_restore(flags);
+}
+
+void scheduler_block(int (*ready)(void)) {
+    task_t *c = get_current_task();
+    uint64_t flags = irq_save_disable();
+    c->wake_tick = UINT64_MAX;
+    c->state = TASK_BLOCKED;
+    // A wakeup that came before the state change shows up in ready()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ready())
+        c->state = TASK_RUNNING;
+    while (c->state == TASK_BLOCKED) sched_wait();
+    irq_restore(flags);
 }
 
 
+// Called from the timer (PIT on the BSP, LAPIC timer on APs) and the
+// reschedule IPI, always on this CPU's IST stack.
 void schedule_tick(register_t *regs) {
-    if (!task_list) return;
-    sweep_wakeup();
+    cpu_t *cpu = this_cpu();
+    run_queue_t *rq = &cpu->rq;
+
+    spinlock_acquire(&rq->lock);
+    if (!rq->head) goto out;
+    sweep_wakeup(rq);
     
-    if (!current) {
-        task_t *main_task = (task_t *)pmalloc(1);
-        if (!main_task) return;
-        memset(main_task, 0, 4096);
-        main_task->state = TASK_RUNNING;
-        memcpy((uint8_t *)&main_task->regs, (const uint8_t *)regs, sizeof(register_t));
-        task_enqueue(main_task);
-        current = main_task;
-        return;
+    if (!cpu->current) {
+        // First tick with work queued: whatever we interrupted (kmain on the
+        // BSP, the AP idle loop) becomes this CPU's idle task
+        task_t *idle = (task_t *)pmalloc(1);
+        if (!idle) goto out;
+        memset(idle, 0, 4096);
+        idle->state = TASK_RUNNING;
+        idle->is_idle = 1;
+        idle->on_cpu = 1;
+        idle->cpu = cpu;
+        rq_push_tail(rq, idle);
+        cpu->idle = idle;
+        cpu->current = idle;
     }
 
-    memcpy((uint8_t *)&current->regs, (const uint8_t *)regs, sizeof(register_t));
+    task_t *prev = cpu->current;
+    memcpy((uint8_t *)&prev->regs, (const uint8_t *)regs, sizeof(register_t));
 
-    if (current->state == TASK_RUNNING) {
-        current->state = TASK_RUNNABLE;
+    if (prev->state == TASK_RUNNING) {
+        prev->state = TASK_RUNNABLE;
     }
 
-    task_t *next = current->next;
-    while (next && next->state != TASK_RUNNABLE) {
-        if (next == current) {
-            current->state = TASK_RUNNING;
-            return;
+    // Round robin over the real tasks, prev included as the last choice.
+    // The idle context never takes a turn while one of them can run.
+    task_t *next = NULL;
+    task_t *t = prev;
+    do {
+        t = t->rq_next;
+        if (t->state == TASK_RUNNABLE && !t->is_idle) {
+            next = t;
+            break;
         }
-        next = next->next;
+    } while (t != prev);
+
+    // Nothing to run here, go find work elsewhere before idling
+    if (!next && cpu_count > 1)
+        next = sched_steal(cpu);
+    if (!next)
+        next = cpu->idle;
+    if (!next || next->state != TASK_RUNNABLE) goto out;
+
+    next->state = TASK_RUNNING;
+    if (next != prev) {
+        next->on_cpu = 1;
+        cpu->current = next;
+        prev->last_ran = get_ticks();
+        // prev's frame is saved and we are on the IST stack, so from here on
+        // another CPU may reap or steal it
+        __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
     }
     
-    current = next;
-    current->state = TASK_RUNNING;
-    
-    if (current->is_usermode) {
-        uint64_t kstack_top = (uint64_t)current->stack_base + current->stack_pages * 4096;
+    if (next->is_usermode) {
+        uint64_t kstack_top = (uint64_t)next->stack_base + next->stack_pages * 4096;
         tss_set_kernel_stack(kstack_top); 
-        
-        if (current->cr3 != 0) {
-            vmm_switch_page_table(current->cr3);
-        }
+    }
+    // Kernel tasks run on the kernel page table, so a user address space can
+    // be torn down on another CPU while this one idles
+    uint64_t cr3 = next->cr3 ? next->cr3 : vmm_get_kernel_cr3();
+    if (cpu->active_cr3 != cr3) {
+        vmm_switch_page_table(cr3);
     }
 
-    memcpy((uint8_t *)regs, (const uint8_t *)&current->regs, sizeof(register_t));
+    memcpy((uint8_t *)regs, (const uint8_t *)&next->regs, sizeof(register_t));
+out:
+    spinlock_release(&rq->lock);
 }
 
 static void setup_task_stdio(task_t *t) {
@@ -169,7 +421,7 @@ task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack
         return NULL;
     }
     
-    task_t *t = (task_t *)kmalloc(sizeof(task_t));
+    task_t *t = (task_t *)pcalloc(1);
     void *kernel_stack = pmalloc(stack_pages);
     void *ustack = pmalloc(2); 
     
@@ -181,7 +433,6 @@ task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack
         vmm_free_user_page_table(task_cr3);
         return NULL;
     }
-    memset(t, 0, 4096);
     t->brk_start   = elf_info.end_addr;
     t->brk_current = elf_info.end_addr;
     uint64_t user_flags = PTE_PRESENT | PTE_RW | PTE_USER;
@@ -189,7 +440,8 @@ task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack
     void *ustack_phys2 = phys_from_virt((void*)((uint64_t)ustack + 4096));
     
     if (vmm_map_page_in(task_cr3, (void*)USER_STACK_TOP_VADDR, ustack_phys1, user_flags) != 0 ||
-        vmm_map_page_in(task_cr3, (void*)(USER_STACK_TOP_VADDR + 4096), ustack_phys2, user_flags) != 0) {
+        vmm_map_page_in(task_cr3, (void*)(USER_STACK_TOP_VADDR + 4096), ustack_phys2, user_flags) != 0 ||
+        vdso_map_into(task_cr3) != 0) {
         pmm_free_pages(t, 1);
         pmm_free_pages(kernel_stack, stack_pages);
         pmm_free_pages(ustack, 2);
@@ -200,7 +452,13 @@ task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack
     
     user_stack_result_t stack_res;
     if (build_user_stack((uint8_t*)ustack, 8192, USER_STACK_TOP_VADDR,
-                          argc, argv, envc, envp, &stack_res) != 0) {
+                          argc, argv, envc, envp, &stack_res) != 0 ||
+        elf_map_vmas(elf_data, &t->vmas) != 0 ||
+        vma_map(&t->vmas, USER_STACK_TOP_VADDR, USER_STACK_TOP_VADDR + 8192,
+                VMA_READ | VMA_WRITE, VMA_STACK, NULL, 0) != 0 ||
+        vma_map(&t->vmas, VDSO_DATA_VADDR, VDSO_DATA_VADDR + 4096,
+                VMA_READ, VMA_SHARED, NULL, 0) != 0) {
+        vma_destroy(&t->vmas);
         pmm_free_pages(t, 1);
         pmm_free_pages(kernel_stack, stack_pages);
         pmm_free_pages(ustack, 2);
@@ -212,7 +470,7 @@ task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack
     t->stack_base = kernel_stack;
     t->stack_pages = stack_pages;
     t->state = TASK_RUNNABLE;
-    t->id = next_task_id++;
+    t->id = atomic_fetch_add(&next_task_id, 1);
     t->cr3 = task_cr3;
     t->is_usermode = 1;
     t->user_code = elf_info.pages;
@@ -241,14 +499,41 @@ task_t *create_elf_task_args(const void *elf_data, size_t elf_size, size_t stack
     task_enqueue(t);
     return t;
 }
+task_t *create_kernel_task(void (*entry)(void), size_t stack_pages) {
+    task_t *t = (task_t *)pcalloc(1);
+    void *kernel_stack = pmalloc(stack_pages);
+    if (!t || !kernel_stack) {
+        if (t) pmm_free_pages(t, 1);
+        if (kernel_stack) pmm_free_pages(kernel_stack, stack_pages);
+        return NULL;
+    }
+
+    t->stack_base = kernel_stack;
+    t->stack_pages = stack_pages;
+    t->state = TASK_RUNNABLE;
+    t->id = atomic_fetch_add(&next_task_id, 1);
+    t->cr3 = 0;              // Runs on the kernel page table
+    t->cwd = (void*)vfs_get_root_dentry();
+
+    t->regs.rip = (uint64_t)entry;
+    t->regs.cs = GDT_KERNEL_CODE;
+    t->regs.rflags = 0x202;
+    // Aligned as if entry had been called
+    t->regs.rsp = (uint64_t)kernel_stack + stack_pages * 4096 - 8;
+    t->regs.ss = GDT_KERNEL_DATA;
+
+    task_enqueue(t);
+    return t;
+}
+
 task_t *fork_current_task(register_t *parent_regs) {
-    task_t *parent = current;
+    task_t *parent = get_current_task();
     if (!parent || !parent->is_usermode) return NULL;
 
     uint64_t child_cr3 = vmm_clone_user_page_table(parent->cr3);
     if (child_cr3 == 0) return NULL;
 
-    task_t *child = (task_t *)pmalloc(1);
+    task_t *child = (task_t *)pcalloc(1);
     void *kernel_stack = pmalloc(parent->stack_pages);
     if (!child || !kernel_stack) {
         if (child) pmm_free_pages(child, 1);
@@ -256,7 +541,6 @@ task_t *fork_current_task(register_t *parent_regs) {
         vmm_free_user_page_table(child_cr3);
         return NULL;
     }
-    memset(child, 0, 4096);
 
     elf_page_t *parent_pages = (elf_page_t *)parent->user_code;
     size_t meta_pages = (parent->user_code_pages * sizeof(elf_page_t) + 4095) / 4096;
@@ -270,6 +554,14 @@ task_t *fork_current_task(register_t *parent_regs) {
     }
     memset(child_pages, 0, meta_pages * 4096);
 
+    if (vma_clone(&child->vmas, &parent->vmas) != 0) {
+        pmm_free_pages(child_pages, meta_pages);
+        pmm_free_pages(kernel_stack, parent->stack_pages);
+        pmm_free_pages(child, 1);
+        vmm_free_user_page_table(child_cr3);
+        return NULL;
+    }
+
     for (size_t i = 0; i < parent->user_code_pages; i++) {
         uint64_t u_vaddr = parent_pages[i].user_vaddr;
         uint64_t pte = vmm_get_pte(child_cr3, u_vaddr);
@@ -285,10 +577,11 @@ task_t *fork_current_task(register_t *parent_regs) {
     child->stack_base = kernel_stack;
     child->brk_start   = parent->brk_start;
     child->brk_current = parent->brk_current;
-    child->mmap_base   = parent->mmap_base;
+    child->ioring      = parent->ioring;
+    child->ioring_entries = parent->ioring_entries;
     child->stack_pages = parent->stack_pages;
     child->state = TASK_RUNNABLE;
-    child->id = next_task_id++;
+    child->id = atomic_fetch_add(&next_task_id, 1);
     child->parent_id = parent->id;
     child->cr3 = child_cr3;
     child->is_usermode = 1;
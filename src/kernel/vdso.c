@@ -0,0 +1,72 @@
+#include <kernel/vdso.h>
+#include <arch/x86_64/cpu.h>
+#include <drivers/pit.h>
+#include <drivers/rtc.h>
+#include <libk/string.h>
+#include <libk/utils.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <stdint.h>
+
+static vdso_data_t *vdso_data = NULL;
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Count TSC cycles over a known number of PIT ticks
+static uint64_t tsc_calibrate(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (!(d & (1 << 4))) return 0;
+
+    pit_wait(1);
+    uint64_t start = rdtsc();
+    pit_wait(10);
+    uint64_t end = rdtsc();
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    int invariant = 0;
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, 0, &a, &b, &c, &d);
+        invariant = (d >> 8) & 1;
+    }
+    uint64_t tsc_hz = (end - start) * hz / 10;
+    log("VDSO", INFO, "TSC at %ul kHz%s\n\r", tsc_hz / 1000, invariant ? " (invariant)" : "");
+    return tsc_hz;
+}
+
+// Needs the PIT running and interrupts enabled for calibration
+void init_vdso(void) {
+    vdso_data = (vdso_data_t *)pmalloc(1);
+    if (!vdso_data) {
+        log("VDSO", ERROR, "Failed to allocate data page\n\r");
+        return;
+    }
+    memset(vdso_data, 0, 4096);
+
+    vdso_data->tick_hz = hz;
+    vdso_data->tsc_hz = tsc_calibrate();
+    vdso_tick(get_ticks());
+    vdso_data->boot_epoch = get_unix_epoch() - get_ticks() / hz;
+    log("VDSO", INFO, "Data page at 0x%xl, boot epoch %ul\n\r", phys_from_virt(vdso_data), vdso_data->boot_epoch);
+}
+
+int vdso_map_into(uint64_t cr3_phys) {
+    if (!vdso_data) return -1;
+    // PTE_SHARED: clone maps the same frame, teardown leaves it alone
+    return vmm_map_page_in(cr3_phys, (void *)VDSO_DATA_VADDR, phys_from_virt(vdso_data),
+                           PTE_PRESENT | PTE_USER | PTE_SHARED);
+}
+
+void vdso_tick(uint64_t ticks) {
+    if (!vdso_data) return;
+    vdso_data->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vdso_data->ticks = ticks;
+    vdso_data->tick_tsc = rdtsc();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vdso_data->seq++;
+}
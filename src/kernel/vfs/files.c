@@ -3,6 +3,7 @@
 #include <kernel/sched/scheduler.h>
 #include <mm/pmm.h>
 #include <mm/liballoc.h>
+#include <mm/pagecache.h>
 
 int vfs_open(file_t **file, inode_t *inode, uint32_t flags) {
     if (!inode || !file) return -1;
@@ -27,12 +28,18 @@ long vfs_read(file_t *file, void *buf, size_t len) {
     if (!file || !file->inode) return -1;
     if (!file->inode->f_ops || 
         !file->inode->f_ops->read) return -1;
-    long ret = file->inode->f_ops->read(
-        file,
-        buf,
-        len,
-        file->offset
-    );
+
+    // Once a file is mapped its cached pages may be newer than the disk
+    long ret;
+    if (page_cache_holds(file->inode))
+        ret = page_cache_read(file->inode, buf, len, file->offset);
+    else
+        ret = file->inode->f_ops->read(
+            file,
+            buf,
+            len,
+            file->offset
+        );
 
     if (ret > 0)
         file->offset += ret;
@@ -52,8 +59,10 @@ long vfs_write(file_t *file, const void *buf, size_t len) {
         file->offset
     );
 
-    if (ret > 0)
+    if (ret > 0) {
+        page_cache_update(file->inode, file->offset, buf, (size_t)ret);
         file->offset += (uint64_t)ret;
+    }
 
     return ret;
 }
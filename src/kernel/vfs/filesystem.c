@@ -4,6 +4,7 @@
 #include <mm/liballoc.h>
 #include <libk/string.h>
 #include <mm/pmm.h>
+#include <mm/pagecache.h>
 
 static vfs_mount_t *mounts = NULL;
 static superblock_t *root_superblock = NULL;
@@ -341,6 +342,15 @@ int vfs_unlink(const char *path) {
     if (!parent_dentry || !parent_dentry->inode) return -1;
     if (!parent_dentry->inode->i_ops || !parent_dentry->inode->i_ops->unlink) return -1;
 
+    // A mapped file keeps its inode and clusters until the last mapping
+    // goes, refuse rather than leave VMAs pointing at freed ones
+    for (dentry_t *d = parent_dentry->children; d; d = d->next) {
+        if (!strcmp(d->name, file_name) && d->inode && d->inode->map_count) {
+            log("VFS", ERROR, "unlink '%s': file is mapped\n\r", path);
+            return -1;
+        }
+    }
+
     int result = parent_dentry->inode->i_ops->unlink(parent_dentry->inode, file_name);
     if (result != 0) return result;
 
@@ -355,6 +365,8 @@ int vfs_unlink(const char *path) {
             else parent_dentry->children = child->next;
 
             if (child->inode) {
+                // Its clusters are free now, cached pages must not outlive them
+                page_cache_evict(child->inode);
                 if (child->inode->private) kfree(child->inode->private); // fat32_node_info_t
                 kfree(child->inode);
             }
@@ -1,12 +1,46 @@
 #include <libk/spinlock.h>
 
-void spinlock_init(spinlock_t *lock) { atomic_store(&lock->lock, 0); }
+static inline uint64_t save_flags_cli(void) {
+  uint64_t flags;
+  asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+  return flags;
+}
+
+static inline void restore_flags(uint64_t flags) {
+  asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
+void spinlock_init(spinlock_t *lock) {
+  atomic_store(&lock->lock, 0);
+  lock->flags = 0;
+}
 
 void spinlock_acquire(spinlock_t *lock) {
+  uint64_t flags = save_flags_cli();
   while (atomic_exchange(&lock->lock, 1) == 1) {
-    // Busy-wait
-    asm volatile("pause");
+    // Busy-wait with the caller's interrupt state, so pending IPIs
+    // (TLB shootdowns in particular) are still serviced while we spin
+    restore_flags(flags);
+    while (atomic_load_explicit(&lock->lock, memory_order_relaxed))
+      asm volatile("pause");
+    flags = save_flags_cli();
   }
+  lock->flags = flags;
 }
 
-void spinlock_release(spinlock_t *lock) { atomic_store(&lock->lock, 0); }
+// Returns 1 with the lock held, 0 without spinning if it is taken
+int spinlock_try_acquire(spinlock_t *lock) {
+  uint64_t flags = save_flags_cli();
+  if (atomic_exchange(&lock->lock, 1) == 1) {
+    restore_flags(flags);
+    return 0;
+  }
+  lock->flags = flags;
+  return 1;
+}
+
+void spinlock_release(spinlock_t *lock) {
+  uint64_t flags = lock->flags;
+  atomic_store(&lock->lock, 0);
+  restore_flags(flags);
+}
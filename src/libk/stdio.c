@@ -4,266 +4,296 @@
 #include <libk/stdio.h>
 #include <libk/string.h>
 #include <stdarg.h>
+#include <stdbool.h>
+
+// printf() and __vsprintf__() format into a stack buffer of this size
+// and hand it on whole each time it fills, instead of a call per character
+#define FMT_BUF 128
 
 void putchar(char c) { tty_putchar(c); }
 
-void puts(const char *str) {
-  while (*str != 0) {
-    putchar(*str);
-    str++;
+void puts(const char *str) { tty_write_buf(str, strlen(str)); }
+
+// Where the formatter puts its output. Characters collect in buf; with a
+// flush function buf is passed on each time it fills, without one
+// (snprintf) anything past size is only counted.
+typedef struct {
+  char *buf;
+  size_t size;
+  size_t pos;     // Characters in buf
+  size_t total;   // Characters produced so far
+  void (*flush)(void *ctx, char *buf, size_t len);
+  void *ctx;
+} fmt_out_t;
+
+typedef struct {
+  int width;
+  bool left;      // '-': pad on the right
+  bool zero;      // '0': pad numbers with zeros after the sign
+} fmt_spec_t;
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+static const char hex_digits[16] = "0123456789abcdef";
+
+static void out_flush(fmt_out_t *o) {
+  if (o->flush && o->pos) {
+    o->flush(o->ctx, o->buf, o->pos);
+    o->pos = 0;
   }
 }
 
-int __vsprintf__(char *fmt, va_list args, void (*putchar_func)(char c),
-                 void (*puts_func)(const char *str)) {
-  int integer;
-  uint64_t unsigned_long;
-  uint32_t unsigned_int;
-  uint16_t unsigned_short;
-  uint8_t unsigned_char;
-  char character;
-  char *str = NULL;
+static void out_mem(fmt_out_t *o, const char *s, size_t len) {
+  o->total += len;
+  while (len) {
+    if (o->pos == o->size) {
+      if (!o->flush) return;
+      out_flush(o);
+    }
+    size_t n = o->size - o->pos < len ? o->size - o->pos : len;
+    memcpy(o->buf + o->pos, s, n);
+    o->pos += n;
+    s += n;
+    len -= n;
+  }
+}
+
+static void out_fill(fmt_out_t *o, char c, int count) {
+  char run[16];
+  memset(run, c, sizeof(run));
+  while (count > 0) {
+    int n = count < (int)sizeof(run) ? count : (int)sizeof(run);
+    out_mem(o, run, n);
+    count -= n;
+  }
+}
 
-  char buffer[32]; // Local buffer for conversions
+// Emit one converted field, padded out to the width of spec
+static void out_field(fmt_out_t *o, const fmt_spec_t *spec, bool neg, bool numeric,
+                      const char *s, size_t len) {
+  int pad = spec->width - (int)len - (neg ? 1 : 0);
+  if (pad > 0 && !spec->left && !(numeric && spec->zero))
+    out_fill(o, ' ', pad);
+  if (neg)
+    out_mem(o, "-", 1);
+  if (pad > 0 && !spec->left && numeric && spec->zero)
+    out_fill(o, '0', pad);
+  out_mem(o, s, len);
+  if (pad > 0 && spec->left)
+    out_fill(o, ' ', pad);
+}
 
-  while (*fmt != 0) {
-    if (*fmt == '%') {
+// The converters write the digits of v so that they end just before end
+// and return where they start. Decimal takes two digits per division.
+static char *fmt_dec(char *end, uint64_t v) {
+  while (v >= 100) {
+    const char *d = &digit_pairs[(v % 100) * 2];
+    v /= 100;
+    end -= 2;
+    end[0] = d[0];
+    end[1] = d[1];
+  }
+  if (v >= 10) {
+    end -= 2;
+    end[0] = digit_pairs[v * 2];
+    end[1] = digit_pairs[v * 2 + 1];
+  } else {
+    *--end = (char)('0' + v);
+  }
+  return end;
+}
+
+static char *fmt_hex(char *end, uint64_t v) {
+  do {
+    *--end = hex_digits[v & 0xF];
+    v >>= 4;
+  } while (v);
+  return end;
+}
+
+static char *fmt_bin(char *end, uint64_t v) {
+  do {
+    *--end = (char)('0' + (v & 1));
+    v >>= 1;
+  } while (v);
+  return end;
+}
+
+// Conversions: %c %s %d %i %b %%, and %x or %u with a size suffix:
+// l (64 bit), i (32), s (16), h (8), plus d (int) and c (char) for %x.
+// %x and %u without a suffix take 32 bits. Flags '-' and '0' and a
+// width (or '*') may come between the '%' and the conversion.
+static void format(fmt_out_t *o, const char *fmt, va_list args) {
+  char num[72];
+  char *end = num + sizeof(num);
+
+  while (*fmt) {
+    // Plain text up to the next conversion goes out in one piece
+    const char *text = fmt;
+    while (*fmt && *fmt != '%')
       fmt++;
-      switch (*fmt) {
-      case 'c':
-        character = va_arg(args, int);
-        putchar_func(character);
+    out_mem(o, text, fmt - text);
+    if (!*fmt)
+      break;
+    fmt++;
+
+    fmt_spec_t spec = {0};
+    for (;; fmt++) {
+      if (*fmt == '-')
+        spec.left = true;
+      else if (*fmt == '0')
+        spec.zero = true;
+      else
         break;
-      case 's':
-        str = va_arg(args, char *);
-        puts_func(str ? str : "(null)");
+    }
+    if (*fmt == '*') {
+      spec.width = va_arg(args, int);
+      if (spec.width < 0) {
+        spec.left = true;
+        spec.width = -spec.width;
+      }
+      fmt++;
+    } else {
+      while (*fmt >= '0' && *fmt <= '9')
+        spec.width = spec.width * 10 + (*fmt++ - '0');
+    }
+
+    char *p;
+    switch (*fmt) {
+    case '\0':
+      return;
+    case 'c': {
+      char c = (char)va_arg(args, int);
+      out_field(o, &spec, false, false, &c, 1);
+      break;
+    }
+    case 's': {
+      const char *str = va_arg(args, const char *);
+      if (!str)
+        str = "(null)";
+      out_field(o, &spec, false, false, str, strlen(str));
+      break;
+    }
+    case 'd':
+    case 'i':
+    case 'b': {
+      int v = va_arg(args, int);
+      uint64_t mag = v < 0 ? -(uint64_t)(int64_t)v : (uint64_t)v;
+      p = *fmt == 'b' ? fmt_bin(end, mag) : fmt_dec(end, mag);
+      out_field(o, &spec, v < 0, true, p, end - p);
+      break;
+    }
+    case 'x':
+    case 'u': {
+      bool hex = *fmt == 'x';
+      uint64_t v;
+      switch (fmt[1]) {
+      case 'l':
+        v = va_arg(args, uint64_t);
+        fmt++;
         break;
-      case 'd':
       case 'i':
-        integer = va_arg(args, int);
-        itoa(integer, buffer, 10);
-        puts_func(buffer);
+        v = va_arg(args, uint32_t);
+        fmt++;
+        break;
+      case 's':
+        v = (uint16_t)va_arg(args, int);
+        fmt++;
         break;
-      case 'b':
-        integer = va_arg(args, int);
-        itoa(integer, buffer, 2);
-        puts_func(buffer);
+      case 'h':
+        v = (uint8_t)va_arg(args, int);
+        fmt++;
         break;
-      case 'x':
+      case 'd':
+        if (!hex)
+          goto plain;
+        v = (uint32_t)va_arg(args, int);
         fmt++;
-        switch (*fmt) {
-        case 'l':
-          unsigned_long = va_arg(args, uint64_t);
-          utoa(unsigned_long, buffer, 16);
-          puts_func(buffer);
-          break;
-        case 'i':
-          unsigned_int = va_arg(args, uint32_t);
-          utoa((uint64_t)unsigned_int, buffer, 16);
-          puts_func(buffer);
-          break;
-        case 's':
-          unsigned_short = va_arg(args, int);
-          utoa((uint64_t)unsigned_short, buffer, 16);
-          puts_func(buffer);
-          break;
-        case 'd':
-          integer = va_arg(args, int);
-          itoa(integer, buffer, 16);
-          puts_func(buffer);
-          break;
-        case 'c':
-          character = va_arg(args, int);
-          itoa((int)character, buffer, 16);
-          puts_func(buffer);
-          break;
-        case 'h':
-          unsigned_char = va_arg(args, int);
-          utoa((uint64_t)unsigned_char, buffer, 16);
-          puts_func(buffer);
-          break;
-        default:
-          putchar_func(*fmt);
-          break;
-        }
         break;
-      case 'u':
+      case 'c':
+        if (!hex)
+          goto plain;
+        v = (uint8_t)va_arg(args, int);
         fmt++;
-        switch (*fmt) {
-        case 'l':
-          unsigned_long = va_arg(args, uint64_t);
-          utoa(unsigned_long, buffer, 10);
-          puts_func(buffer);
-          break;
-        case 'i':
-          unsigned_int = va_arg(args, uint32_t);
-          utoa((uint64_t)unsigned_int, buffer, 10);
-          puts_func(buffer);
-          break;
-        case 's':
-          unsigned_short = va_arg(args, int);
-          utoa((uint64_t)unsigned_short, buffer, 10);
-          puts_func(buffer);
-          break;
-        case 'h':
-          unsigned_char = va_arg(args, int);
-          utoa((uint64_t)unsigned_char, buffer, 10);
-          puts_func(buffer);
-          break;
-        default:
-          putchar_func(*fmt);
-          break;
-        }
         break;
       default:
-        putchar_func(*fmt);
+      plain:
+        v = va_arg(args, uint32_t);
         break;
       }
-    } else {
-      putchar_func(*fmt);
+      p = hex ? fmt_hex(end, v) : fmt_dec(end, v);
+      out_field(o, &spec, false, true, p, end - p);
+      break;
+    }
+    default:
+      // %% and unknown conversions print the character itself
+      out_mem(o, fmt, 1);
+      break;
     }
     fmt++;
   }
-  return 0;
 }
 
-int sprintf(char *out_buffer, const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+typedef void (*puts_fn_t)(const char *str);
 
-    char *out_ptr = out_buffer; // Pointer to track our position in the output buffer
-    
-    int integer;
-    uint64_t unsigned_long;
-    uint32_t unsigned_int;
-    uint16_t unsigned_short;
-    uint8_t unsigned_char;
-    char character;
-    char *str_arg = NULL;
-    char temp_buffer[32]; // Local buffer for numeric conversions
+static void flush_puts(void *ctx, char *buf, size_t len) {
+  buf[len] = '\0';
+  (*(puts_fn_t *)ctx)(buf);
+}
 
-    while (*fmt != '\0') {
-        if (*fmt == '%') {
-            fmt++;
-            switch (*fmt) {
-                case 'c':
-                    character = (char)va_arg(args, int);
-                    *out_ptr++ = character;
-                    break;
-                case 's':
-                    str_arg = va_arg(args, char *);
-                    if (!str_arg) str_arg = "(null)";
-                    while (*str_arg) {
-                        *out_ptr++ = *str_arg++;
-                    }
-                    break;
-                case 'd':
-                case 'i':
-                    integer = va_arg(args, int);
-                    itoa(integer, temp_buffer, 10);
-                    for (int i = 0; temp_buffer[i] != '\0'; i++) {
-                        *out_ptr++ = temp_buffer[i];
-                    }
-                    break;
-                case 'b':
-                    integer = va_arg(args, int);
-                    itoa(integer, temp_buffer, 2);
-                    for (int i = 0; temp_buffer[i] != '\0'; i++) {
-                        *out_ptr++ = temp_buffer[i];
-                    }
-                    break;
-                case 'x':
-                    fmt++;
-                    temp_buffer[0] = '\0'; // Reset temp buffer
-                    switch (*fmt) {
-                        case 'l':
-                            unsigned_long = va_arg(args, uint64_t);
-                            utoa(unsigned_long, temp_buffer, 16);
-                            break;
-                        case 'i':
-                            unsigned_int = va_arg(args, uint32_t);
-                            utoa((uint64_t)unsigned_int, temp_buffer, 16);
-                            break;
-                        case 's':
-                            unsigned_short = (uint16_t)va_arg(args, int);
-                            utoa((uint64_t)unsigned_short, temp_buffer, 16);
-                            break;
-                        case 'd':
-                            integer = va_arg(args, int);
-                            itoa(integer, temp_buffer, 16);
-                            break;
-                        case 'c':
-                            character = (char)va_arg(args, int);
-                            itoa((int)character, temp_buffer, 16);
-                            break;
-                        case 'h':
-                            unsigned_char = (uint8_t)va_arg(args, int);
-                            utoa((uint64_t)unsigned_char, temp_buffer, 16);
-                            break;
-                        default:
-                            *out_ptr++ = *fmt;
-                            break;
-                    }
-                    // Copy the converted hex string to the output buffer
-                    for (int i = 0; temp_buffer[i] != '\0'; i++) {
-                        *out_ptr++ = temp_buffer[i];
-                    }
-                    break;
-                case 'u':
+int __vsprintf__(char *fmt, va_list args, void (*putchar_func)(char c),
+                 void (*puts_func)(const char *str)) {
+  (void)putchar_func;
+  char buf[FMT_BUF + 1];   // Room for the terminator puts_func needs
+  fmt_out_t o = {
+      .buf = buf, .size = FMT_BUF, .flush = flush_puts, .ctx = &puts_func};
+  format(&o, fmt, args);
+  out_flush(&o);
+  return (int)o.total;
+}
 
-                    fmt++;
-                    temp_buffer[0] = '\0'; // Reset temp buffer
-                    switch (*fmt) {
-                        case 'l':
-                            unsigned_long = va_arg(args, uint64_t);
-                            utoa(unsigned_long, temp_buffer, 10);
-                            break;
-                        case 'i':
-                            unsigned_int = va_arg(args, uint32_t);
-                            utoa((uint64_t)unsigned_int, temp_buffer, 10);
-                            break;
-                        case 's':
-                            unsigned_short = (uint16_t)va_arg(args, int);
-                            utoa((uint64_t)unsigned_short, temp_buffer, 10);
-                            break;
-                        case 'h':
-                            unsigned_char = (uint8_t)va_arg(args, int);
-                            utoa((uint64_t)unsigned_char, temp_buffer, 10);
-                            break;
-                        default:
-                            *out_ptr++ = *fmt;
-                            break;
-                    }
-                    // Copy the converted unsigned string to the output buffer
-                    for (int i = 0; temp_buffer[i] != '\0'; i++) {
-                        *out_ptr++ = temp_buffer[i];
-                    }
-                    break;
-                default:
-                    *out_ptr++ = *fmt;
-                    break;
-            }
-        } else {
-            // Normal characters just get copied over
-            *out_ptr++ = *fmt;
-        }
-        fmt++;
-    }
+int vsnprintf(char *out_buffer, size_t size, const char *fmt, va_list args) {
+  fmt_out_t o = {.buf = out_buffer, .size = size ? size - 1 : 0};
+  format(&o, fmt, args);
+  if (size)
+    out_buffer[o.pos] = '\0';
+  // Length of the whole result, which was cut short if it is >= size
+  return (int)o.total;
+}
 
-    *out_ptr = '\0'; // Crucial: Null-terminate the final string
+int snprintf(char *out_buffer, size_t size, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(out_buffer, size, fmt, args);
+  va_end(args);
+  return n;
+}
 
-    va_end(args);
+int sprintf(char *out_buffer, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(out_buffer, (size_t)-1, fmt, args);
+  va_end(args);
+  return n;
+}
 
-    // Return the number of characters written (excluding the null terminator)
-    return (out_ptr - out_buffer); 
+static void flush_tty(void *ctx, char *buf, size_t len) {
+  (void)ctx;
+  tty_write_buf(buf, len);
 }
 
 int printf(char *fmt, ...) {
+  char buf[FMT_BUF];
+  fmt_out_t o = {.buf = buf, .size = FMT_BUF, .flush = flush_tty};
   va_list args;
   va_start(args, fmt);
-  __vsprintf__(fmt, args, putchar, puts);
+  format(&o, fmt, args);
   va_end(args);
-  return 0;
+  out_flush(&o);
+  return (int)o.total;
 }
 
 void gets(char *to) {
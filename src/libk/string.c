@@ -1,4 +1,38 @@
 #include <libk/string.h>
+#include <libk/utils.h>
+
+/*
+ * The kernel is built with -mgeneral-regs-only, so the block operations
+ * are string instructions and 64-bit words. With ERMS (enhanced rep
+ * movsb/stosb) the microcode picks the best chunk size itself and a plain
+ * rep movsb/stosb wins; without it dst is aligned and the bulk moved as
+ * qwords. init_string_ops() picks between the two once CPUID can be read,
+ * until then the qword paths are used.
+ *
+ * The string instructions assume DF is clear. Every kernel entry makes
+ * sure of that: the exception, IRQ and int 0x80 stubs run cld and SYSCALL
+ * masks DF through SFMASK. Nothing in the kernel sets it.
+ */
+static int have_erms = 0;
+// copy_page through SSE with non-temporal stores, "simdcopy" on the
+// kernel command line
+static int simd_pages = 0;
+
+// Below this rep movsb/stosb startup costs more than it saves
+#define ERMS_THRESHOLD 128
+
+// Unaligned, aliasing-safe word access for the compare and scan loops
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+
+void init_string_ops(void) {
+  uint32_t a, b, c, d;
+  asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0), "c"(0));
+  if (a >= 7) {
+    asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+    have_erms = (b >> 9) & 1;
+  }
+  simd_pages = arg_exist("simdcopy");
+}
 
 char *itoa(int value, char *str, int base) {
   char *rc;
@@ -52,9 +86,21 @@ char *utoa(uint64_t value, char *str, uint8_t base) {
 }
 
 void *memset(void *bufptr, int value, size_t size) {
-  unsigned char *buf = (unsigned char *)bufptr;
-  for (size_t i = 0; i < size; i++)
-    buf[i] = (unsigned char)value;
+  void *d = bufptr;
+  if (have_erms && size >= ERMS_THRESHOLD) {
+    asm volatile("rep stosb" : "+D"(d), "+c"(size) : "a"(value) : "memory");
+    return bufptr;
+  }
+
+  if (size >= 8) {
+    uint64_t pattern = (uint8_t)value * 0x0101010101010101ULL;
+    size_t head = -(uintptr_t)d & 7;
+    size_t words = (size - head) >> 3;
+    size = (size - head) & 7;
+    asm volatile("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+    asm volatile("rep stosq" : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+  }
+  asm volatile("rep stosb" : "+D"(d), "+c"(size) : "a"(value) : "memory");
   return bufptr;
 }
 
@@ -67,10 +113,73 @@ uint16_t *memsetw(uint16_t *dest, uint16_t val, size_t count) {
 }
 
 void *memcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t*)dest;
-    const uint8_t *s = (const uint8_t*)src;
-    for (size_t i = 0; i < n; i++) d[i] = s[i];
+  void *d = dest;
+  if (have_erms && n >= ERMS_THRESHOLD) {
+    asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
     return dest;
+  }
+
+  if (n >= 8) {
+    size_t head = -(uintptr_t)d & 7;
+    size_t words = (n - head) >> 3;
+    n = (n - head) & 7;
+    asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(head) : : "memory");
+    asm volatile("rep movsq" : "+D"(d), "+S"(src), "+c"(words) : : "memory");
+  }
+  asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+  return dest;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n) {
+  const uint8_t *a = (const uint8_t *)s1;
+  const uint8_t *b = (const uint8_t *)s2;
+  // Skip equal words, the byte loop then finds the first difference
+  while (n >= 8 && *(const unaligned_u64 *)a == *(const unaligned_u64 *)b) {
+    a += 8;
+    b += 8;
+    n -= 8;
+  }
+  for (; n; n--, a++, b++) {
+    if (*a != *b)
+      return *a - *b;
+  }
+  return 0;
+}
+
+void copy_page(void *dst, const void *src) {
+  if (!simd_pages) {
+    memcpy(dst, src, 4096);
+    return;
+  }
+
+  // Whatever task we interrupted may have live SSE state, keep it intact
+  // and stay on this CPU while the registers are borrowed
+  uint8_t fpu_state[512] __attribute__((aligned(16)));
+  uint64_t flags;
+  asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  asm volatile("fxsave %0" : "=m"(fpu_state));
+
+  size_t blocks = 4096 / 64;
+  asm volatile("1:\n\t"
+               "movdqa (%1), %%xmm0\n\t"
+               "movdqa 16(%1), %%xmm1\n\t"
+               "movdqa 32(%1), %%xmm2\n\t"
+               "movdqa 48(%1), %%xmm3\n\t"
+               "movntdq %%xmm0, (%0)\n\t"
+               "movntdq %%xmm1, 16(%0)\n\t"
+               "movntdq %%xmm2, 32(%0)\n\t"
+               "movntdq %%xmm3, 48(%0)\n\t"
+               "add $64, %0\n\t"
+               "add $64, %1\n\t"
+               "dec %2\n\t"
+               "jnz 1b\n\t"
+               "sfence"
+               : "+r"(dst), "+r"(src), "+r"(blocks)
+               :
+               : "memory", "cc");
+
+  asm volatile("fxrstor %0" : : "m"(fpu_state));
+  asm volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
 }
 
 
@@ -78,59 +187,54 @@ void *memmove(void *dest, const void *src, size_t n) {
   unsigned char *d = (unsigned char *)dest;
   const unsigned char *s = (const unsigned char *)src;
 
-  if (d > s && d < s + n) {
-    d += n;
-    s += n;
-
-    while (n && ((uintptr_t)d & (sizeof(unsigned long) - 1))) {
-      n--;
-      *--d = *--s;
-    }
-
-    unsigned long *dw = (unsigned long *)d;
-    const unsigned long *sw = (const unsigned long *)s;
+  // memcpy copies upwards, which is safe whenever dest is below src
+  if (d <= s || d >= s + n)
+    return memcpy(dest, src, n);
 
-    while (n >= sizeof(unsigned long)) {
-      n -= sizeof(unsigned long);
-      --dw;
-      --sw;
-      *dw = *sw;
-    }
+  d += n;
+  s += n;
 
-    d = (unsigned char *)dw;
-    s = (const unsigned char *)sw;
-    while (n--) {
-      *--d = *--s;
-    }
-  } else {
-    while (n && ((uintptr_t)d & (sizeof(unsigned long) - 1))) {
-      *d++ = *s++;
-      n--;
-    }
+  while (n && ((uintptr_t)d & (sizeof(unsigned long) - 1))) {
+    n--;
+    *--d = *--s;
+  }
 
-    unsigned long *dw = (unsigned long *)d;
-    const unsigned long *sw = (const unsigned long *)s;
+  unsigned long *dw = (unsigned long *)d;
+  const unsigned long *sw = (const unsigned long *)s;
 
-    while (n >= sizeof(unsigned long)) {
-      *dw++ = *sw++;
-      n -= sizeof(unsigned long);
-    }
+  while (n >= sizeof(unsigned long)) {
+    n -= sizeof(unsigned long);
+    --dw;
+    --sw;
+    *dw = *sw;
+  }
 
-    d = (unsigned char *)dw;
-    s = (const unsigned char *)sw;
-    while (n--) {
-      *d++ = *s++;
-    }
+  d = (unsigned char *)dw;
+  s = (const unsigned char *)sw;
+  while (n--) {
+    *--d = *--s;
   }
 
   return dest;
 }
 
 int strlen(const char *str) {
-  int len = 0;
-  while (str[len])
-    len++;
-  return len;
+  const char *p = str;
+  // Bytewise up to a word boundary, aligned loads never cross into an
+  // unmapped page
+  for (; (uintptr_t)p & 7; p++) {
+    if (!*p)
+      return p - str;
+  }
+  for (;;) {
+    uint64_t w = *(const unaligned_u64 *)p;
+    if ((w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL)
+      break;
+    p += 8;
+  }
+  while (*p)
+    p++;
+  return p - str;
 }
 
 char *strcpy(char *dst, const char *src) {
@@ -1,5 +1,6 @@
 #include <drivers/serial.h>
 #include <init/limine_req.h>
+#include <kernel/kmsg.h>
 #include <libk/stdio.h>
 #include <libk/string.h>
 #include <libk/utils.h>
@@ -21,21 +22,19 @@ void sysfetch() {
          "\033[21;45m  \033[21;46m  \033[21;47m  \033[0m\n");
 }
 
-void log(const char* module, int status, char *fmt, ...) {
-  dbgln("\033[1;34m[%s] %s: \033[0m", module, status ? "\033[32m" : "\033[31mERROR");
-  
+int log_level = INFO;
+
+void klog(const char* module, int status, char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  __vsprintf__(fmt, args, serial_putchar, serial_puts);
+  kmsg_vadd(module, status, fmt, args);
   va_end(args);
 }
 
 void dbgln(char *fmt, ...) {
-  if (!is_serial_initialized())
-    return;
   va_list args;
   va_start(args, fmt);
-  __vsprintf__(fmt, args, serial_putchar, serial_puts);
+  kmsg_vadd(NULL, INFO, fmt, args);
   va_end(args);
 }
 
@@ -53,6 +52,11 @@ void init_arg_parser() {
   } else {
     kernel_argv[kernel_argc] = NULL;
   }
+
+  if (arg_exist("verbose"))
+    log_level = VERBOSE;
+  else if (arg_exist("quiet"))
+    log_level = ERROR;
 }
 
 int arg_exist(char *arg) {
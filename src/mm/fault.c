@@ -0,0 +1,78 @@
+#include <mm/vma.h>
+#include <mm/vmm.h>
+#include <mm/pmm.h>
+#include <mm/pagecache.h>
+#include <mm/uaccess.h>
+#include <kernel/sched/scheduler.h>
+#include <kernel/vfs/vfs.h>
+#include <libk/string.h>
+
+#define PTE_PHYS_MASK 0x000ffffffffff000ULL
+
+// Give the task its own copy of a page it may write (MAP_PRIVATE file page)
+static int map_private_copy(uint64_t cr3, uint64_t va, const void *src, uint64_t flags) {
+    void *copy = pmalloc(1);
+    if (!copy) return -1;
+    copy_page(copy, src);
+    if (vmm_map_page_in(cr3, (void *)va, phys_from_virt(copy), flags | PTE_RW) != 0) {
+        pmm_free_pages(copy, 1);
+        return -1;
+    }
+    return 0;
+}
+
+int vma_fault(uint64_t addr, uint64_t err) {
+    task_t *t = get_current_task();
+    if (!t || !t->cr3 || addr >= USER_SPACE_END) return -1;
+
+    vma_t *v = vma_lookup(&t->vmas, addr);
+    if (!v || !v->prot) return -1;
+    if ((err & PF_WRITE) && !(v->prot & VMA_WRITE)) return -1;
+    if ((err & PF_FETCH) && !(v->prot & VMA_EXEC)) return -1;
+
+    uint64_t va = addr & ~0xFFFULL;
+    uint64_t flags = PTE_PRESENT | PTE_USER;
+    if (!(v->prot & VMA_EXEC)) flags |= PTE_NX;
+
+    uint64_t pte = vmm_get_pte(t->cr3, va);
+    if (pte & PTE_PRESENT) {
+        // Another CPU got here first, or the TLB held a stale entry
+        if (!(err & PF_WRITE) || (pte & PTE_RW)) {
+            vmm_flush_tlb_local(va, 1);
+            return 0;
+        }
+        // First store to a private file page still shared with the cache
+        if (!v->file || (v->flags & VMA_SHARED) || !(pte & PTE_SHARED)) return -1;
+        return map_private_copy(t->cr3, va, virt_from_phys((void *)(pte & PTE_PHYS_MASK)), flags);
+    }
+
+    // Anonymous memory is populated by mmap and brk up front
+    if (!v->file) return -1;
+    uint64_t pos = v->offset + (va - v->start);
+    if (pos >= v->file->size) return -1;
+    void *page = page_cache_get(v->file, pos / PAGE_SIZE);
+    if (!page) return -1;
+
+    if (v->flags & VMA_SHARED) {
+        if (v->prot & VMA_WRITE) flags |= PTE_RW;
+        return vmm_map_page_in(t->cr3, (void *)va, phys_from_virt(page), flags | PTE_SHARED);
+    }
+    if (err & PF_WRITE)
+        return map_private_copy(t->cr3, va, page, flags);
+    // Reads share the cache page until the first write
+    return vmm_map_page_in(t->cr3, (void *)va, phys_from_virt(page), flags | PTE_SHARED);
+}
+
+void vma_writeback(vma_tree_t *tree, uint64_t cr3, uint64_t start, uint64_t end) {
+    for (vma_t *v = vma_find(tree, start); v && v->start < end; v = vma_next(v)) {
+        if (!v->file || !(v->flags & VMA_SHARED)) continue;
+
+        uint64_t s = v->start > start ? v->start : start;
+        uint64_t e = v->end < end ? v->end : end;
+        for (uint64_t va = s; va < e; va += PAGE_SIZE) {
+            uint64_t pte = vmm_clear_pte_bits(cr3, va, PTE_DIRTY);
+            if ((pte & PTE_PRESENT) && (pte & PTE_DIRTY))
+                page_cache_writeback(v->file, (v->offset + (va - v->start)) / PAGE_SIZE);
+        }
+    }
+}
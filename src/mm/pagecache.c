@@ -0,0 +1,182 @@
+#include <mm/pagecache.h>
+#include <mm/pmm.h>
+#include <mm/liballoc.h>
+#include <kernel/vfs/vfs.h>
+#include <libk/string.h>
+#include <libk/utils.h>
+
+#define PCACHE_BUCKETS 1024
+
+typedef struct cached_file {
+    inode_t *inode;
+    size_t nr_pages;
+    struct cached_file *next;
+} cached_file_t;
+
+typedef struct cached_page {
+    cached_file_t *file;
+    uint64_t index;
+    void *page;
+    struct cached_page *next;   // Hash chain
+} cached_page_t;
+
+static cached_file_t *files;
+static cached_page_t *buckets[PCACHE_BUCKETS];
+
+static cached_file_t *find_file(inode_t *inode, int create) {
+    for (cached_file_t *f = files; f; f = f->next) {
+        if (f->inode == inode)
+            return f;
+    }
+    if (!create) return NULL;
+
+    cached_file_t *f = kmalloc(sizeof(cached_file_t));
+    if (!f) return NULL;
+    f->inode = inode;
+    f->nr_pages = 0;
+    f->next = files;
+    files = f;
+    return f;
+}
+
+static inline size_t bucket_of(cached_file_t *f, uint64_t index) {
+    uint64_t h = ((uint64_t)f >> 4) ^ (index * 0x9E3779B97F4A7C15ULL);
+    return (h >> 32) % PCACHE_BUCKETS;
+}
+
+static void *find_page(cached_file_t *f, uint64_t index) {
+    for (cached_page_t *p = buckets[bucket_of(f, index)]; p; p = p->next) {
+        if (p->file == f && p->index == index)
+            return p->page;
+    }
+    return NULL;
+}
+
+// A file_t for driver calls made on behalf of the cache
+static inline file_t cache_file(inode_t *inode, uint64_t offset) {
+    file_t tmp = {
+        .inode = inode,
+        .flags = 0,
+        .f_ops = inode->f_ops,
+        .offset = offset,
+    };
+    return tmp;
+}
+
+void *page_cache_get(inode_t *inode, uint64_t index) {
+    if (!inode || !inode->f_ops || !inode->f_ops->read) return NULL;
+
+    cached_file_t *f = find_file(inode, 1);
+    if (!f) return NULL;
+    void *page = find_page(f, index);
+    if (page) return page;
+
+    cached_page_t *p = kmalloc(sizeof(cached_page_t));
+    page = pcalloc(1);
+    if (!p || !page) {
+        if (p) kfree(p);
+        if (page) pmm_free_pages(page, 1);
+        return NULL;
+    }
+
+    uint64_t off = index * PAGE_SIZE;
+    if (off < inode->size) {
+        size_t len = inode->size - off < PAGE_SIZE ? inode->size - off : PAGE_SIZE;
+        file_t tmp = cache_file(inode, off);
+        if (inode->f_ops->read(&tmp, page, len, off) < 0) {
+            log("PCACHE", ERROR, "read of page %ul of inode %d failed\n\r", index, inode->ino);
+            pmm_free_pages(page, 1);
+            kfree(p);
+            return NULL;
+        }
+    }
+
+    size_t b = bucket_of(f, index);
+    p->file = f;
+    p->index = index;
+    p->page = page;
+    p->next = buckets[b];
+    buckets[b] = p;
+    f->nr_pages++;
+    return page;
+}
+
+int page_cache_writeback(inode_t *inode, uint64_t index) {
+    if (!inode || !inode->f_ops || !inode->f_ops->write) return -1;
+    cached_file_t *f = find_file(inode, 0);
+    void *page = f ? find_page(f, index) : NULL;
+    if (!page) return -1;
+
+    // Shared mappings never grow the file, the tail of the last page is
+    // not written
+    uint64_t off = index * PAGE_SIZE;
+    if (off >= inode->size) return 0;
+    size_t len = inode->size - off < PAGE_SIZE ? inode->size - off : PAGE_SIZE;
+    file_t tmp = cache_file(inode, off);
+    return inode->f_ops->write(&tmp, page, len, off) == (long)len ? 0 : -1;
+}
+
+int page_cache_holds(inode_t *inode) {
+    if (!inode || inode->type != FT_REG) return 0;
+    cached_file_t *f = find_file(inode, 0);
+    return f && f->nr_pages;
+}
+
+long page_cache_read(inode_t *inode, void *buf, size_t len, uint64_t offset) {
+    if (offset >= inode->size) return 0;
+    if (len > inode->size - offset) len = inode->size - offset;
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint8_t *page = page_cache_get(inode, pos / PAGE_SIZE);
+        if (!page) return done ? (long)done : -1;
+        size_t in_page = PAGE_SIZE - (pos % PAGE_SIZE);
+        size_t n = len - done < in_page ? len - done : in_page;
+        memcpy((uint8_t *)buf + done, page + pos % PAGE_SIZE, n);
+        done += n;
+    }
+    return (long)done;
+}
+
+void page_cache_update(inode_t *inode, uint64_t offset, const void *buf, size_t len) {
+    cached_file_t *f = find_file(inode, 0);
+    if (!f || !f->nr_pages) return;
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        size_t in_page = PAGE_SIZE - (pos % PAGE_SIZE);
+        size_t n = len - done < in_page ? len - done : in_page;
+        uint8_t *page = find_page(f, pos / PAGE_SIZE);
+        if (page)
+            memcpy(page + pos % PAGE_SIZE, (const uint8_t *)buf + done, n);
+        done += n;
+    }
+}
+
+void page_cache_evict(inode_t *inode) {
+    cached_file_t **link = &files;
+    while (*link && (*link)->inode != inode)
+        link = &(*link)->next;
+    cached_file_t *f = *link;
+    if (!f) return;
+
+    for (size_t b = 0; b < PCACHE_BUCKETS && f->nr_pages; b++) {
+        cached_page_t **pp = &buckets[b];
+        while (*pp) {
+            cached_page_t *p = *pp;
+            if (p->file != f) {
+                pp = &p->next;
+                continue;
+            }
+            *pp = p->next;
+            pmm_free_pages(p->page, 1);
+            kfree(p);
+            f->nr_pages--;
+        }
+    }
+
+    *link = f->next;
+    kfree(f);
+}
@@ -1,5 +1,6 @@
 #include <init/limine.h>
 #include <init/limine_req.h>
+#include <libk/spinlock.h>
 #include <libk/string.h>
 #include <libk/utils.h>
 #include <mm/pmm.h>
@@ -16,12 +17,33 @@ static uint8_t *pmm_bitmap = 0;
 static uintptr_t highest_page = 0;
 static uint32_t total_mem = 0;
 static uint32_t free_mem = 0;
+// No frame below this one is free. Frees lower it, allocating the frame
+// it points at raises it, so first fit scans start here instead of at 0.
+static size_t free_hint = 0;
 
 // HHDM offset (higher-half direct map) provided by Limine if available.
 // Populated during init_pmm(). Use this to convert between physical and
 // virtual addresses inside the PMM implementation.
 static uintptr_t hhdm_offset = 0ULL;
 
+// Protects the bitmap and the free counter against other CPUs
+static spinlock_t pmm_lock;
+
+/*
+ * Frames zeroed ahead of time. Idle CPUs allocate free frames, clear them
+ * with non-temporal stores (the zeroes would only evict useful cache
+ * lines) and park them here; pcalloc(1) takes from the pool before
+ * zeroing anything itself. When memory runs out the pool is handed back
+ * to the bitmap. Lock order: pmm_lock, then zero_pool_lock.
+ */
+#define ZERO_POOL_SIZE 256
+// Leave this many frames alone before refilling the pool
+#define ZERO_POOL_RESERVE 4096
+
+static void *zero_pool[ZERO_POOL_SIZE];
+static size_t zero_pool_count = 0;
+static spinlock_t zero_pool_lock;
+
 static void *get_physical_address(void *adr) {
   if (hhdm_offset == 0)
     return adr; // assume already physical if offset unknown
@@ -43,16 +65,21 @@ static void *get_virtual_address(void *adr) {
 }
 
 void pmm_free_page(void *adr) {
-  BIT_CLEAR((size_t)get_physical_address(adr) / PAGE_SIZE);
+  size_t frame = (size_t)get_physical_address(adr) / PAGE_SIZE;
+  BIT_CLEAR(frame);
+  if (frame < free_hint)
+    free_hint = frame;
 }
 
 void pmm_alloc_page(void *adr) { BIT_SET((size_t)get_physical_address(adr) / PAGE_SIZE); }
 
 void pmm_free_pages(void *adr, size_t page_count) {
+  spinlock_acquire(&pmm_lock);
   for (size_t i = 0; i < page_count; i++) {
     pmm_free_page((void *)((uintptr_t)adr + (i * PAGE_SIZE)));
   }
   free_mem += page_count * PAGE_SIZE;
+  spinlock_release(&pmm_lock);
 }
 
 void pmm_alloc_pages(void *adr, size_t page_count) {
@@ -62,39 +89,97 @@ void pmm_alloc_pages(void *adr, size_t page_count) {
   free_mem -= page_count * PAGE_SIZE;
 }
 
-static inline uint64_t irq_save_disable(void) {
-    uint64_t flags;
-    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
-    return flags;
-}
-static inline void irq_restore(uint64_t flags) {
-    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
-}
-
-void *pmalloc(size_t pages) {
-  uint64_t flags = irq_save_disable();
-
+// First fit scan from free_hint, pmm_lock held. NULL if no run of
+// `pages` is free.
+static void *pmalloc_locked(size_t pages) {
   size_t max_pages = highest_page / PAGE_SIZE;
-  for (size_t i = 0; i < max_pages; i++) {
+  for (size_t i = free_hint; i < max_pages; i++) {
+    // Whole bytes of busy frames are skipped at once
+    if (!(i & 7) && pmm_bitmap[i / 8] == 0xff) {
+      i += 7;
+      continue;
+    }
     for (size_t j = 0; j < pages; j++) {
       if (BIT_TEST(i + j))
         break;
       else if (j == pages - 1) {
         uintptr_t phys_addr = (uintptr_t)(i * PAGE_SIZE);
         pmm_alloc_pages((void *)phys_addr, pages);
-        irq_restore(flags);
+        if (i == free_hint)
+          free_hint = i + pages;
         return get_virtual_address((void *)phys_addr);
       }
     }
   }
+  return NULL;
+}
+
+// Give the pre-zeroed frames back to the bitmap, pmm_lock held
+static size_t zero_pool_drain_locked(void) {
+  spinlock_acquire(&zero_pool_lock);
+  size_t n = zero_pool_count;
+  for (size_t i = 0; i < n; i++)
+    pmm_free_page(zero_pool[i]);
+  free_mem += n * PAGE_SIZE;
+  zero_pool_count = 0;
+  spinlock_release(&zero_pool_lock);
+  return n;
+}
+
+void *pmalloc(size_t pages) {
+  spinlock_acquire(&pmm_lock);
+
+  void *ret = pmalloc_locked(pages);
+  if (!ret && zero_pool_drain_locked())
+    ret = pmalloc_locked(pages);
+  if (ret) {
+    spinlock_release(&pmm_lock);
+    return ret;
+  }
 
   log("PMM",INFO, "Ran out of memory! Halting!\n\r");
-  irq_restore(flags);
+  spinlock_release(&pmm_lock);
   while (1) ;
   return NULL;
 }
 
+// Like pmalloc, but the run starts on an align_pages boundary (2 MiB for
+// huge pages). Returns NULL instead of halting, callers fall back to 4 KiB.
+void *pmalloc_aligned(size_t pages, size_t align_pages) {
+  spinlock_acquire(&pmm_lock);
+
+  size_t max_pages = highest_page / PAGE_SIZE;
+  for (size_t i = 0; i + pages <= max_pages; i += align_pages) {
+    size_t j;
+    for (j = 0; j < pages; j++) {
+      if (BIT_TEST(i + j))
+        break;
+    }
+    if (j == pages) {
+      uintptr_t phys_addr = (uintptr_t)(i * PAGE_SIZE);
+      pmm_alloc_pages((void *)phys_addr, pages);
+      spinlock_release(&pmm_lock);
+      return get_virtual_address((void *)phys_addr);
+    }
+    // Skip the aligned blocks the busy page rules out
+    i = (i + j) / align_pages * align_pages;
+  }
+
+  spinlock_release(&pmm_lock);
+  return NULL;
+}
+
 void *pcalloc(size_t pages) {
+  if (pages == 1) {
+    void *page = NULL;
+    spinlock_acquire(&zero_pool_lock);
+    if (zero_pool_count)
+      page = zero_pool[--zero_pool_count];
+    spinlock_release(&zero_pool_lock);
+    if (page)
+      return page;
+  }
+
   char *ret = (char *)pmalloc(pages);
 
   if (ret == NULL)
@@ -105,6 +190,59 @@ void *pcalloc(size_t pages) {
   return ret;
 }
 
+static void zero_page_nt(void *page) {
+  uint64_t *p = (uint64_t *)page;
+  for (size_t i = 0; i < PAGE_SIZE / 8; i += 4) {
+    asm volatile("movnti %1, (%0)\n\t"
+                 "movnti %1, 8(%0)\n\t"
+                 "movnti %1, 16(%0)\n\t"
+                 "movnti %1, 24(%0)"
+                 : : "r"(p + i), "r"(0ULL) : "memory");
+  }
+}
+
+// Frames taken from the bitmap per pmm_lock hold when refilling
+#define ZERO_POOL_BATCH 16
+
+size_t pmm_zero_pool_refill(size_t max_pages) {
+  void *batch[ZERO_POOL_BATCH];
+  if (max_pages > ZERO_POOL_BATCH)
+    max_pages = ZERO_POOL_BATCH;
+
+  size_t room = ZERO_POOL_SIZE - __atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED);
+  if (max_pages > room)
+    max_pages = room;
+
+  size_t n = 0;
+  spinlock_acquire(&pmm_lock);
+  while (n < max_pages && free_mem / PAGE_SIZE > ZERO_POOL_RESERVE) {
+    void *page = pmalloc_locked(1);
+    if (!page)
+      break;
+    batch[n++] = page;
+  }
+  spinlock_release(&pmm_lock);
+
+  for (size_t i = 0; i < n; i++)
+    zero_page_nt(batch[i]);
+  // Weakly ordered stores must land before another CPU can use the pages
+  asm volatile("sfence" : : : "memory");
+
+  size_t added = 0;
+  spinlock_acquire(&zero_pool_lock);
+  while (added < n && zero_pool_count < ZERO_POOL_SIZE)
+    zero_pool[zero_pool_count++] = batch[added++];
+  spinlock_release(&zero_pool_lock);
+  // Another CPU filled the pool meanwhile
+  for (size_t i = added; i < n; i++)
+    pmm_free_pages(batch[i], 1);
+  return added;
+}
+
+size_t pmm_zero_pool_pages(void) {
+  return __atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED);
+}
+
 void *phys_from_virt(void *virt) { return get_physical_address(virt); }
 void *virt_from_phys(void *phys) { return get_virtual_address(phys); }
 
@@ -160,4 +298,7 @@ int init_pmm() {
 }
 
 uint32_t get_total_physical_memory() { return total_mem; }
-uint32_t get_free_physical_memory() { return free_mem; }
+// Pre-zeroed frames are free memory that happens to be parked in the pool
+uint32_t get_free_physical_memory() {
+  return free_mem + (uint32_t)(pmm_zero_pool_pages() * PAGE_SIZE);
+}
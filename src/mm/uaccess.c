@@ -0,0 +1,118 @@
+#include <mm/uaccess.h>
+#include <mm/vmm.h>
+#include <mm/vma.h>
+#include <mm/liballoc.h>
+#include <kernel/vfs/vfs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every instruction allowed to fault on a user address gets an entry here,
+// the page fault handler resumes at `fixup` instead of panicking
+typedef struct {
+    uint64_t insn;
+    uint64_t fixup;
+} exception_entry_t;
+
+extern exception_entry_t __ex_table_start[];
+extern exception_entry_t __ex_table_end[];
+
+uint64_t search_exception_table(uint64_t rip) {
+    for (exception_entry_t *e = __ex_table_start; e < __ex_table_end; e++) {
+        if (e->insn == rip) return e->fixup;
+    }
+    return 0;
+}
+
+// Qword copy plus byte tail. Returns the number of bytes left uncopied,
+// which is non-zero only if a fault cut the copy short.
+static size_t copy_user_generic(void *dst, const void *src, size_t n) {
+    size_t left = n >> 3;
+    size_t tail = n & 7;
+    asm volatile(
+        "1: rep movsq\n\t"
+        "mov %[tail], %%rcx\n\t"
+        "2: rep movsb\n\t"
+        "3:\n\t"
+        ".pushsection .text.fixup, \"ax\"\n\t"
+        "4: lea (%[tail], %%rcx, 8), %%rcx\n\t"
+        "jmp 3b\n\t"
+        ".popsection\n\t"
+        ".pushsection __ex_table, \"a\"\n\t"
+        ".balign 8\n\t"
+        ".quad 1b, 4b\n\t"
+        ".quad 2b, 3b\n\t"
+        ".popsection"
+        : "+c"(left), "+D"(dst), "+S"(src)
+        : [tail] "r"(tail)
+        : "memory");
+    return left;
+}
+
+static int get_user_u8(uint8_t *out, const uint8_t *uptr) {
+    int err = 0;
+    uint8_t v = 0;
+    asm volatile(
+        "1: movb (%2), %1\n\t"
+        "2:\n\t"
+        ".pushsection .text.fixup, \"ax\"\n\t"
+        "3: mov %3, %0\n\t"
+        "jmp 2b\n\t"
+        ".popsection\n\t"
+        ".pushsection __ex_table, \"a\"\n\t"
+        ".balign 8\n\t"
+        ".quad 1b, 3b\n\t"
+        ".popsection"
+        : "+r"(err), "=q"(v)
+        : "r"(uptr), "i"(-EFAULT)
+        : "memory");
+    *out = v;
+    return err;
+}
+
+int copy_from_user(void *dst, const void *usrc, size_t n) {
+    if (!access_ok(usrc, n)) return -EFAULT;
+    return copy_user_generic(dst, usrc, n) ? -EFAULT : 0;
+}
+
+int copy_to_user(void *udst, const void *src, size_t n) {
+    if (!access_ok(udst, n)) return -EFAULT;
+    return copy_user_generic(udst, src, n) ? -EFAULT : 0;
+}
+
+long strncpy_from_user(char *dst, const char *usrc, size_t n) {
+    const uint8_t *p = (const uint8_t*)usrc;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t c;
+        if (!access_ok(p + i, 1) || get_user_u8(&c, p + i)) return -EFAULT;
+        dst[i] = (char)c;
+        if (!c) return (long)i;
+    }
+    return -ENAMETOOLONG;
+}
+
+char *getname(uint64_t upath) {
+    if (!upath) return NULL;
+    char *name = kmalloc(PATH_MAX);
+    if (!name) return NULL;
+    if (strncpy_from_user(name, (const char*)upath, PATH_MAX) < 0) {
+        kfree(name);
+        return NULL;
+    }
+    return name;
+}
+
+int user_buffer_ok(const void *ptr, size_t n, int write) {
+    if (!access_ok(ptr, n)) return 0;
+    if (n == 0) return 1;
+
+    uint64_t need = PTE_PRESENT | PTE_USER | (write ? PTE_RW : 0);
+    uint64_t cr3 = vmm_get_cr3();
+    uint64_t page = (uint64_t)ptr & ~0xFFFULL;
+    uint64_t end = (uint64_t)ptr + n;
+    for (; page < end; page += 0x1000) {
+        if ((vmm_get_pte(cr3, page) & need) == need) continue;
+        // Not faulted in yet, e.g. a file mapping
+        if (vma_fault(page, write ? PF_WRITE : 0) != 0) return 0;
+    }
+    return 1;
+}
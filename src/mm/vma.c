@@ -0,0 +1,465 @@
+#include <mm/vma.h>
+#include <mm/liballoc.h>
+#include <kernel/vfs/vfs.h>
+#include <libk/string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static inline uint64_t max_u64(uint64_t a, uint64_t b) {
+    return a > b ? a : b;
+}
+
+// Recompute the cached subtree bounds of n from its children
+static void vma_update(vma_t *n) {
+    uint64_t gap = 0;
+    n->sub_start = n->left ? n->left->sub_start : n->start;
+    n->sub_end = n->right ? n->right->sub_end : n->end;
+    if (n->left)
+        gap = max_u64(n->left->sub_gap, n->start - n->left->sub_end);
+    if (n->right)
+        gap = max_u64(gap, max_u64(n->right->sub_gap, n->right->sub_start - n->end));
+    n->sub_gap = gap;
+}
+
+// After n's range or children changed
+static void vma_propagate(vma_t *n) {
+    for (; n; n = n->parent)
+        vma_update(n);
+}
+
+static void replace_child(vma_tree_t *tree, vma_t *parent, vma_t *old, vma_t *new) {
+    if (!parent)
+        tree->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static void rotate_left(vma_tree_t *tree, vma_t *x) {
+    vma_t *y = x->right;
+    x->right = y->left;
+    if (y->left) y->left->parent = x;
+    y->parent = x->parent;
+    replace_child(tree, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+    vma_update(x);
+    vma_update(y);
+}
+
+static void rotate_right(vma_tree_t *tree, vma_t *x) {
+    vma_t *y = x->left;
+    x->left = y->right;
+    if (y->right) y->right->parent = x;
+    y->parent = x->parent;
+    replace_child(tree, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+    vma_update(x);
+    vma_update(y);
+}
+
+// Link n in; the caller guarantees it overlaps nothing already there
+static void tree_insert(vma_tree_t *tree, vma_t *n) {
+    vma_t *parent = NULL;
+    vma_t **link = &tree->root;
+    while (*link) {
+        parent = *link;
+        link = n->start < parent->start ? &parent->left : &parent->right;
+    }
+    n->parent = parent;
+    n->left = n->right = NULL;
+    n->red = 1;
+    *link = n;
+    vma_propagate(n);
+
+    while (n->parent && n->parent->red) {
+        vma_t *p = n->parent;
+        vma_t *g = p->parent;   // A red node is never the root
+        if (p == g->left) {
+            vma_t *u = g->right;
+            if (u && u->red) {
+                p->red = u->red = 0;
+                g->red = 1;
+                n = g;
+                continue;
+            }
+            if (n == p->right) {
+                rotate_left(tree, p);
+                p = n;
+            }
+            p->red = 0;
+            g->red = 1;
+            rotate_right(tree, g);
+            break;
+        } else {
+            vma_t *u = g->left;
+            if (u && u->red) {
+                p->red = u->red = 0;
+                g->red = 1;
+                n = g;
+                continue;
+            }
+            if (n == p->left) {
+                rotate_right(tree, p);
+                p = n;
+            }
+            p->red = 0;
+            g->red = 1;
+            rotate_left(tree, g);
+            break;
+        }
+    }
+    tree->root->red = 0;
+    tree->count++;
+}
+
+static inline int is_black(vma_t *n) {
+    return !n || !n->red;
+}
+
+// x took the place of a removed black node under parent xp (x may be NULL)
+static void erase_fixup(vma_tree_t *tree, vma_t *x, vma_t *xp) {
+    while (x != tree->root && is_black(x)) {
+        if (x == xp->left) {
+            vma_t *w = xp->right;
+            if (w->red) {
+                w->red = 0;
+                xp->red = 1;
+                rotate_left(tree, xp);
+                w = xp->right;
+            }
+            if (is_black(w->left) && is_black(w->right)) {
+                w->red = 1;
+                x = xp;
+                xp = x->parent;
+                continue;
+            }
+            if (is_black(w->right)) {
+                w->left->red = 0;
+                w->red = 1;
+                rotate_right(tree, w);
+                w = xp->right;
+            }
+            w->red = xp->red;
+            xp->red = 0;
+            w->right->red = 0;
+            rotate_left(tree, xp);
+        } else {
+            vma_t *w = xp->left;
+            if (w->red) {
+                w->red = 0;
+                xp->red = 1;
+                rotate_right(tree, xp);
+                w = xp->left;
+            }
+            if (is_black(w->left) && is_black(w->right)) {
+                w->red = 1;
+                x = xp;
+                xp = x->parent;
+                continue;
+            }
+            if (is_black(w->left)) {
+                w->right->red = 0;
+                w->red = 1;
+                rotate_left(tree, w);
+                w = xp->left;
+            }
+            w->red = xp->red;
+            xp->red = 0;
+            w->left->red = 0;
+            rotate_right(tree, xp);
+        }
+        x = tree->root;
+    }
+    if (x) x->red = 0;
+}
+
+// Unlink z. Nodes are relinked, never copied, so pointers to the other
+// areas stay valid.
+static void tree_erase(vma_tree_t *tree, vma_t *z) {
+    vma_t *x, *xp;
+    int removed_red = z->red;
+
+    if (!z->left || !z->right) {
+        x = z->left ? z->left : z->right;
+        xp = z->parent;
+        if (x) x->parent = xp;
+        replace_child(tree, xp, z, x);
+    } else {
+        vma_t *y = z->right;
+        while (y->left) y = y->left;
+        removed_red = y->red;
+        x = y->right;
+        if (y->parent == z) {
+            xp = y;
+        } else {
+            xp = y->parent;
+            xp->left = x;
+            if (x) x->parent = xp;
+            y->right = z->right;
+            y->right->parent = y;
+        }
+        y->parent = z->parent;
+        replace_child(tree, z->parent, z, y);
+        y->left = z->left;
+        y->left->parent = y;
+        y->red = z->red;
+    }
+
+    vma_propagate(xp);
+    if (!removed_red)
+        erase_fixup(tree, x, xp);
+    tree->count--;
+}
+
+vma_t *vma_lookup(vma_tree_t *tree, uint64_t addr) {
+    vma_t *n = tree->root;
+    while (n) {
+        if (addr < n->start)
+            n = n->left;
+        else if (addr >= n->end)
+            n = n->right;
+        else
+            return n;
+    }
+    return NULL;
+}
+
+vma_t *vma_find(vma_tree_t *tree, uint64_t addr) {
+    vma_t *n = tree->root;
+    vma_t *best = NULL;
+    while (n) {
+        if (n->end > addr) {
+            best = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return best;
+}
+
+vma_t *vma_next(vma_t *vma) {
+    if (vma->right) {
+        vma = vma->right;
+        while (vma->left) vma = vma->left;
+        return vma;
+    }
+    while (vma->parent && vma == vma->parent->right)
+        vma = vma->parent;
+    return vma->parent;
+}
+
+int vma_range_free(vma_tree_t *tree, uint64_t start, uint64_t end) {
+    vma_t *v = vma_find(tree, start);
+    return !v || v->start >= end;
+}
+
+// Fit inside the hole [hole_start, hole_end), clipped to [lo, hi)
+static uint64_t gap_fit(uint64_t hole_start, uint64_t hole_end, uint64_t size,
+                        uint64_t align, uint64_t lo, uint64_t hi) {
+    if (hole_start < lo) hole_start = lo;
+    if (hole_end > hi) hole_end = hi;
+    hole_start = (hole_start + align - 1) & ~(align - 1);
+    if (hole_start >= hole_end || hole_end - hole_start < size)
+        return 0;
+    return hole_start;
+}
+
+// n's subtree covers the hole-and-area run between prev_end (end of the
+// area before it) and next_start (start of the one after it)
+static uint64_t gap_search(vma_t *n, uint64_t prev_end, uint64_t next_start,
+                           uint64_t size, uint64_t align, uint64_t lo, uint64_t hi) {
+    if (!n)
+        return gap_fit(prev_end, next_start, size, align, lo, hi);
+    if (next_start <= lo || prev_end >= hi)
+        return 0;
+
+    uint64_t widest = max_u64(n->sub_gap, max_u64(n->sub_start - prev_end,
+                                                  next_start - n->sub_end));
+    if (widest < size)
+        return 0;
+
+    uint64_t addr = gap_search(n->left, prev_end, n->start, size, align, lo, hi);
+    if (addr)
+        return addr;
+    return gap_search(n->right, n->end, next_start, size, align, lo, hi);
+}
+
+uint64_t vma_find_gap(vma_tree_t *tree, uint64_t size, uint64_t align,
+                      uint64_t lo, uint64_t hi) {
+    if (!size || lo >= hi)
+        return 0;
+    return gap_search(tree->root, 0, ~0ULL, size, align, lo, hi);
+}
+
+// Every area backed by a file pins its inode, see vfs_unlink
+static inline void vma_get_file(vma_t *v) {
+    if (v->file)
+        v->file->map_count++;
+}
+
+static void vma_free(vma_t *v) {
+    if (v->file)
+        v->file->map_count--;
+    kfree(v);
+}
+
+// Split v at addr (strictly inside it); v keeps the lower half
+static vma_t *vma_split(vma_tree_t *tree, vma_t *v, uint64_t addr) {
+    vma_t *tail = kmalloc(sizeof(vma_t));
+    if (!tail)
+        return NULL;
+    *tail = *v;
+    vma_get_file(tail);
+    tail->start = addr;
+    if (tail->file)
+        tail->offset += addr - v->start;
+    v->end = addr;
+    vma_propagate(v);
+    tree_insert(tree, tail);
+    return tail;
+}
+
+static int vma_mergeable(vma_t *a, vma_t *b) {
+    if (a->end != b->start || a->prot != b->prot || a->flags != b->flags || a->file != b->file)
+        return 0;
+    return !a->file || a->offset + (a->end - a->start) == b->offset;
+}
+
+// Fold next into v when they describe one contiguous area
+static void vma_try_merge(vma_tree_t *tree, vma_t *v) {
+    vma_t *next = v ? vma_next(v) : NULL;
+    if (!next || !vma_mergeable(v, next))
+        return;
+    uint64_t end = next->end;
+    tree_erase(tree, next);
+    vma_free(next);
+    v->end = end;
+    vma_propagate(v);
+}
+
+int vma_unmap(vma_tree_t *tree, uint64_t start, uint64_t end) {
+    vma_t *v = vma_find(tree, start);
+    while (v && v->start < end) {
+        if (v->start < start && v->end > end) {
+            // A hole punched in the middle leaves two areas
+            if (!vma_split(tree, v, end))
+                return -1;
+            v->end = start;
+            vma_propagate(v);
+            return 0;
+        }
+
+        vma_t *next = vma_next(v);
+        if (v->start < start) {
+            v->end = start;
+            vma_propagate(v);
+        } else if (v->end > end) {
+            if (v->file)
+                v->offset += end - v->start;
+            v->start = end;
+            vma_propagate(v);
+        } else {
+            tree_erase(tree, v);
+            vma_free(v);
+        }
+        v = next;
+    }
+    return 0;
+}
+
+int vma_map(vma_tree_t *tree, uint64_t start, uint64_t end, uint32_t prot,
+            uint32_t flags, struct inode *file, uint64_t offset) {
+    if (vma_unmap(tree, start, end) != 0)
+        return -1;
+
+    vma_t *v = kmalloc(sizeof(vma_t));
+    if (!v)
+        return -1;
+    memset(v, 0, sizeof(vma_t));
+    v->start = start;
+    v->end = end;
+    v->prot = prot;
+    v->flags = flags;
+    v->file = file;
+    v->offset = offset;
+    vma_get_file(v);
+    tree_insert(tree, v);
+
+    vma_t *prev = start ? vma_lookup(tree, start - 1) : NULL;
+    vma_try_merge(tree, v);
+    vma_try_merge(tree, prev);
+    return 0;
+}
+
+int vma_range_mapped(vma_tree_t *tree, uint64_t start, uint64_t end) {
+    uint64_t pos = start;
+    for (vma_t *v = vma_find(tree, start); pos < end; v = vma_next(v)) {
+        if (!v || v->start > pos)
+            return 0;
+        pos = v->end;
+    }
+    return 1;
+}
+
+int vma_protect(vma_tree_t *tree, uint64_t start, uint64_t end, uint32_t prot) {
+    if (!vma_range_mapped(tree, start, end))
+        return -1;
+
+    vma_t *first = vma_lookup(tree, start);
+    if (first->start < start) {
+        first = vma_split(tree, first, start);
+        if (!first) return -1;
+    }
+    vma_t *last = vma_lookup(tree, end - 1);
+    if (last->end > end && !vma_split(tree, last, end))
+        return -1;
+
+    vma_t *prev = start ? vma_lookup(tree, start - 1) : NULL;
+    for (vma_t *v = first; v && v->start < end; v = vma_next(v))
+        v->prot = prot;
+
+    // Fold the changed run together and into its neighbours
+    vma_t *v = prev ? prev : first;
+    while (v && v->start < end) {
+        vma_t *next = vma_next(v);
+        if (next && vma_mergeable(v, next))
+            vma_try_merge(tree, v);
+        else
+            v = next;
+    }
+    return 0;
+}
+
+int vma_clone(vma_tree_t *dst, vma_tree_t *src) {
+    vma_t *v = vma_find(src, 0);
+    for (; v; v = vma_next(v)) {
+        vma_t *copy = kmalloc(sizeof(vma_t));
+        if (!copy) {
+            vma_destroy(dst);
+            return -1;
+        }
+        *copy = *v;
+        vma_get_file(copy);
+        tree_insert(dst, copy);
+    }
+    return 0;
+}
+
+static void free_subtree(vma_t *n) {
+    while (n) {
+        vma_t *right = n->right;
+        free_subtree(n->left);
+        vma_free(n);
+        n = right;
+    }
+}
+
+void vma_destroy(vma_tree_t *tree) {
+    free_subtree(tree->root);
+    tree->root = NULL;
+    tree->count = 0;
+}
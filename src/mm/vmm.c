@@ -1,9 +1,12 @@
 #include <mm/vmm.h>
 #include <mm/pmm.h>
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/smp.h>
 #include <libk/stdio.h>
 #include <libk/utils.h>
 #include <stdint.h>
 #include <libk/string.h>
+#include <libk/spinlock.h>
 
 static inline uint64_t read_cr3(void) {
     uint64_t v;
@@ -21,8 +24,211 @@ static inline void invlpg(void *addr) {
 
 static uint64_t kernel_cr3 = 0;
 
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PGE     (1ULL << 7)
+#define CR4_PCIDE   (1ULL << 17)
+#define CPUID_PCID  (1U << 17)    // CPUID.1:ECX
+#define KERNEL_HALF 0xFFFF800000000000ULL
+
+static inline uint64_t read_cr4(void) {
+    uint64_t v;
+    asm volatile("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint64_t v) {
+    asm volatile("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+// PCID 0 belongs to the kernel page table, and to any user page table
+// created once the other 4095 are taken; switching to those always flushes
+static int pcid_enabled = 0;
+static uint64_t pcid_used[PCID_COUNT / 64] = { 1 };
+static spinlock_t pcid_lock;
+
+static void pcid_set_stale(cpu_t *cpu, uint16_t pcid) {
+    __atomic_fetch_or(&cpu->pcid_stale[pcid / 64], 1ULL << (pcid % 64), __ATOMIC_SEQ_CST);
+}
+
+static uint16_t pcid_alloc(void) {
+    if (!pcid_enabled)
+        return 0;
+
+    uint16_t pcid = 0;
+    spinlock_acquire(&pcid_lock);
+    for (size_t i = 0; i < PCID_COUNT / 64 && !pcid; i++) {
+        if (pcid_used[i] == ~0ULL) continue;
+        uint16_t bit = (uint16_t)__builtin_ctzll(~pcid_used[i]);
+        pcid_used[i] |= 1ULL << bit;
+        pcid = (uint16_t)(i * 64 + bit);
+    }
+    spinlock_release(&pcid_lock);
+
+    // A recycled PCID may still tag the previous owner's entries anywhere
+    for (uint32_t i = 0; pcid && i < cpu_count; i++)
+        pcid_set_stale(&cpus[i], pcid);
+    return pcid;
+}
+
+static void pcid_free(uint16_t pcid) {
+    if (!pcid) return;
+    spinlock_acquire(&pcid_lock);
+    pcid_used[pcid / 64] &= ~(1ULL << (pcid % 64));
+    spinlock_release(&pcid_lock);
+}
+
+void vmm_pcid_mark_stale(uint64_t cr3_phys) {
+    uint16_t pcid = cr3_phys & 0xFFF;
+    if (!pcid_enabled || !pcid) return;
+
+    cpu_t *self = this_cpu();
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t *cpu = &cpus[i];
+        // The caller already invalidated this CPU's live entries
+        if (cpu == self && cpu->active_cr3 == cr3_phys) continue;
+        pcid_set_stale(cpu, pcid);
+    }
+}
+
+// Set the global bit on every leaf of the shared kernel half, so those
+// translations survive address space switches
+static void mark_kernel_global(void) {
+    uint64_t *pml4 = (uint64_t *)virt_from_phys((void *)(kernel_cr3 & 0x000ffffffffff000ULL));
+    for (size_t i4 = 256; i4 < 512; i4++) {
+        if (!(pml4[i4] & PTE_PRESENT)) continue;
+        uint64_t *pdpt = (uint64_t *)virt_from_phys((void *)(pml4[i4] & 0x000ffffffffff000ULL));
+        for (size_t i3 = 0; i3 < 512; i3++) {
+            if (!(pdpt[i3] & PTE_PRESENT)) continue;
+            if (pdpt[i3] & PTE_PSE) { pdpt[i3] |= PTE_GLOBAL; continue; }
+            uint64_t *pd = (uint64_t *)virt_from_phys((void *)(pdpt[i3] & 0x000ffffffffff000ULL));
+            for (size_t i2 = 0; i2 < 512; i2++) {
+                if (!(pd[i2] & PTE_PRESENT)) continue;
+                if (pd[i2] & PTE_PSE) { pd[i2] |= PTE_GLOBAL; continue; }
+                uint64_t *pt = (uint64_t *)virt_from_phys((void *)(pd[i2] & 0x000ffffffffff000ULL));
+                for (size_t i1 = 0; i1 < 512; i1++) {
+                    if (pt[i1] & PTE_PRESENT)
+                        pt[i1] |= PTE_GLOBAL;
+                }
+            }
+        }
+    }
+}
+
+// WB, WT, UC-, UC, WP, WC, UC-, UC: the layout Limine boots with, set
+// again so every CPU agrees on entry 5 (PTE_WC) whatever the firmware did
+#define PAT_LAYOUT 0x0007010500070406ULL
+
+void vmm_init_cpu(void) {
+    wrmsr(MSR_PAT, PAT_LAYOUT);
+    uint64_t cr4 = read_cr4() | CR4_PGE;
+    if (pcid_enabled)
+        cr4 |= CR4_PCIDE;
+    write_cr4(cr4);
+}
+
+// Leaf flags for a new mapping, kernel ones are global
+static uint64_t leaf_flags(uint64_t v, uint64_t flags) {
+    if (!flags)
+        flags = PTE_PRESENT | PTE_RW;
+    if (v >= KERNEL_HALF)
+        flags |= PTE_GLOBAL;
+    return flags;
+}
+
+// Device memory is not covered by the HHDM, it gets its own window in the
+// last GiB of the address space (above the kernel image).
+#define VMM_MMIO_BASE 0xFFFFFFFFC0000000ULL
+static uint64_t mmio_next = VMM_MMIO_BASE;
+
+/*
+ * Every PML4 slot of the higher half points at a PDPT from boot on, so
+ * later kernel mappings only ever touch tables below the PML4 and every
+ * user PML4 can share the kernel half by copying it once at creation.
+ */
+static int populate_kernel_pdpts(void) {
+    uint64_t *pml4 = (uint64_t *)virt_from_phys((void *)(kernel_cr3 & 0x000ffffffffff000ULL));
+    int added = 0;
+    for (size_t i = 256; i < 512; i++) {
+        if (pml4[i] & PTE_PRESENT) continue;
+        void *pdpt = pcalloc(1);
+        if (!pdpt) return -1;
+        pml4[i] = (uint64_t)phys_from_virt(pdpt) | PTE_PRESENT | PTE_RW;
+        added++;
+    }
+    return added;
+}
+
+/*
+ * User PML4s (two pages, see vmm_create_user_page_table) are recycled
+ * through a small pool. A pooled PML4 has its user half and stats page
+ * zeroed and the kernel half, which never changes, already in place.
+ */
+#define PML4_POOL_SIZE 32
+#define PML4_POOL_PREFILL 8
+
+static uint64_t *pml4_pool[PML4_POOL_SIZE];
+static size_t pml4_pool_count;
+static spinlock_t pml4_pool_lock;
+
+static uint64_t *pml4_fresh(void) {
+    uint64_t *pml4 = pmalloc(2);
+    if (!pml4) return NULL;
+    uint64_t *kernel_pml4 = (uint64_t *)virt_from_phys((void *)(kernel_cr3 & 0x000ffffffffff000ULL));
+    memset(pml4, 0, 256 * sizeof(uint64_t));
+    memcpy(pml4 + 256, kernel_pml4 + 256, 256 * sizeof(uint64_t));
+    memset(pml4 + 512, 0, 4096);
+    return pml4;
+}
+
+static uint64_t *pml4_get(void) {
+    uint64_t *pml4 = NULL;
+    spinlock_acquire(&pml4_pool_lock);
+    if (pml4_pool_count)
+        pml4 = pml4_pool[--pml4_pool_count];
+    spinlock_release(&pml4_pool_lock);
+    return pml4 ? pml4 : pml4_fresh();
+}
+
+// The user half must already be clear
+static void pml4_put(uint64_t *pml4) {
+    memset(pml4 + 512, 0, 4096);
+    spinlock_acquire(&pml4_pool_lock);
+    if (pml4_pool_count < PML4_POOL_SIZE) {
+        pml4_pool[pml4_pool_count++] = pml4;
+        pml4 = NULL;
+    }
+    spinlock_release(&pml4_pool_lock);
+    if (pml4)
+        pmm_free_pages(pml4, 2);
+}
+
 int init_vmm() {
     kernel_cr3 = read_cr3();
+    this_cpu()->active_cr3 = kernel_cr3;
+
+    int added = populate_kernel_pdpts();
+    if (added < 0) {
+        log("VMM", ERROR, "out of memory populating kernel PDPTs\n\r");
+        return -1;
+    }
+    spinlock_init(&pml4_pool_lock);
+    for (int i = 0; i < PML4_POOL_PREFILL; i++) {
+        uint64_t *pml4 = pml4_fresh();
+        if (!pml4) break;
+        pml4_pool[pml4_pool_count++] = pml4;
+    }
+    log("VMM", INFO, "%d kernel PDPTs preallocated, %d PML4s pooled\n\r",
+        added, (int)pml4_pool_count);
+
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    pcid_enabled = (c & CPUID_PCID) != 0;
+    mark_kernel_global();
+    // Toggling PGE flushes everything, including the entries cached before
+    // the global bits were set
+    write_cr4(read_cr4() & ~CR4_PGE);
+    vmm_init_cpu();
+    log("VMM", INFO, "global kernel pages, PCID %s\n\r", pcid_enabled ? "enabled" : "unsupported");
     log("VMM",INFO, "initialized, kernel CR3 = 0x%xl\n\r", kernel_cr3);
     return 0;
 }
@@ -31,11 +237,131 @@ uint64_t vmm_get_cr3(void) {
     return read_cr3();
 }
 
+uint64_t vmm_get_kernel_cr3(void) {
+    return kernel_cr3;
+}
+
 void vmm_switch_page_table(uint64_t cr3_phys) {
+    cpu_t *cpu = this_cpu();
+    // Published before the stale bits are read, pairs with
+    // smp_tlb_shootdown marking them before it reads active_cr3
+    __atomic_store_n(&cpu->active_cr3, cr3_phys, __ATOMIC_SEQ_CST);
+
+    if (pcid_enabled) {
+        uint16_t pcid = cr3_phys & 0xFFF;
+        uint64_t bit = 1ULL << (pcid % 64);
+        uint64_t was = __atomic_fetch_and(&cpu->pcid_stale[pcid / 64], ~bit, __ATOMIC_SEQ_CST);
+        if (!(was & bit) && (pcid || cr3_phys == kernel_cr3))
+            cr3_phys |= CR3_NOFLUSH;
+    }
     write_cr3(cr3_phys);
 }
 
-static uint64_t *ensure_table(uint64_t *table_entry, uint64_t flags) {
+// Drop stale translations on this CPU only; large ranges reload CR3, or
+// toggle PGE for kernel ranges since their entries are global
+void vmm_flush_tlb_local(uint64_t addr, size_t pages) {
+    if (pages > 32) {
+        if (addr >= KERNEL_HALF) {
+            uint64_t cr4 = read_cr4();
+            write_cr4(cr4 & ~CR4_PGE);
+            write_cr4(cr4);
+        } else {
+            write_cr3(read_cr3());
+        }
+        return;
+    }
+    for (size_t i = 0; i < pages; i++)
+        invlpg((void *)(addr + i * 4096));
+}
+
+#define HUGE_PHYS_MASK 0x000fffffffe00000ULL
+#define GIANT_PHYS_MASK 0x000fffffc0000000ULL
+
+/*
+ * User page tables are reference counted: the entry pointing at a PDPT, PD
+ * or PT keeps the number of present entries of that table in bits 52-61,
+ * which the MMU ignores in non-leaf entries, so a table left empty is
+ * noticed and freed without scanning it. The kernel half is not counted,
+ * its tables are shared by every address space (and partly built by the
+ * bootloader) and are never given back.
+ */
+#define PT_COUNT_SHIFT 52
+#define PT_COUNT_MASK  (0x3FFULL << PT_COUNT_SHIFT)
+
+static inline size_t pt_count(uint64_t entry) {
+    return (entry & PT_COUNT_MASK) >> PT_COUNT_SHIFT;
+}
+
+static inline void pt_count_add(uint64_t *entry, int delta) {
+    if (entry)
+        *entry += (uint64_t)(int64_t)delta << PT_COUNT_SHIFT;
+}
+
+// Counters of the address space va belongs to, NULL where nothing is
+// counted. They live in the page after the PML4 of a user page table.
+static vmm_stats_t *space_stats(uint64_t cr3_phys, uint64_t va) {
+    uint64_t pml4_phys = cr3_phys & 0x000ffffffffff000ULL;
+    if (va >= KERNEL_HALF || pml4_phys == (kernel_cr3 & 0x000ffffffffff000ULL))
+        return NULL;
+    return (vmm_stats_t *)((uint8_t *)virt_from_phys((void *)pml4_phys) + 4096);
+}
+
+// A leaf covering `pages` pages was added to (delta 1) or removed from
+// (delta -1) the table `owner` points at
+static void account_leaf(vmm_stats_t *st, uint64_t *owner, int delta, size_t pages) {
+    if (!st) return;
+    pt_count_add(owner, delta);
+    st->rss_pages += (uint64_t)((int64_t)delta * (int64_t)pages);
+}
+
+// Flags of a large-page entry as they read on a 4 KiB PTE
+static uint64_t large_to_small_flags(uint64_t e) {
+    uint64_t flags = (e & 0xFFFULL & ~PTE_PSE) | (e & PTE_NX);
+    if (e & PTE_PAT_LARGE)
+        flags |= PTE_PAT;
+    return flags;
+}
+
+// Replace a large-page entry (level 2: 2 MiB, level 3: 1 GiB) by a table
+// mapping the same frames one size down, so part of it can be changed.
+// The caller invalidates the TLB when it modifies the new table.
+static uint64_t *split_large(uint64_t *entry, int level, vmm_stats_t *st) {
+    uint64_t *table = pmalloc(1);
+    if (!table)
+        return NULL;
+
+    uint64_t e = *entry;
+    uint64_t base, step, flags;
+    if (level == 3) {
+        base = e & GIANT_PHYS_MASK;
+        step = HUGE_PAGE_SIZE;
+        flags = e & ~GIANT_PHYS_MASK;
+    } else {
+        base = e & HUGE_PHYS_MASK;
+        step = 4096;
+        flags = large_to_small_flags(e);
+    }
+    for (size_t i = 0; i < 512; i++)
+        table[i] = (base + i * step) | flags;
+
+    // NX stays on the leaves, the table entry must not restrict them
+    *entry = ((uint64_t)phys_from_virt(table) & 0x000ffffffffff000ULL) |
+             (e & (PTE_PRESENT | PTE_RW | PTE_USER));
+    if (st) {
+        pt_count_add(entry, 512);
+        st->pt_pages++;
+    }
+    return table;
+}
+
+// Table *table_entry points at, created if missing. `owner` is the entry
+// pointing at the table that holds table_entry (NULL for a PML4 entry).
+static uint64_t *ensure_table(uint64_t *table_entry, uint64_t *owner, vmm_stats_t *st,
+                              uint64_t flags, int level) {
+    if (((*table_entry) & PTE_PRESENT) && ((*table_entry) & PTE_PSE) && level < 4) {
+        if (!split_large(table_entry, level, st))
+            return NULL;
+    }
     if ((*table_entry) & PTE_PRESENT) {
         if (flags & PTE_USER)
             *table_entry |= PTE_USER;
@@ -43,22 +369,96 @@ static uint64_t *ensure_table(uint64_t *table_entry, uint64_t flags) {
         return (uint64_t *)virt_from_phys((void *)phys);
     }
 
-    void *virt = pmalloc(1);
+    void *virt = pcalloc(1);
     if (!virt)
         return NULL;
 
-    for (size_t i = 0; i < 512; i++)
-        ((uint64_t *)virt)[i] = 0ULL;
-
     void *phys = phys_from_virt(virt);
     uint64_t entry_flags = PTE_PRESENT | PTE_RW;
     if (flags & PTE_USER)
         entry_flags |= PTE_USER;
 
     *table_entry = ((uint64_t)(uintptr_t)phys & 0x000ffffffffff000ULL) | entry_flags;
+    if (st) {
+        pt_count_add(owner, 1);
+        st->pt_pages++;
+    }
     return (uint64_t *)virt;
 }
 
+/*
+ * Unmapping collects its invalidations in a tlb_gather_t and issues them
+ * as a single local flush plus one shootdown at the end, or whenever the
+ * batch of frames waiting to be freed fills up. Frames (page-table pages
+ * included) are only returned to the PMM after the flush, so no CPU can
+ * still reach them through a stale translation.
+ */
+#define TLB_GATHER_FRAMES 32
+
+typedef struct {
+    uint64_t cr3;
+    uint64_t start, end;       // Range needing invalidation, empty if equal
+    size_t nr_frames;
+    struct {
+        void *virt;
+        size_t pages;
+    } frames[TLB_GATHER_FRAMES];
+} tlb_gather_t;
+
+static void gather_flush(tlb_gather_t *g) {
+    if (g->end > g->start) {
+        size_t pages = (g->end - g->start) / 4096;
+        if ((read_cr3() & 0x000ffffffffff000ULL) == (g->cr3 & 0x000ffffffffff000ULL))
+            vmm_flush_tlb_local(g->start, pages);
+        smp_tlb_shootdown(g->cr3, g->start, pages);
+    }
+    for (size_t i = 0; i < g->nr_frames; i++)
+        pmm_free_pages(g->frames[i].virt, g->frames[i].pages);
+    g->start = g->end = 0;
+    g->nr_frames = 0;
+}
+
+static void gather_range(tlb_gather_t *g, uint64_t va, uint64_t size) {
+    if (g->end == g->start) {
+        g->start = va;
+        g->end = va + size;
+        return;
+    }
+    if (va < g->start) g->start = va;
+    if (va + size > g->end) g->end = va + size;
+}
+
+static void gather_frame(tlb_gather_t *g, uint64_t phys, size_t pages) {
+    if (g->nr_frames == TLB_GATHER_FRAMES)
+        gather_flush(g);
+    g->frames[g->nr_frames].virt = virt_from_phys((void *)phys);
+    g->frames[g->nr_frames].pages = pages;
+    g->nr_frames++;
+}
+
+// Page-table page being dropped: the range entry makes sure the flush that
+// precedes its release also clears paging-structure caches pointing at it
+static void gather_table(tlb_gather_t *g, uint64_t va, void *table) {
+    gather_frame(g, (uint64_t)phys_from_virt(table), 1);
+    gather_range(g, va & ~0xFFFULL, 4096);
+}
+
+// Free the tables left empty after a leaf was removed at va. path[k] is
+// the entry pointing at the table k levels below the PML4 (PDPT, PD, PT);
+// the table path[depth - 1] points at is the one that lost the leaf.
+static void reclaim_tables(tlb_gather_t *g, vmm_stats_t *st, uint64_t va,
+                           uint64_t **path, int depth) {
+    if (!st) return;
+    for (int k = depth - 1; k >= 0 && pt_count(*path[k]) == 0; k--) {
+        void *table = virt_from_phys((void *)(*path[k] & 0x000ffffffffff000ULL));
+        *path[k] = 0;
+        if (k > 0)
+            pt_count_add(path[k - 1], -1);
+        st->pt_pages--;
+        gather_table(g, va, table);
+    }
+}
+
 int vmm_map_page(void *virt, void *phys, uint64_t flags) {
     if (!virt || !phys)
         return -1;
@@ -74,28 +474,67 @@ int vmm_map_page(void *virt, void *phys, uint64_t flags) {
     size_t i2 = (v >> 21) & 0x1FF;
     size_t i1 = (v >> 12) & 0x1FF;
 
-    uint64_t *pdpt = ensure_table(&pml4[i4], flags);
+    vmm_stats_t *st = space_stats(cr3, v);
+    uint64_t *pdpt = ensure_table(&pml4[i4], NULL, st, flags, 4);
     if (!pdpt) return -1;
-    uint64_t *pd = ensure_table(&pdpt[i3], flags);
+    uint64_t *pd = ensure_table(&pdpt[i3], &pml4[i4], st, flags, 3);
     if (!pd) return -1;
-    uint64_t *pt = ensure_table(&pd[i2], flags);
+    uint64_t *pt = ensure_table(&pd[i2], &pdpt[i3], st, flags, 2);
     if (!pt) return -1;
 
-    pt[i1] = (p & 0x000ffffffffff000ULL) | (flags ? flags : (PTE_PRESENT | PTE_RW));
+    uint64_t old = pt[i1];
+    pt[i1] = (p & 0x000ffffffffff000ULL) | leaf_flags(v, flags);
+    if (!(old & PTE_PRESENT))
+        account_leaf(st, &pd[i2], 1, 1);
     invlpg(virt);
+    // Kernel mappings are shared by every CPU, replacing one needs a shootdown
+    if ((old & PTE_PRESENT) && v >= 0xFFFF800000000000ULL)
+        smp_tlb_shootdown(0, v & ~0xFFFULL, 1);
     return 0;
 }
 
-int vmm_map_range(void *virt, void *phys, size_t pages, uint64_t flags) {
-    for (size_t i = 0; i < pages; i++) {
-        void *v = (void *)((uintptr_t)virt + i * 4096);
-        void *p = (void *)((uintptr_t)phys + i * 4096);
-        if (vmm_map_page(v, p, flags) != 0)
+int vmm_map_range_in(uint64_t cr3_phys, void *virt, void *phys, size_t pages, uint64_t flags) {
+    uint64_t v = (uint64_t)virt;
+    uint64_t p = (uint64_t)phys;
+    size_t i = 0;
+
+    while (i < pages) {
+        if (((v | p) & (HUGE_PAGE_SIZE - 1)) == 0 && pages - i >= HUGE_PAGE_PAGES &&
+            vmm_map_huge_in(cr3_phys, (void *)v, (void *)p, flags) == 0) {
+            v += HUGE_PAGE_SIZE;
+            p += HUGE_PAGE_SIZE;
+            i += HUGE_PAGE_PAGES;
+            continue;
+        }
+        if (vmm_map_page_in(cr3_phys, (void *)v, (void *)p, flags) != 0)
             return -1;
+        v += 4096;
+        p += 4096;
+        i++;
     }
     return 0;
 }
 
+int vmm_map_range(void *virt, void *phys, size_t pages, uint64_t flags) {
+    return vmm_map_range_in(read_cr3(), virt, phys, pages, flags);
+}
+
+void *vmm_map_mmio(uint64_t phys, size_t size, uint64_t flags) {
+    uint64_t offset = phys & 0xFFF;
+    size_t pages = (offset + size + 4095) / 4096;
+
+    // Large aligned apertures (framebuffers) get 2 MiB pages
+    if (pages >= HUGE_PAGE_PAGES && (phys & (HUGE_PAGE_SIZE - 1)) == 0)
+        mmio_next = (mmio_next + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    uint64_t virt = mmio_next;
+
+    if (vmm_map_range((void *)virt, (void *)(phys & ~0xFFFULL), pages,
+                      PTE_PRESENT | PTE_RW | flags) != 0)
+        return NULL;
+    mmio_next += pages * 4096;
+    return (void *)(virt + offset);
+}
+
 int vmm_map_page_in(uint64_t cr3_phys, void *virt, void *phys, uint64_t flags) {
     if (!virt || !phys)
         return -1;
@@ -110,21 +549,108 @@ int vmm_map_page_in(uint64_t cr3_phys, void *virt, void *phys, uint64_t flags) {
     size_t i2 = (v >> 21) & 0x1FF;
     size_t i1 = (v >> 12) & 0x1FF;
 
-    uint64_t *pdpt = ensure_table(&pml4[i4], flags);
+    vmm_stats_t *st = space_stats(cr3_phys, v);
+    uint64_t *pdpt = ensure_table(&pml4[i4], NULL, st, flags, 4);
     if (!pdpt) return -1;
-    uint64_t *pd = ensure_table(&pdpt[i3], flags);
+    uint64_t *pd = ensure_table(&pdpt[i3], &pml4[i4], st, flags, 3);
     if (!pd) return -1;
-    uint64_t *pt = ensure_table(&pd[i2], flags);
+    uint64_t *pt = ensure_table(&pd[i2], &pdpt[i3], st, flags, 2);
     if (!pt) return -1;
 
-    pt[i1] = (p & 0x000ffffffffff000ULL) | (flags ? flags : (PTE_PRESENT | PTE_RW));
+    uint64_t old = pt[i1];
+    pt[i1] = (p & 0x000ffffffffff000ULL) | leaf_flags(v, flags);
+    if (!(old & PTE_PRESENT))
+        account_leaf(st, &pd[i2], 1, 1);
 
     if ((read_cr3() & 0x000ffffffffff000ULL) == pml4_phys)
         invlpg(virt);
+    if (old & PTE_PRESENT)
+        smp_tlb_shootdown(cr3_phys, v & ~0xFFFULL, 1);
+
+    return 0;
+}
+
+int vmm_map_huge_in(uint64_t cr3_phys, void *virt, void *phys, uint64_t flags) {
+    uint64_t v         = (uint64_t)virt;
+    uint64_t p         = (uint64_t)phys;
+    uint64_t pml4_phys = cr3_phys & 0x000ffffffffff000ULL;
+    uint64_t *pml4     = (uint64_t *)virt_from_phys((void *)pml4_phys);
+
+    if ((v | p) & (HUGE_PAGE_SIZE - 1))
+        return -1;
+    flags = leaf_flags(v, flags);
+
+    size_t i4 = (v >> 39) & 0x1FF;
+    size_t i3 = (v >> 30) & 0x1FF;
+    size_t i2 = (v >> 21) & 0x1FF;
+
+    vmm_stats_t *st = space_stats(cr3_phys, v);
+    uint64_t *pdpt = ensure_table(&pml4[i4], NULL, st, flags, 4);
+    if (!pdpt) return -1;
+    uint64_t *pd = ensure_table(&pdpt[i3], &pml4[i4], st, flags, 3);
+    if (!pd) return -1;
+
+    uint64_t old = pd[i2];
+    uint64_t *old_pt = NULL;
+    if ((old & PTE_PRESENT) && !(old & PTE_PSE)) {
+        // An emptied page table can be dropped, a live one cannot
+        old_pt = (uint64_t *)virt_from_phys((void *)(old & 0x000ffffffffff000ULL));
+        if (st && pt_count(old))
+            return -1;
+        for (size_t i = 0; !st && i < 512; i++) {
+            if (old_pt[i] & PTE_PRESENT)
+                return -1;
+        }
+    }
+
+    uint64_t entry_flags = (flags & ~PTE_PAT) | PTE_PSE;
+    if (flags & PTE_PAT)
+        entry_flags |= PTE_PAT_LARGE;
+    pd[i2] = (p & HUGE_PHYS_MASK) | entry_flags;
+    if (!(old & PTE_PRESENT)) {
+        account_leaf(st, &pdpt[i3], 1, HUGE_PAGE_PAGES);
+    } else if (old_pt && st) {
+        st->rss_pages += HUGE_PAGE_PAGES;
+        st->pt_pages--;
+    }
 
+    if ((read_cr3() & 0x000ffffffffff000ULL) == pml4_phys)
+        invlpg(virt);
+    if (old & PTE_PRESENT)
+        smp_tlb_shootdown(v >= 0xFFFF800000000000ULL ? 0 : cr3_phys, v, 1);
+    if (old_pt)
+        pmm_free_pages(old_pt, 1);
     return 0;
 }
 
+void *vmm_unmap_huge_in(uint64_t cr3_phys, void *virt) {
+    uint64_t va        = (uint64_t)virt;
+    uint64_t pml4_phys = cr3_phys & 0x000ffffffffff000ULL;
+
+    size_t i4 = (va >> 39) & 0x1FF;
+    size_t i3 = (va >> 30) & 0x1FF;
+    size_t i2 = (va >> 21) & 0x1FF;
+
+    uint64_t *pml4 = (uint64_t *)virt_from_phys((void *)pml4_phys);
+    if (!(pml4[i4] & PTE_PRESENT)) return NULL;
+    uint64_t *pdpt = (uint64_t *)virt_from_phys((void *)(pml4[i4] & 0x000ffffffffff000ULL));
+    if (!(pdpt[i3] & PTE_PRESENT) || (pdpt[i3] & PTE_PSE)) return NULL;
+    uint64_t *pd = (uint64_t *)virt_from_phys((void *)(pdpt[i3] & 0x000ffffffffff000ULL));
+    if (!(pd[i2] & PTE_PRESENT) || !(pd[i2] & PTE_PSE)) return NULL;
+
+    void *phys = (void *)(pd[i2] & HUGE_PHYS_MASK);
+    pd[i2] = 0;
+
+    vmm_stats_t *st = space_stats(cr3_phys, va);
+    uint64_t *path[] = { &pml4[i4], &pdpt[i3] };
+    tlb_gather_t g = { .cr3 = cr3_phys };
+    account_leaf(st, path[1], -1, HUGE_PAGE_PAGES);
+    gather_range(&g, va & ~(HUGE_PAGE_SIZE - 1), 4096);
+    reclaim_tables(&g, st, va, path, 2);
+    gather_flush(&g);
+    return phys;
+}
+
 /*
  * vmm_unmap_page_in — remove a single PTE from an arbitrary page table.
  *
@@ -132,7 +658,9 @@ int vmm_map_page_in(uint64_t cr3_phys, void *virt, void *phys, uint64_t flags) {
  * can free it.  Returns NULL if the page was not mapped.
  *
  * invlpg is only issued when cr3_phys matches the current address space —
- * same guard used in vmm_map_page_in.
+ * same guard used in vmm_map_page_in.  Other CPUs running the same address
+ * space are flushed through smp_tlb_shootdown().  Page tables left empty
+ * are freed after that flush.
  */
 void *vmm_unmap_page_in(uint64_t cr3_phys, void *virt) {
     uint64_t va        = (uint64_t)virt;
@@ -149,8 +677,19 @@ void *vmm_unmap_page_in(uint64_t cr3_phys, void *virt) {
     uint64_t *pdpt = (uint64_t *)virt_from_phys((void *)(pml4[i4] & 0x000ffffffffff000ULL));
     if (!(pdpt[i3] & PTE_PRESENT)) return NULL;
 
+    vmm_stats_t *st = space_stats(cr3_phys, va);
+    if (pdpt[i3] & PTE_PSE) {
+        if (!split_large(&pdpt[i3], 3, st)) return NULL;
+    }
+
     uint64_t *pd = (uint64_t *)virt_from_phys((void *)(pdpt[i3] & 0x000ffffffffff000ULL));
     if (!(pd[i2] & PTE_PRESENT)) return NULL;
+    // Unmapping part of a huge page leaves the rest mapped with 4 KiB pages.
+    // The frames were allocated page by page in the bitmap, so they can
+    // still be freed one at a time.
+    if (pd[i2] & PTE_PSE) {
+        if (!split_large(&pd[i2], 2, st)) return NULL;
+    }
 
     uint64_t *pt = (uint64_t *)virt_from_phys((void *)(pd[i2] & 0x000ffffffffff000ULL));
     if (!(pt[i1] & PTE_PRESENT)) return NULL;
@@ -158,31 +697,146 @@ void *vmm_unmap_page_in(uint64_t cr3_phys, void *virt) {
     void *phys = (void *)(pt[i1] & 0x000ffffffffff000ULL);
     pt[i1] = 0;
 
-    if ((read_cr3() & 0x000ffffffffff000ULL) == pml4_phys)
-        invlpg(virt);
+    uint64_t *path[] = { &pml4[i4], &pdpt[i3], &pd[i2] };
+    tlb_gather_t g = { .cr3 = cr3_phys };
+    account_leaf(st, path[2], -1, 1);
+    gather_range(&g, va & ~0xFFFULL, 4096);
+    reclaim_tables(&g, st, va, path, 3);
+    gather_flush(&g);
 
     return phys;
 }
 
+// Start of the next region mapped by one entry at `shift` (21: PD entry...)
+static inline uint64_t next_boundary(uint64_t va, int shift) {
+    return (va + (1ULL << shift)) & ~((1ULL << shift) - 1);
+}
+
+void vmm_unmap_range(uint64_t cr3_phys, uint64_t vaddr, size_t pages, int free_frames) {
+    uint64_t *pml4 = (uint64_t *)virt_from_phys((void *)(cr3_phys & 0x000ffffffffff000ULL));
+    uint64_t va = vaddr & ~0xFFFULL;
+    uint64_t end = va + pages * 4096;
+    tlb_gather_t g = { .cr3 = cr3_phys };
+    vmm_stats_t *st = space_stats(cr3_phys, va);
+
+    while (va < end) {
+        size_t i4 = (va >> 39) & 0x1FF;
+        size_t i3 = (va >> 30) & 0x1FF;
+        size_t i2 = (va >> 21) & 0x1FF;
+
+        if (!(pml4[i4] & PTE_PRESENT)) { va = next_boundary(va, 39); continue; }
+        uint64_t *pdpt = (uint64_t *)virt_from_phys((void *)(pml4[i4] & 0x000ffffffffff000ULL));
+        if (!(pdpt[i3] & PTE_PRESENT)) { va = next_boundary(va, 30); continue; }
+        if ((pdpt[i3] & PTE_PSE) && !split_large(&pdpt[i3], 3, st)) break;
+        uint64_t *pd = (uint64_t *)virt_from_phys((void *)(pdpt[i3] & 0x000ffffffffff000ULL));
+        if (!(pd[i2] & PTE_PRESENT)) { va = next_boundary(va, 21); continue; }
+        uint64_t *path[] = { &pml4[i4], &pdpt[i3], &pd[i2] };
+
+        if (pd[i2] & PTE_PSE) {
+            if ((va & (HUGE_PAGE_SIZE - 1)) == 0 && end - va >= HUGE_PAGE_SIZE) {
+                uint64_t e = pd[i2];
+                pd[i2] = 0;
+                account_leaf(st, path[1], -1, HUGE_PAGE_PAGES);
+                gather_range(&g, va, HUGE_PAGE_SIZE);
+                if (free_frames && !(e & PTE_SHARED))
+                    gather_frame(&g, e & HUGE_PHYS_MASK, HUGE_PAGE_PAGES);
+                reclaim_tables(&g, st, va, path, 2);
+                va += HUGE_PAGE_SIZE;
+                continue;
+            }
+            // Partially unmapped, the rest stays mapped with small pages
+            if (!split_large(&pd[i2], 2, st)) break;
+        }
+
+        uint64_t *pt = (uint64_t *)virt_from_phys((void *)(pd[i2] & 0x000ffffffffff000ULL));
+        uint64_t pt_end = next_boundary(va, 21);
+        if (pt_end > end) pt_end = end;
+        for (; va < pt_end; va += 4096) {
+            size_t i1 = (va >> 12) & 0x1FF;
+            uint64_t e = pt[i1];
+            if (!(e & PTE_PRESENT)) continue;
+            pt[i1] = 0;
+            account_leaf(st, path[2], -1, 1);
+            gather_range(&g, va, 4096);
+            if (free_frames && !(e & PTE_SHARED))
+                gather_frame(&g, e & 0x000ffffffffff000ULL, 1);
+        }
+        reclaim_tables(&g, st, va - 4096, path, 3);
+    }
+
+    gather_flush(&g);
+}
+
+// Frames the address space does not own only become writable when the
+// caller says the mapping is shared (page cache pages under MAP_PRIVATE,
+// the vdso)
+static inline uint64_t leaf_prot(uint64_t entry, uint64_t prot, uint64_t flags) {
+    if ((entry & PTE_SHARED) && !(flags & PTE_SHARED))
+        return prot & ~PTE_RW;
+    return prot;
+}
+
+void vmm_protect_range(uint64_t cr3_phys, uint64_t vaddr, size_t pages, uint64_t flags) {
+    uint64_t *pml4 = (uint64_t *)virt_from_phys((void *)(cr3_phys & 0x000ffffffffff000ULL));
+    uint64_t va = vaddr & ~0xFFFULL;
+    uint64_t end = va + pages * 4096;
+    uint64_t prot = flags & VMM_PROT_MASK;
+    tlb_gather_t g = { .cr3 = cr3_phys };
+    vmm_stats_t *st = space_stats(cr3_phys, va);
+
+    while (va < end) {
+        size_t i4 = (va >> 39) & 0x1FF;
+        size_t i3 = (va >> 30) & 0x1FF;
+        size_t i2 = (va >> 21) & 0x1FF;
+
+        if (!(pml4[i4] & PTE_PRESENT)) { va = next_boundary(va, 39); continue; }
+        uint64_t *pdpt = (uint64_t *)virt_from_phys((void *)(pml4[i4] & 0x000ffffffffff000ULL));
+        if (!(pdpt[i3] & PTE_PRESENT)) { va = next_boundary(va, 30); continue; }
+        if ((pdpt[i3] & PTE_PSE) && !split_large(&pdpt[i3], 3, st)) break;
+        uint64_t *pd = (uint64_t *)virt_from_phys((void *)(pdpt[i3] & 0x000ffffffffff000ULL));
+        if (!(pd[i2] & PTE_PRESENT)) { va = next_boundary(va, 21); continue; }
+
+        // Upper levels must not be stricter than the leaves they lead to
+        if (prot & PTE_RW) {
+            pml4[i4] |= PTE_RW;
+            pdpt[i3] |= PTE_RW;
+        }
+
+        if (pd[i2] & PTE_PSE) {
+            if ((va & (HUGE_PAGE_SIZE - 1)) == 0 && end - va >= HUGE_PAGE_SIZE) {
+                pd[i2] = (pd[i2] & ~VMM_PROT_MASK) | leaf_prot(pd[i2], prot, flags);
+                gather_range(&g, va, HUGE_PAGE_SIZE);
+                va += HUGE_PAGE_SIZE;
+                continue;
+            }
+            if (!split_large(&pd[i2], 2, st)) break;
+        }
+        if (prot & PTE_RW)
+            pd[i2] |= PTE_RW;
+
+        uint64_t *pt = (uint64_t *)virt_from_phys((void *)(pd[i2] & 0x000ffffffffff000ULL));
+        uint64_t pt_end = next_boundary(va, 21);
+        if (pt_end > end) pt_end = end;
+        for (; va < pt_end; va += 4096) {
+            size_t i1 = (va >> 12) & 0x1FF;
+            if (!(pt[i1] & PTE_PRESENT)) continue;
+            pt[i1] = (pt[i1] & ~VMM_PROT_MASK) | leaf_prot(pt[i1], prot, flags);
+            gather_range(&g, va, 4096);
+        }
+    }
+
+    gather_flush(&g);
+}
+
 uint64_t vmm_create_user_page_table(void) {
-    void *new_pml4_virt = pmalloc(1);
+    // PML4 followed by the address space's vmm_stats_t, kernel half shared
+    void *new_pml4_virt = pml4_get();
     if (!new_pml4_virt) {
         log("VMM", ERROR, "Failed to allocate PML4\n\r");
         return 0;
     }
 
-    for (size_t i = 0; i < 512; i++)
-        ((uint64_t *)new_pml4_virt)[i] = 0ULL;
-
-    uint64_t *kernel_pml4 = (uint64_t *)virt_from_phys(
-        (void *)(kernel_cr3 & 0x000ffffffffff000ULL));
-    uint64_t *new_pml4 = (uint64_t *)new_pml4_virt;
-
-    /* Share the kernel's higher-half mappings (indices 256–511) */
-    for (size_t i = 256; i < 512; i++)
-        new_pml4[i] = kernel_pml4[i];
-
-    uint64_t new_cr3 = (uint64_t)phys_from_virt(new_pml4_virt);
+    uint64_t new_cr3 = (uint64_t)phys_from_virt(new_pml4_virt) | pcid_alloc();
     log("VMM", INFO, "Created user page table at phys 0x%xl\n\r", new_cr3);
     return new_cr3;
 }
@@ -207,6 +861,14 @@ void vmm_free_user_page_table(uint64_t cr3_phys) {
             for (size_t i2 = 0; i2 < 512; i2++) {
                 if (!(pd[i2] & PTE_PRESENT)) continue;
 
+                if (pd[i2] & PTE_PSE) {
+                    if (!(pd[i2] & PTE_SHARED))
+                        pmm_free_pages(virt_from_phys((void *)(pd[i2] & HUGE_PHYS_MASK)),
+                                       HUGE_PAGE_PAGES);
+                    pd[i2] = 0;
+                    continue;
+                }
+
                 uint64_t *pt = (uint64_t *)virt_from_phys(
                     (void *)(pd[i2] & 0x000ffffffffff000ULL));
 
@@ -214,8 +876,10 @@ void vmm_free_user_page_table(uint64_t cr3_phys) {
                 // before freeing the PT structure page itself.
                 for (size_t i1 = 0; i1 < 512; i1++) {
                     if (!(pt[i1] & PTE_PRESENT)) continue;
-                    void *leaf_phys = (void *)(pt[i1] & 0x000ffffffffff000ULL);
-                    pmm_free_pages(virt_from_phys(leaf_phys), 1);
+                    if (!(pt[i1] & PTE_SHARED)) {
+                        void *leaf_phys = (void *)(pt[i1] & 0x000ffffffffff000ULL);
+                        pmm_free_pages(virt_from_phys(leaf_phys), 1);
+                    }
                     pt[i1] = 0;
                 }
 
@@ -231,9 +895,17 @@ void vmm_free_user_page_table(uint64_t cr3_phys) {
         pml4[i4] = 0;
     }
 
-    pmm_free_pages(pml4, 1);
+    pml4_put(pml4);
+    pcid_free(cr3_phys & 0xFFF);
     log("VMM", INFO, "Freed user page table at phys 0x%xl\n\r", cr3_phys);
 }
+int vmm_get_stats(uint64_t cr3_phys, vmm_stats_t *out) {
+    vmm_stats_t *st = space_stats(cr3_phys, 0);
+    if (!st) return -1;
+    *out = *st;
+    return 0;
+}
+
 uint64_t vmm_get_pte(uint64_t cr3_phys, uint64_t vaddr) {
     uint64_t *pml4 = virt_from_phys((void*)(cr3_phys & 0x000ffffffffff000ULL));
     size_t i4 = (vaddr >> 39) & 0x1FF;
@@ -243,24 +915,93 @@ uint64_t vmm_get_pte(uint64_t cr3_phys, uint64_t vaddr) {
     if (!(pml4[i4] & PTE_PRESENT)) return 0;
     uint64_t *pdpt = virt_from_phys((void*)(pml4[i4] & 0x000ffffffffff000ULL));
     if (!(pdpt[i3] & PTE_PRESENT)) return 0;
+    if (pdpt[i3] & PTE_PSE)
+        return ((pdpt[i3] & GIANT_PHYS_MASK) + (vaddr & 0x3FFFF000ULL)) |
+               large_to_small_flags(pdpt[i3]);
     uint64_t *pd = virt_from_phys((void*)(pdpt[i3] & 0x000ffffffffff000ULL));
     if (!(pd[i2] & PTE_PRESENT)) return 0;
+    if (pd[i2] & PTE_PSE)
+        return ((pd[i2] & HUGE_PHYS_MASK) + (vaddr & 0x1FF000ULL)) |
+               large_to_small_flags(pd[i2]);
     uint64_t *pt = virt_from_phys((void*)(pd[i2] & 0x000ffffffffff000ULL));
     return pt[i1];
 }
+uint64_t vmm_clear_pte_bits(uint64_t cr3_phys, uint64_t vaddr, uint64_t bits) {
+    uint64_t *pml4 = virt_from_phys((void*)(cr3_phys & 0x000ffffffffff000ULL));
+    size_t i4 = (vaddr >> 39) & 0x1FF;
+    size_t i3 = (vaddr >> 30) & 0x1FF;
+    size_t i2 = (vaddr >> 21) & 0x1FF;
+    size_t i1 = (vaddr >> 12) & 0x1FF;
+    if (!(pml4[i4] & PTE_PRESENT)) return 0;
+    uint64_t *pdpt = virt_from_phys((void*)(pml4[i4] & 0x000ffffffffff000ULL));
+    if (!(pdpt[i3] & PTE_PRESENT) || (pdpt[i3] & PTE_PSE)) return 0;
+    uint64_t *pd = virt_from_phys((void*)(pdpt[i3] & 0x000ffffffffff000ULL));
+    if (!(pd[i2] & PTE_PRESENT) || (pd[i2] & PTE_PSE)) return 0;
+    uint64_t *pt = virt_from_phys((void*)(pd[i2] & 0x000ffffffffff000ULL));
+
+    uint64_t old = pt[i1];
+    if (!(old & PTE_PRESENT) || !(old & bits)) return old;
+    pt[i1] = old & ~bits;
+
+    // A cached translation would keep the bits set behind our back
+    tlb_gather_t g = { .cr3 = cr3_phys };
+    gather_range(&g, vaddr & ~0xFFFULL, 4096);
+    gather_flush(&g);
+    return old;
+}
+
+// Copy a 2 MiB page for a forked child, as a huge page if an aligned run
+// is free and as 512 small pages otherwise
+static int clone_huge(uint64_t *c_entry, uint64_t *c_owner, vmm_stats_t *st, uint64_t p_entry) {
+    if (p_entry & PTE_SHARED) {
+        *c_entry = p_entry;
+        account_leaf(st, c_owner, 1, HUGE_PAGE_PAGES);
+        return 0;
+    }
+
+    uint8_t *src = virt_from_phys((void *)(p_entry & HUGE_PHYS_MASK));
+    void *frame = pmalloc_aligned(HUGE_PAGE_PAGES, HUGE_PAGE_PAGES);
+    if (frame) {
+        memcpy(frame, src, HUGE_PAGE_SIZE);
+        *c_entry = ((uint64_t)phys_from_virt(frame) & HUGE_PHYS_MASK) |
+                   (p_entry & ~HUGE_PHYS_MASK);
+        account_leaf(st, c_owner, 1, HUGE_PAGE_PAGES);
+        return 0;
+    }
+
+    uint64_t *pt = pcalloc(1);
+    if (!pt) return -1;
+    *c_entry = ((uint64_t)phys_from_virt(pt) & 0x000ffffffffff000ULL) |
+               (p_entry & (PTE_PRESENT | PTE_RW | PTE_USER));
+    pt_count_add(c_owner, 1);
+    st->pt_pages++;
+    uint64_t flags = large_to_small_flags(p_entry);
+    for (size_t i = 0; i < 512; i++) {
+        void *page = pmalloc(1);
+        if (!page) return -1;
+        copy_page(page, src + i * 4096);
+        pt[i] = ((uint64_t)phys_from_virt(page) & 0x000ffffffffff000ULL) | flags;
+        account_leaf(st, c_entry, 1, 1);
+    }
+    return 0;
+}
+
 uint64_t vmm_clone_user_page_table(uint64_t parent_cr3_phys) {
     uint64_t child_cr3_phys = vmm_create_user_page_table();
     if (!child_cr3_phys) return 0;
 
-    uint64_t *p_pml4 = (uint64_t *)virt_from_phys((void *)parent_cr3_phys);
-    uint64_t *c_pml4 = (uint64_t *)virt_from_phys((void *)child_cr3_phys);
+    uint64_t *p_pml4 = (uint64_t *)virt_from_phys(
+        (void *)(parent_cr3_phys & 0x000ffffffffff000ULL));
+    uint64_t *c_pml4 = (uint64_t *)virt_from_phys(
+        (void *)(child_cr3_phys & 0x000ffffffffff000ULL));
+    vmm_stats_t *st = space_stats(child_cr3_phys, 0);
 
     for (int i4 = 0; i4 < 256; i4++) {
         if (!(p_pml4[i4] & PTE_PRESENT)) continue;
 
         uint64_t *p_pdpt = (uint64_t *)virt_from_phys(
             (void *)(p_pml4[i4] & 0x000ffffffffff000ULL));
-        uint64_t *c_pdpt = ensure_table(&c_pml4[i4], p_pml4[i4] & 0xFFF);
+        uint64_t *c_pdpt = ensure_table(&c_pml4[i4], NULL, st, p_pml4[i4] & 0xFFF, 4);
         if (!c_pdpt) goto fail;
 
         for (int i3 = 0; i3 < 512; i3++) {
@@ -268,30 +1009,43 @@ uint64_t vmm_clone_user_page_table(uint64_t parent_cr3_phys) {
 
             uint64_t *p_pd = (uint64_t *)virt_from_phys(
                 (void *)(p_pdpt[i3] & 0x000ffffffffff000ULL));
-            uint64_t *c_pd = ensure_table(&c_pdpt[i3], p_pdpt[i3] & 0xFFF);
+            uint64_t *c_pd = ensure_table(&c_pdpt[i3], &c_pml4[i4], st,
+                                         p_pdpt[i3] & 0xFFF, 3);
             if (!c_pd) goto fail;
 
             for (int i2 = 0; i2 < 512; i2++) {
                 if (!(p_pd[i2] & PTE_PRESENT)) continue;
 
+                if (p_pd[i2] & PTE_PSE) {
+                    if (clone_huge(&c_pd[i2], &c_pdpt[i3], st, p_pd[i2]) != 0) goto fail;
+                    continue;
+                }
+
                 uint64_t *p_pt = (uint64_t *)virt_from_phys(
                     (void *)(p_pd[i2] & 0x000ffffffffff000ULL));
-                uint64_t *c_pt = ensure_table(&c_pd[i2], p_pd[i2] & 0xFFF);
+                uint64_t *c_pt = ensure_table(&c_pd[i2], &c_pdpt[i3], st,
+                                             p_pd[i2] & 0xFFF, 2);
                 if (!c_pt) goto fail;
 
                 for (int i1 = 0; i1 < 512; i1++) {
                     if (!(p_pt[i1] & PTE_PRESENT)) continue;
+                    if (p_pt[i1] & PTE_SHARED) {
+                        c_pt[i1] = p_pt[i1];
+                        account_leaf(st, &c_pd[i2], 1, 1);
+                        continue;
+                    }
 
                     void *new_frame_virt = pmalloc(1);
                     if (!new_frame_virt) goto fail;
 
                     uint64_t old_frame_phys = p_pt[i1] & 0x000ffffffffff000ULL;
                     void *old_frame_virt    = virt_from_phys((void *)old_frame_phys);
-                    memcpy(new_frame_virt, old_frame_virt, 4096);
+                    copy_page(new_frame_virt, old_frame_virt);
 
                     uint64_t new_frame_phys = (uint64_t)phys_from_virt(new_frame_virt);
                     c_pt[i1] = (new_frame_phys & 0x000ffffffffff000ULL)
                                | (p_pt[i1] & 0xFFF);
+                    account_leaf(st, &c_pd[i2], 1, 1);
                 }
             }
         }
@@ -45,7 +45,7 @@ cd source
 echo "Compiling Discitix runtime..."
 
 x86_64-linux-gnu-gcc -Iusr/include -nostdlib -ffreestanding -mno-red-zone -fno-pic -no-pie -c crt.c -o usr/lib/crt0.o
-x86_64-linux-gnu-gcc -Iusr/include -nostdlib -ffreestanding -mno-red-zone -fno-pic -no-pie -c stubs.c -o usr/lib/stubs.o
+x86_64-linux-gnu-gcc -Iusr/include -Iinclude -nostdlib -ffreestanding -mno-red-zone -fno-pic -no-pie -c stubs.c -o usr/lib/stubs.o
 x86_64-linux-gnu-ar rcs usr/lib/libc.a usr/lib/stubs.o
 
 echo "Done!"
@@ -21,6 +21,8 @@ struct dirent {
 extern DIR *opendir(const char *name);
 extern struct dirent *readdir(DIR *dirp);
 extern int closedir(DIR *dirp);
+/* Batched stat() through the syscall ring, see stubs.c */
+extern int stat_many(int n, const char *const paths[], struct stat bufs[], int results[]);
 
 #define CLR_RESET "\033[0m"
 #define CLR_BLUE  "\033[1;34m"
@@ -113,37 +115,65 @@ static void list_dir(const char *path, int long_fmt, int show_all, int human)
 
     struct dirent *ent;
     FileEntry *entries = NULL;
+    char (*paths)[512] = NULL;
     int count = 0;
     int capacity = 0;
     int max_len = 0;
 
+    /* Collect the names first so every stat goes out in one batch */
     while ((ent = readdir(dir)) != NULL) {
         if (!show_all && ent->d_name[0] == '.')
             continue;
 
-        char fullpath[512];
-        struct stat st;
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, ent->d_name);
-
-        if (stat(fullpath, &st) < 0)
-            continue;
-
         if (count >= capacity) {
             capacity = capacity == 0 ? 64 : capacity * 2;
             entries = realloc(entries, capacity * sizeof(FileEntry));
+            paths = realloc(paths, capacity * sizeof(*paths));
         }
 
         strncpy(entries[count].name, ent->d_name, sizeof(entries[count].name));
-        entries[count].mode = st.st_mode;
-        entries[count].size = st.st_size;
+        snprintf(paths[count], sizeof(paths[count]), "%s/%s", path, ent->d_name);
+        count++;
+    }
+    closedir(dir);
+
+    if (count == 0) {
+        free(entries);
+        free(paths);
+        return;
+    }
+
+    const char **path_ptrs = malloc(count * sizeof(char *));
+    struct stat *st = malloc(count * sizeof(struct stat));
+    int *res = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++)
+        path_ptrs[i] = paths[i];
+
+    if (stat_many(count, path_ptrs, st, res) < 0) {
+        for (int i = 0; i < count; i++)
+            res[i] = stat(paths[i], &st[i]);
+    }
 
-        int len = strlen(ent->d_name);
+    /* Drop entries that failed to stat, as before */
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (res[i] < 0)
+            continue;
+        entries[kept] = entries[i];
+        entries[kept].mode = st[i].st_mode;
+        entries[kept].size = st[i].st_size;
+
+        int len = strlen(entries[kept].name);
         if (len > max_len) {
             max_len = len;
         }
-        count++;
+        kept++;
     }
-    closedir(dir);
+    count = kept;
+    free(path_ptrs);
+    free(st);
+    free(res);
+    free(paths);
 
     if (count == 0) {
         free(entries);
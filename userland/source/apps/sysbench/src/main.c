@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vdso.h>
+
+// Round-trip cost of a null system call (getpid) through both entry paths
+
+#define SYS_GETPID 20
+#define DEFAULT_ITERATIONS 100000
+
+static inline long getpid_syscall(void){
+  long ret;
+  asm volatile("syscall" : "=a"(ret) : "a"(SYS_GETPID) : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long getpid_int80(void){
+  long ret;
+  asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_GETPID) : "rcx", "r11", "memory");
+  return ret;
+}
+
+int main(int argc, char** argv){
+  long iterations = DEFAULT_ITERATIONS;
+  if(argc > 1){
+    iterations = atol(argv[1]);
+    if(iterations <= 0){
+      printf("Usage: sysbench [iterations]\n");
+      return 1;
+    }
+  }
+
+  // Warm up both paths
+  getpid_syscall();
+  getpid_int80();
+
+  uint64_t start = rdtsc();
+  for(long i = 0; i < iterations; i++)
+    getpid_syscall();
+  uint64_t fast = rdtsc() - start;
+
+  start = rdtsc();
+  for(long i = 0; i < iterations; i++)
+    getpid_int80();
+  uint64_t slow = rdtsc() - start;
+
+  printf("%ld calls\n", iterations);
+  printf("syscall/sysret: %lu cycles/call\n", (unsigned long)(fast / iterations));
+  printf("int 0x80/iretq: %lu cycles/call\n", (unsigned long)(slow / iterations));
+  if(fast)
+    printf("speedup: %lu.%02lux\n", (unsigned long)(slow / fast), (unsigned long)((slow * 100 / fast) % 100));
+  return EXIT_SUCCESS;
+}
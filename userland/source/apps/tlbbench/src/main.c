@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vdso.h>
+
+// TLB refill cost after a context switch. Spinner children keep every CPU
+// busy so the timer switches us out; each time we come back the first
+// sweep over the working set is timed against a warm one. With PCIDs the
+// entries survive the switch and the two are close.
+
+#define PAGE 4096
+#define DEFAULT_PAGES 64
+#define DEFAULT_SPINNERS 8
+#define SAMPLES 64
+#define RUN_SECONDS 5
+
+extern int waitpid(int pid, int *status, int options);
+
+static uint64_t sweep(volatile uint8_t* buf, int pages){
+  uint64_t start = rdtsc();
+  for(int i = 0; i < pages; i++)
+    (void)buf[i * PAGE];
+  return rdtsc() - start;
+}
+
+int main(int argc, char** argv){
+  int pages = argc > 1 ? atoi(argv[1]) : DEFAULT_PAGES;
+  int spinners = argc > 2 ? atoi(argv[2]) : DEFAULT_SPINNERS;
+  if(pages <= 0 || spinners <= 0){
+    printf("Usage: tlbbench [pages] [spinners]\n");
+    return 1;
+  }
+
+  const struct vdso_data* vd = (const struct vdso_data*)VDSO_DATA_VADDR;
+  volatile uint8_t* buf = malloc((size_t)pages * PAGE);
+  if(!buf){
+    printf("tlbbench: out of memory\n");
+    return 1;
+  }
+  for(int i = 0; i < pages; i++)
+    buf[i * PAGE] = 1;
+
+  uint64_t stop = vd->ticks + RUN_SECONDS * vd->tick_hz;
+  int* pids = malloc(sizeof(int) * spinners);
+  for(int i = 0; i < spinners; i++){
+    pids[i] = fork();
+    if(pids[i] == 0){
+      while(vd->ticks < stop)
+        ;
+      _exit(0);
+    }
+  }
+
+  uint64_t cold = 0, warm = 0;
+  int samples = 0;
+  uint64_t last = vd->ticks;
+  while(samples < SAMPLES && vd->ticks < stop){
+    // A gap of more than one tick means another task ran in between
+    uint64_t now = vd->ticks;
+    if(now - last < 2){
+      last = now;
+      continue;
+    }
+    cold += sweep(buf, pages);
+    warm += sweep(buf, pages);
+    samples++;
+    last = vd->ticks;
+  }
+
+  for(int i = 0; i < spinners; i++)
+    waitpid(pids[i], NULL, 0);
+
+  if(!samples){
+    printf("tlbbench: no context switches seen, try more spinners\n");
+    return 1;
+  }
+  printf("%d pages, %d switches sampled\n", pages, samples);
+  printf("first sweep after switch: %lu cycles\n", (unsigned long)(cold / samples));
+  printf("warm sweep:               %lu cycles\n", (unsigned long)(warm / samples));
+  if(cold > warm)
+    printf("refill cost: %lu cycles/page\n", (unsigned long)((cold - warm) / samples / pages));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <vdso.h>
+
+// Terminal output throughput: write() large buffers of text lines to
+// stdout, once plain and once with a colour change on every line, and
+// report MB/s from the TSC rate the vDSO publishes.
+
+#define DEFAULT_KIB 1024
+#define DEFAULT_CHUNK 4096
+#define LINE 72
+
+// Fill buf with whole lines, each starting with an SGR sequence if colour
+static size_t fill(char* buf, size_t size, int colour){
+  size_t n = 0;
+  int line = 0;
+  while(n + LINE + 16 <= size){
+    if(colour)
+      n += sprintf(buf + n, "\033[%dm", 31 + line % 7);
+    for(int i = 0; i < LINE; i++)
+      buf[n++] = 'a' + (line + i) % 26;
+    buf[n++] = '\n';
+    line++;
+  }
+  if(colour)
+    n += sprintf(buf + n, "\033[0m");
+  return n;
+}
+
+static uint64_t run(const char* buf, size_t len, size_t total, uint64_t* written){
+  uint64_t start = rdtsc();
+  *written = 0;
+  while(*written < total){
+    if(write(1, buf, len) != (long)len)
+      break;
+    *written += len;
+  }
+  return rdtsc() - start;
+}
+
+static void report(const char* name, uint64_t bytes, uint64_t cycles, uint64_t tsc_hz){
+  // MB/s with two decimals, in integers
+  uint64_t rate = cycles ? bytes * 100 / 1000 * (tsc_hz / 1000) / cycles : 0;
+  printf("%s: %lu bytes, %lu cycles, %lu.%02lu MB/s\n", name, (unsigned long)bytes,
+         (unsigned long)cycles, (unsigned long)(rate / 100), (unsigned long)(rate % 100));
+}
+
+int main(int argc, char** argv){
+  long kib = argc > 1 ? atol(argv[1]) : DEFAULT_KIB;
+  long chunk = argc > 2 ? atol(argv[2]) : DEFAULT_CHUNK;
+  if(kib <= 0 || chunk < LINE + 32){
+    printf("Usage: ttybench [KiB] [chunk bytes]\n");
+    return 1;
+  }
+
+  const struct vdso_data* vd = (const struct vdso_data*)VDSO_DATA_VADDR;
+  char* plain = malloc(chunk);
+  char* colour = malloc(chunk);
+  if(!plain || !colour){
+    printf("ttybench: out of memory\n");
+    return 1;
+  }
+  size_t plain_len = fill(plain, chunk, 0);
+  size_t colour_len = fill(colour, chunk, 1);
+  uint64_t total = (uint64_t)kib * 1024;
+
+  uint64_t plain_bytes, colour_bytes;
+  uint64_t plain_cycles = run(plain, plain_len, total, &plain_bytes);
+  uint64_t colour_cycles = run(colour, colour_len, total, &colour_bytes);
+
+  printf("\n%ld KiB in %ld byte writes, TSC %lu Hz\n", kib, chunk, (unsigned long)vd->tsc_hz);
+  report("plain ", plain_bytes, plain_cycles, vd->tsc_hz);
+  report("colour", colour_bytes, colour_cycles, vd->tsc_hz);
+  return EXIT_SUCCESS;
+}
@@ -10,7 +10,7 @@ void _start(void) {
         "call main\n\t"
         "mov %eax, %edi\n\t"
         "mov $0, %rax\n\t"
-        "int $0x80\n\t"
+        "syscall\n\t"
         "1:\n\t"
         "pause\n\t"
         "jmp 1b\n\t"
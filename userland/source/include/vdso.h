@@ -0,0 +1,27 @@
+#ifndef _DISCITIX_VDSO_H
+#define _DISCITIX_VDSO_H
+
+#include <stdint.h>
+
+// Clock page the kernel maps read-only into every process. Mirrors
+// vdso_data_t in the kernel's include/kernel/vdso.h; seq is odd while
+// the kernel is updating the page.
+#define VDSO_DATA_VADDR 0x00007FFFFFFFE000ULL
+
+struct vdso_data {
+    volatile uint32_t seq;
+    uint32_t tick_hz;
+    uint64_t tsc_hz;
+    uint64_t boot_epoch;
+    volatile uint64_t ticks;
+    volatile uint64_t tick_tsc;
+};
+
+// TSC read, ordered after every earlier instruction
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
@@ -2,9 +2,12 @@
 #include <sys/stat.h>
 #include <sys/times.h>
 #include <sys/fcntl.h>
+#include <sys/time.h>
+#include <time.h>
 #include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <vdso.h>
 
 #undef errno
 extern int errno;
@@ -32,28 +35,36 @@ extern int errno;
 #define SYS_MKDIR      17
 #define SYS_UNLINK     18
 #define SYS_LSEEK      19
+#define SYS_GETPID     20
+#define SYS_IO_SETUP   21
+#define SYS_IO_ENTER   22
+#define SYS_MPROTECT   23
+#define SYS_MSYNC      24
+
+// All helpers enter through SYSCALL; the kernel clobbers rcx (return rip)
+// and r11 (saved rflags). int $0x80 is still accepted by the kernel.
 
 static inline long _syscall0(long num) {
     long ret;
-    asm volatile("int $0x80" : "=a"(ret) : "a"(num) : "rcx", "r11", "memory");
+    asm volatile("syscall" : "=a"(ret) : "a"(num) : "rcx", "r11", "memory");
     return ret;
 }
 
 static inline long _syscall1(long num, long arg1) {
     long ret;
-    asm volatile("int $0x80" : "=a"(ret) : "a"(num), "D"(arg1) : "rcx", "r11", "memory");
+    asm volatile("syscall" : "=a"(ret) : "a"(num), "D"(arg1) : "rcx", "r11", "memory");
     return ret;
 }
 
 static inline long _syscall2(long num, long arg1, long arg2) {
     long ret;
-    asm volatile("int $0x80" : "=a"(ret) : "a"(num), "D"(arg1), "S"(arg2) : "rcx", "r11", "memory");
+    asm volatile("syscall" : "=a"(ret) : "a"(num), "D"(arg1), "S"(arg2) : "rcx", "r11", "memory");
     return ret;
 }
 
 static inline long _syscall3(long num, long arg1, long arg2, long arg3) {
     long ret;
-    asm volatile("int $0x80" : "=a"(ret) : "a"(num), "D"(arg1), "S"(arg2), "d"(arg3) : "rcx", "r11", "memory");
+    asm volatile("syscall" : "=a"(ret) : "a"(num), "D"(arg1), "S"(arg2), "d"(arg3) : "rcx", "r11", "memory");
     return ret;
 }
 
@@ -64,7 +75,7 @@ static inline long _syscall6(long num, long arg1, long arg2, long arg3,
     register long r8 asm("r8") = arg5;
     register long r9 asm("r9") = arg6;
     asm volatile(
-        "int $0x80"
+        "syscall"
         : "=a"(ret)
         : "a"(num), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8), "r"(r9)
         : "rcx", "r11", "memory"
@@ -171,9 +182,12 @@ void _exit(int status) {
     }
 }
 
+static int cached_pid = 0;
+
 int fork(void) {
     long ret = _syscall0(SYS_FORK);
     if (ret < 0) { errno = (int)-ret; return -1; }
+    if (ret == 0) cached_pid = 0; // child: our pid changed
     return (int)ret;
 }
 
@@ -194,8 +208,11 @@ int waitpid(int pid, int *status, int options) {
     }
 }
 
+// A process's pid never changes (exec keeps it), ask the kernel once
 int getpid(void) {
-    return 1; // Default fallback representation until SYS_GETPID implementation
+    if (!cached_pid)
+        cached_pid = (int)_syscall0(SYS_GETPID);
+    return cached_pid;
 }
 
 // Custom Extension Hook (Optional utility preservation)
@@ -257,6 +274,18 @@ int munmap(void *addr, size_t length) {
     return (int)ret;
 }
 
+int mprotect(void *addr, size_t length, int prot) {
+    long ret = _syscall3(SYS_MPROTECT, (long)addr, (long)length, (long)prot);
+    if (ret < 0) { errno = (int)-ret; return -1; }
+    return 0;
+}
+
+int msync(void *addr, size_t length, int flags) {
+    long ret = _syscall3(SYS_MSYNC, (long)addr, (long)length, (long)flags);
+    if (ret < 0) { errno = (int)-ret; return -1; }
+    return 0;
+}
+
 // ============================================================================
 // 6. DIRECTORY MANAGEMENT LAYERS
 // ============================================================================
@@ -431,10 +460,59 @@ off_t lseek(int fd, off_t offset, int whence) {
 
 
 
+// ============================================================================
+// 8. VDSO CLOCK (no kernel entry)
+// ============================================================================
+// Nanoseconds since boot: last tick plus the TSC cycles elapsed since then
+static uint64_t _vdso_uptime_ns(const struct vdso_data **out) {
+    const struct vdso_data *vd = (const struct vdso_data *)VDSO_DATA_VADDR;
+    uint32_t seq;
+    uint64_t ticks, tick_tsc, now;
+    do {
+        while ((seq = vd->seq) & 1)
+            asm volatile("pause");
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        ticks = vd->ticks;
+        tick_tsc = vd->tick_tsc;
+        now = rdtsc();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (vd->seq != seq);
+
+    uint64_t tick_ns = 1000000000ULL / vd->tick_hz;
+    uint64_t ns = ticks * tick_ns;
+    if (vd->tsc_hz && now > tick_tsc) {
+        uint64_t delta = (now - tick_tsc) * 1000000000ULL / vd->tsc_hz;
+        // Never run past the next tick, keeps the clock monotonic
+        ns += delta < tick_ns ? delta : tick_ns - 1;
+    }
+    *out = vd;
+    return ns;
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp) {
+    if (!tp) { errno = EFAULT; return -1; }
+    const struct vdso_data *vd;
+    uint64_t ns = _vdso_uptime_ns(&vd);
+
+    if (clock_id == CLOCK_REALTIME) {
+        tp->tv_sec = vd->boot_epoch + ns / 1000000000ULL;
+    } else if (clock_id == CLOCK_MONOTONIC) {
+        tp->tv_sec = ns / 1000000000ULL;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    tp->tv_nsec = ns % 1000000000ULL;
+    return 0;
+}
+
 int gettimeofday(struct timeval *restrict tv, void *restrict tz) {
+    (void)tz;
     if (tv) {
-        tv->tv_sec = 0;  
-        tv->tv_usec = 0;
+        const struct vdso_data *vd;
+        uint64_t ns = _vdso_uptime_ns(&vd);
+        tv->tv_sec = vd->boot_epoch + ns / 1000000000ULL;
+        tv->tv_usec = (ns % 1000000000ULL) / 1000;
     }
     return 0;
 }
@@ -452,3 +530,182 @@ int getuid(void) { return 0; }
 int geteuid(void) { return 0; }
 int getgid(void) { return 0; }
 int getegid(void) { return 0; }
+
+// ============================================================================
+// 9. BATCHED SYSCALLS (submission/completion ring)
+// ============================================================================
+// Mirrors the kernel's include/arch/x86_64/ioring.h
+#define IORING_OP_READ   1
+#define IORING_OP_WRITE  2
+#define IORING_OP_STAT   5
+
+#define IOSQE_LINK          (1 << 0)
+#define IOSQE_LEN_FROM_PREV (1 << 1)
+
+#define IORING_ENTRIES 64
+
+struct io_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t addr;
+    uint64_t addr2;
+    uint32_t len;
+    uint32_t op_flags;
+    uint64_t user_data;
+};
+
+struct io_cqe {
+    uint64_t user_data;
+    int64_t res;
+};
+
+struct io_ring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_entries;
+    uint32_t sq_off;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_entries;
+    uint32_t cq_off;
+    uint64_t nr_enters;
+    uint64_t nr_sqes;
+};
+
+static struct io_ring *ioring = NULL;
+
+static int _ioring_get(void) {
+    if (ioring) return 0;
+    long ret = _syscall1(SYS_IO_SETUP, IORING_ENTRIES);
+    if (ret < 0) { errno = (int)-ret; return -1; }
+    ioring = (struct io_ring *)ret;
+    return 0;
+}
+
+// Queue one SQE; the caller makes sure no more than sq_entries are pending
+static void _ioring_queue(uint8_t op, uint8_t flags, int fd, const void *addr,
+                          const void *addr2, uint32_t len, uint64_t user_data) {
+    struct io_sqe *sq = (struct io_sqe *)((char *)ioring + ioring->sq_off);
+    uint32_t tail = ioring->sq_tail;
+    struct io_sqe *sqe = &sq[tail & (ioring->sq_entries - 1)];
+    sqe->opcode = op;
+    sqe->flags = flags;
+    sqe->reserved = 0;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)addr;
+    sqe->addr2 = (uint64_t)addr2;
+    sqe->len = len;
+    sqe->op_flags = 0;
+    sqe->user_data = user_data;
+    __atomic_store_n(&ioring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Submit everything queued and hand each completion to `fn`
+static int _ioring_submit(void (*fn)(uint64_t user_data, int64_t res, void *ctx), void *ctx) {
+    uint32_t pending = ioring->sq_tail - ioring->sq_head;
+    long ret = _syscall1(SYS_IO_ENTER, pending);
+    if (ret < 0) { errno = (int)-ret; return -1; }
+
+    struct io_cqe *cq = (struct io_cqe *)((char *)ioring + ioring->cq_off);
+    uint32_t head = ioring->cq_head;
+    uint32_t tail = __atomic_load_n(&ioring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_cqe *cqe = &cq[head & (ioring->cq_entries - 1)];
+        fn(cqe->user_data, cqe->res, ctx);
+    }
+    __atomic_store_n(&ioring->cq_head, head, __ATOMIC_RELEASE);
+    return (int)ret;
+}
+
+#define SENDFILE_CHUNK  4096
+#define SENDFILE_CHUNKS (IORING_ENTRIES / 2)
+
+static char sendfile_buf[SENDFILE_CHUNKS][SENDFILE_CHUNK];
+
+struct sendfile_ctx {
+    int64_t read_res[SENDFILE_CHUNKS];
+    int64_t write_res[SENDFILE_CHUNKS];
+};
+
+static void _sendfile_cqe(uint64_t user_data, int64_t res, void *arg) {
+    struct sendfile_ctx *ctx = arg;
+    if (user_data & 1)
+        ctx->write_res[user_data / 2] = res;
+    else
+        ctx->read_res[user_data / 2] = res;
+}
+
+// Copy up to `count` bytes from in_fd to out_fd. Each kernel entry moves
+// SENDFILE_CHUNKS chunks as one chain of READ -> WRITE pairs, each WRITE
+// taking its length from the READ before it. A failed READ or a short
+// WRITE cancels the rest of the chain; the unwritten tail of that chunk is
+// finished with write() here, so nothing read is dropped. Returns bytes
+// written, 0 at end of file.
+long sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    if (offset) { errno = EINVAL; return -1; }
+    if (_ioring_get() < 0) return -1;
+
+    struct sendfile_ctx ctx;
+    uint32_t lens[SENDFILE_CHUNKS];
+    int chunks = 0;
+    size_t queued = 0;
+    for (; chunks < SENDFILE_CHUNKS && queued < count; chunks++) {
+        uint32_t len = count - queued < SENDFILE_CHUNK ? count - queued : SENDFILE_CHUNK;
+        char *buf = sendfile_buf[chunks];
+        _ioring_queue(IORING_OP_READ, IOSQE_LINK, in_fd, buf, NULL, len, 2 * chunks);
+        _ioring_queue(IORING_OP_WRITE, IOSQE_LINK | IOSQE_LEN_FROM_PREV, out_fd, buf, NULL, 0,
+                      2 * chunks + 1);
+        lens[chunks] = len;
+        ctx.read_res[chunks] = ctx.write_res[chunks] = -EIO;  // Until its CQE arrives
+        queued += len;
+    }
+    if (_ioring_submit(_sendfile_cqe, &ctx) < 0) return -1;
+
+    long written = 0;
+    int error = 0;
+    for (int i = 0; i < chunks; i++) {
+        int64_t r = ctx.read_res[i];
+        int64_t w = ctx.write_res[i];
+        if (r < 0) { error = (int)-r; break; }
+        if (w < 0) { error = (int)-w; break; }
+        written += w;
+        while (w < r) {
+            long n = write(out_fd, sendfile_buf[i] + w, r - w);
+            if (n <= 0) { error = n < 0 ? errno : EIO; break; }
+            w += n;
+            written += n;
+        }
+        if (w < r || r < lens[i]) break;
+    }
+    if (error && !written) { errno = error; return -1; }
+    return written;
+}
+
+struct stat_many_ctx {
+    int *results;
+    struct kernel_stat *kst;
+    struct stat *bufs;
+};
+
+static void _stat_many_cqe(uint64_t user_data, int64_t res, void *arg) {
+    struct stat_many_ctx *ctx = arg;
+    ctx->results[user_data] = res < 0 ? -1 : 0;
+    if (res >= 0) _translate_stat(&ctx->bufs[user_data], &ctx->kst[user_data]);
+}
+
+// stat() n paths, IORING_ENTRIES per kernel entry. results[i] is 0 or -1.
+int stat_many(int n, const char *const paths[], struct stat bufs[], int results[]) {
+    if (_ioring_get() < 0) return -1;
+
+    struct kernel_stat kst[IORING_ENTRIES];
+    for (int base = 0; base < n; base += IORING_ENTRIES) {
+        int batch = n - base < IORING_ENTRIES ? n - base : IORING_ENTRIES;
+        struct stat_many_ctx ctx = { results + base, kst, bufs + base };
+        for (int i = 0; i < batch; i++)
+            _ioring_queue(IORING_OP_STAT, 0, 0, paths[base + i], &kst[i], 0, i);
+        if (_ioring_submit(_stat_many_cqe, &ctx) < 0) return -1;
+    }
+    return 0;
+}